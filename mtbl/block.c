@@ -125,6 +125,20 @@ block_destroy(struct block **b)
 	}
 }
 
+/*
+ * Transfer ownership of the block's contents to the caller, who must free them
+ * once the block has been destroyed. Returns NULL if the block does not own
+ * its contents.
+ */
+uint8_t *
+block_detach(struct block *b)
+{
+	if (!b->needs_free)
+		return (NULL);
+	b->needs_free = false;
+	return (b->data);
+}
+
 struct block_iter *
 block_iter_init(struct block *b)
 {
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "mtbl-private.h"
+#include "vector_types.h"
+
+/*
+ * A struct mtbl_buf is a library-owned ubuf handed to merge functions, which
+ * reuses its allocation from one merge to the next.
+ */
+
+#define as_ubuf(b) ((ubuf *) (b))
+
+/* Buffers created by the caller, e.g. for mtbl_writer_init_buf(). */
+struct mtbl_buf *
+mtbl_buf_init(void)
+{
+	return ((struct mtbl_buf *) ubuf_init(64));
+}
+
+void
+mtbl_buf_destroy(struct mtbl_buf **b)
+{
+	ubuf_destroy((ubuf **) b);
+}
+
+uint8_t *
+mtbl_buf_data(struct mtbl_buf *b)
+{
+	return (ubuf_data(as_ubuf(b)));
+}
+
+size_t
+mtbl_buf_size(struct mtbl_buf *b)
+{
+	return (ubuf_size(as_ubuf(b)));
+}
+
+void
+mtbl_buf_append(struct mtbl_buf *b, const uint8_t *data, size_t len)
+{
+	ubuf_append(as_ubuf(b), data, len);
+}
+
+uint8_t *
+mtbl_buf_extend(struct mtbl_buf *b, size_t len)
+{
+	/* ubuf_clip() can only shrink the buffer, so it is grown by advancing */
+	ubuf_reserve(as_ubuf(b), len);
+	uint8_t *p = ubuf_data(as_ubuf(b)) + ubuf_size(as_ubuf(b));
+	ubuf_advance(as_ubuf(b), len);
+	return (p);
+}
+
+void
+mtbl_buf_clip(struct mtbl_buf *b, size_t len)
+{
+	ubuf_clip(as_ubuf(b), len);
+}
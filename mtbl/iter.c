@@ -18,8 +18,18 @@
 
 struct mtbl_iter {
 	mtbl_iter_next_func	iter_next;
+	mtbl_iter_seek_func	iter_seek;
+	mtbl_iter_next_batch_func iter_next_batch;
 	mtbl_iter_free_func	iter_free;
+	iter_pin_func		iter_pin;
 	void			*clos;
+
+	/* entry read ahead by a seek without an iter_seek function */
+	bool			pending;
+	const uint8_t		*key;
+	const uint8_t		*val;
+	size_t			len_key;
+	size_t			len_val;
 };
 
 struct mtbl_iter *
@@ -32,13 +42,41 @@ mtbl_iter_init(mtbl_iter_next_func iter_next,
 	it->iter_next = iter_next;
 	it->iter_free = iter_free;
 	it->clos = clos;
+	PROBE1(iter__create, it);
 	return (it);
 }
 
+void
+mtbl_iter_set_seek_func(struct mtbl_iter *it, mtbl_iter_seek_func iter_seek)
+{
+	it->iter_seek = iter_seek;
+}
+
+void
+mtbl_iter_set_next_batch_func(struct mtbl_iter *it, mtbl_iter_next_batch_func iter_next_batch)
+{
+	it->iter_next_batch = iter_next_batch;
+}
+
+void
+iter_set_pin_func(struct mtbl_iter *it, iter_pin_func fp)
+{
+	it->iter_pin = fp;
+}
+
+struct mtbl_pin *
+iter_pin(struct mtbl_iter *it)
+{
+	if (it->iter_pin == NULL)
+		return (NULL);
+	return (it->iter_pin(it->clos));
+}
+
 void
 mtbl_iter_destroy(struct mtbl_iter **it)
 {
 	if (*it) {
+		PROBE1(iter__destroy, *it);
 		if ((*it)->iter_free != NULL)
 			(*it)->iter_free((*it)->clos);
 		free(*it);
@@ -53,5 +91,82 @@ mtbl_iter_next(struct mtbl_iter *it,
 {
 	if (it == NULL)
 		return (mtbl_res_failure);
+	if (it->pending) {
+		it->pending = false;
+		*key = it->key;
+		*len_key = it->len_key;
+		*val = it->val;
+		*len_val = it->len_val;
+		return (mtbl_res_success);
+	}
 	return (it->iter_next(it->clos, key, len_key, val, len_val));
 }
+
+/*
+ * Iterators without a batch function return a single entry at a time, since
+ * the entry returned by iter_next is only valid until it is next called.
+ */
+size_t
+mtbl_iter_next_batch(struct mtbl_iter *it, struct mtbl_kv *kv, size_t max)
+{
+	if (it == NULL || max == 0)
+		return (0);
+	if (it->iter_next_batch != NULL && !it->pending)
+		return (it->iter_next_batch(it->clos, kv, max));
+	if (mtbl_iter_next(it, &kv->key, &kv->len_key, &kv->val, &kv->len_val) != mtbl_res_success)
+		return (0);
+	return (1);
+}
+
+/*
+ * Iterators without a seek function are stepped forward until an entry at or
+ * after the target is found, which is then held until the next call to
+ * mtbl_iter_next(). The iterator's own buffers remain valid until then.
+ */
+mtbl_res
+mtbl_iter_seek(struct mtbl_iter *it, const uint8_t *key, size_t len_key)
+{
+	if (it == NULL)
+		return (mtbl_res_failure);
+	if (it->iter_seek != NULL)
+		return (it->iter_seek(it->clos, key, len_key));
+
+	if (it->pending &&
+	    bytes_compare(it->key, it->len_key, key, len_key) >= 0)
+	{
+		return (mtbl_res_success);
+	}
+	it->pending = false;
+	while (it->iter_next(it->clos,
+			     &it->key, &it->len_key,
+			     &it->val, &it->len_val) == mtbl_res_success)
+	{
+		if (bytes_compare(it->key, it->len_key, key, len_key) >= 0) {
+			it->pending = true;
+			break;
+		}
+	}
+	return (mtbl_res_success);
+}
+
+/*
+ * The entry returned by mtbl_iter_next() remains the last one returned by
+ * iter_next, even when it was held by a seek, so the iterator can pin it.
+ * Otherwise the value is copied into a pin of its own.
+ */
+mtbl_res
+mtbl_iter_next_pinned(struct mtbl_iter *it,
+		      const uint8_t **key, size_t *len_key,
+		      const uint8_t **val, size_t *len_val,
+		      struct mtbl_pin **pin)
+{
+	*pin = NULL;
+	if (mtbl_iter_next(it, key, len_key, val, len_val) != mtbl_res_success)
+		return (mtbl_res_failure);
+	*pin = iter_pin(it);
+	if (*pin == NULL) {
+		*pin = pin_init_copy(*val, *len_val);
+		*val = pin_data(*pin);
+	}
+	return (mtbl_res_success);
+}
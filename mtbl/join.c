@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "mtbl-private.h"
+#include "vector_types.h"
+
+/*
+ * Composite sources which combine the keys of their inputs: the intersection
+ * and join of any number of sources, and the difference of two sources.
+ *
+ * The inputs are advanced leapfrog style. Whichever inputs are behind the
+ * greatest of the current keys are seeked directly to it with
+ * mtbl_iter_seek(), so that when the inputs overlap sparsely, the entries in
+ * between are never read.
+ */
+
+typedef enum {
+	JOIN_TYPE_INTERSECTION,
+	JOIN_TYPE_JOIN,
+	JOIN_TYPE_DIFFERENCE,
+} join_type;
+
+struct join_input {
+	struct mtbl_iter		*it;
+	const uint8_t			*key;
+	const uint8_t			*val;
+	size_t				len_key;
+	size_t				len_val;
+	bool				have;
+	bool				done;
+};
+
+struct join_source {
+	join_type			type;
+	const struct mtbl_source	**sources;
+	size_t				n_sources;
+	mtbl_merge_multi_func		merge;
+	void				*merge_clos;
+};
+
+struct join_iter {
+	struct join_source		*js;
+	struct join_input		*inputs;
+	size_t				n_inputs;
+	const uint8_t			**vals;
+	size_t				*len_vals;
+	ubuf				*merged_val;
+};
+
+/*
+ * Make sure input 'in' holds an unconsumed entry. Returns false when the
+ * input is exhausted.
+ */
+static bool
+input_fill(struct join_input *in)
+{
+	if (in->have)
+		return (true);
+	if (in->done)
+		return (false);
+	if (mtbl_iter_next(in->it, &in->key, &in->len_key,
+			   &in->val, &in->len_val) == mtbl_res_success)
+	{
+		in->have = true;
+	} else {
+		in->done = true;
+	}
+	return (in->have);
+}
+
+/* Skip input 'in' forward to the first entry at or after 'key'. */
+static bool
+input_seek(struct join_input *in, const uint8_t *key, size_t len_key)
+{
+	if (in->have && bytes_compare(in->key, in->len_key, key, len_key) >= 0)
+		return (true);
+	in->have = false;
+	if (in->done)
+		return (false);
+	if (mtbl_iter_seek(in->it, key, len_key) != mtbl_res_success) {
+		in->done = true;
+		return (false);
+	}
+	return (input_fill(in));
+}
+
+static mtbl_res
+join_iter_intersect(struct join_iter *it,
+		    const uint8_t **key, size_t *len_key,
+		    const uint8_t **val, size_t *len_val)
+{
+	for (size_t i = 0; i < it->n_inputs; i++) {
+		if (!input_fill(&it->inputs[i]))
+			return (mtbl_res_failure);
+	}
+
+	/* leapfrog until every input is on the same key */
+	size_t i_max = 0;
+	for (;;) {
+		for (size_t i = 0; i < it->n_inputs; i++) {
+			struct join_input *in = &it->inputs[i];
+			struct join_input *max = &it->inputs[i_max];
+			if (bytes_compare(in->key, in->len_key, max->key, max->len_key) > 0)
+				i_max = i;
+		}
+
+		const struct join_input *max = &it->inputs[i_max];
+		bool equal = true;
+		for (size_t i = 0; i < it->n_inputs; i++) {
+			struct join_input *in = &it->inputs[i];
+			if (i == i_max ||
+			    bytes_compare(in->key, in->len_key, max->key, max->len_key) == 0)
+			{
+				continue;
+			}
+			equal = false;
+			if (!input_seek(in, max->key, max->len_key))
+				return (mtbl_res_failure);
+			if (bytes_compare(in->key, in->len_key, max->key, max->len_key) > 0) {
+				i_max = i;
+				break;
+			}
+		}
+		if (equal)
+			break;
+	}
+
+	/* the entries remain valid until the inputs are next advanced */
+	for (size_t i = 0; i < it->n_inputs; i++) {
+		it->inputs[i].have = false;
+		it->vals[i] = it->inputs[i].val;
+		it->len_vals[i] = it->inputs[i].len_val;
+	}
+	*key = it->inputs[0].key;
+	*len_key = it->inputs[0].len_key;
+
+	if (it->js->type == JOIN_TYPE_JOIN) {
+		ubuf_clip(it->merged_val, 0);
+		mtbl_res res = it->js->merge(it->js->merge_clos,
+			*key, *len_key,
+			it->n_inputs, it->vals, it->len_vals,
+			(struct mtbl_buf *) it->merged_val);
+		if (res != mtbl_res_success)
+			return (res);
+		*val = ubuf_data(it->merged_val);
+		*len_val = ubuf_size(it->merged_val);
+	} else {
+		*val = it->vals[0];
+		*len_val = it->len_vals[0];
+	}
+	return (mtbl_res_success);
+}
+
+static mtbl_res
+join_iter_difference(struct join_iter *it,
+		     const uint8_t **key, size_t *len_key,
+		     const uint8_t **val, size_t *len_val)
+{
+	struct join_input *a = &it->inputs[0];
+	struct join_input *b = &it->inputs[1];
+
+	while (input_fill(a)) {
+		a->have = false;
+		if (input_seek(b, a->key, a->len_key) &&
+		    bytes_compare(a->key, a->len_key, b->key, b->len_key) == 0)
+		{
+			continue;
+		}
+		*key = a->key;
+		*len_key = a->len_key;
+		*val = a->val;
+		*len_val = a->len_val;
+		return (mtbl_res_success);
+	}
+	return (mtbl_res_failure);
+}
+
+static mtbl_res
+join_iter_next(void *v,
+	       const uint8_t **key, size_t *len_key,
+	       const uint8_t **val, size_t *len_val)
+{
+	struct join_iter *it = (struct join_iter *) v;
+	if (it->js->type == JOIN_TYPE_DIFFERENCE)
+		return (join_iter_difference(it, key, len_key, val, len_val));
+	return (join_iter_intersect(it, key, len_key, val, len_val));
+}
+
+static mtbl_res
+join_iter_seek(void *v, const uint8_t *key, size_t len_key)
+{
+	struct join_iter *it = (struct join_iter *) v;
+
+	/* the inputs other than the first are seeked as needed by next */
+	input_seek(&it->inputs[0], key, len_key);
+	return (mtbl_res_success);
+}
+
+static void
+join_iter_free(void *v)
+{
+	struct join_iter *it = (struct join_iter *) v;
+	if (it != NULL) {
+		for (size_t i = 0; i < it->n_inputs; i++)
+			mtbl_iter_destroy(&it->inputs[i].it);
+		free(it->inputs);
+		free(it->vals);
+		free(it->len_vals);
+		ubuf_destroy(&it->merged_val);
+		free(it);
+	}
+}
+
+/*
+ * Wrap the iterators 'inputs', one for each source, which are taken over by
+ * the returned iterator. A NULL input is treated as empty.
+ */
+static struct mtbl_iter *
+join_iter_init(struct join_source *js, struct mtbl_iter **inputs)
+{
+	struct join_iter *it = my_calloc(1, sizeof(*it));
+	it->js = js;
+	it->n_inputs = js->n_sources;
+	it->inputs = my_calloc(it->n_inputs, sizeof(struct join_input));
+	it->vals = my_calloc(it->n_inputs, sizeof(const uint8_t *));
+	it->len_vals = my_calloc(it->n_inputs, sizeof(size_t));
+	it->merged_val = ubuf_init(256);
+	for (size_t i = 0; i < it->n_inputs; i++) {
+		it->inputs[i].it = inputs[i];
+		it->inputs[i].done = (inputs[i] == NULL);
+	}
+
+	struct mtbl_iter *iter = mtbl_iter_init(join_iter_next, join_iter_free, it);
+	mtbl_iter_set_seek_func(iter, join_iter_seek);
+	return (iter);
+}
+
+/* Only the keys are needed from the second source of a difference. */
+static inline bool
+subtrahend(const struct join_source *js, size_t i)
+{
+	return (js->type == JOIN_TYPE_DIFFERENCE && i == 1);
+}
+
+static struct mtbl_iter *
+join_source_iter(void *clos)
+{
+	struct join_source *js = (struct join_source *) clos;
+	struct mtbl_iter *inputs[js->n_sources];
+	for (size_t i = 0; i < js->n_sources; i++) {
+		if (subtrahend(js, i))
+			inputs[i] = mtbl_source_iter_keys(js->sources[i]);
+		else
+			inputs[i] = mtbl_source_iter(js->sources[i]);
+	}
+	return (join_iter_init(js, inputs));
+}
+
+static struct mtbl_iter *
+join_source_get(void *clos, const uint8_t *key, size_t len_key)
+{
+	struct join_source *js = (struct join_source *) clos;
+	struct mtbl_iter *inputs[js->n_sources];
+	for (size_t i = 0; i < js->n_sources; i++)
+		inputs[i] = mtbl_source_get(js->sources[i], key, len_key);
+	return (join_iter_init(js, inputs));
+}
+
+static struct mtbl_iter *
+join_source_get_prefix(void *clos, const uint8_t *key, size_t len_key)
+{
+	struct join_source *js = (struct join_source *) clos;
+	struct mtbl_iter *inputs[js->n_sources];
+	for (size_t i = 0; i < js->n_sources; i++) {
+		if (subtrahend(js, i))
+			inputs[i] = mtbl_source_get_prefix_keys(js->sources[i], key, len_key);
+		else
+			inputs[i] = mtbl_source_get_prefix(js->sources[i], key, len_key);
+	}
+	return (join_iter_init(js, inputs));
+}
+
+static struct mtbl_iter *
+join_source_get_range(void *clos,
+		      const uint8_t *key0, size_t len_key0,
+		      const uint8_t *key1, size_t len_key1)
+{
+	struct join_source *js = (struct join_source *) clos;
+	struct mtbl_iter *inputs[js->n_sources];
+	for (size_t i = 0; i < js->n_sources; i++) {
+		if (subtrahend(js, i))
+			inputs[i] = mtbl_source_get_range_keys(js->sources[i],
+							       key0, len_key0, key1, len_key1);
+		else
+			inputs[i] = mtbl_source_get_range(js->sources[i],
+							  key0, len_key0, key1, len_key1);
+	}
+	return (join_iter_init(js, inputs));
+}
+
+static void
+join_source_free(void *clos)
+{
+	struct join_source *js = (struct join_source *) clos;
+	free(js->sources);
+	free(js);
+}
+
+static struct mtbl_source *
+join_source_init(join_type type,
+		 const struct mtbl_source * const *sources, size_t n_sources,
+		 mtbl_merge_multi_func merge, void *merge_clos)
+{
+	assert(n_sources > 0);
+	struct join_source *js = my_calloc(1, sizeof(*js));
+	js->type = type;
+	js->sources = my_calloc(n_sources, sizeof(struct mtbl_source *));
+	memcpy(js->sources, sources, n_sources * sizeof(struct mtbl_source *));
+	js->n_sources = n_sources;
+	js->merge = merge;
+	js->merge_clos = merge_clos;
+	return (mtbl_source_init(join_source_iter,
+				 join_source_get,
+				 join_source_get_prefix,
+				 join_source_get_range,
+				 join_source_free, js));
+}
+
+struct mtbl_source *
+mtbl_source_intersection(const struct mtbl_source * const *sources, size_t n_sources)
+{
+	return (join_source_init(JOIN_TYPE_INTERSECTION, sources, n_sources, NULL, NULL));
+}
+
+struct mtbl_source *
+mtbl_source_join(const struct mtbl_source * const *sources, size_t n_sources,
+		 mtbl_merge_multi_func merge, void *clos)
+{
+	assert(merge != NULL);
+	return (join_source_init(JOIN_TYPE_JOIN, sources, n_sources, merge, clos));
+}
+
+struct mtbl_source *
+mtbl_source_difference(const struct mtbl_source *a, const struct mtbl_source *b)
+{
+	const struct mtbl_source *sources[2] = { a, b };
+	return (join_source_init(JOIN_TYPE_DIFFERENCE, sources, 2, NULL, NULL));
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "mtbl-private.h"
+
+/*
+ * Built-in merge operators. These are mtbl_merge_multi_func's which write
+ * the merged value directly into the library-owned output buffer and never
+ * allocate memory of their own.
+ *
+ * The fixed64 operators treat each value as an array of little endian 64-bit
+ * words and combine them elementwise. Their inner loops are kept free of
+ * function calls and data-dependent branches so that the compiler can
+ * vectorize them.
+ */
+
+static inline uint64_t
+load64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return (le64toh(v));
+}
+
+static inline void
+store64(uint8_t *p, uint64_t v)
+{
+	v = htole64(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+/*
+ * Copy the longest of the values into the output buffer, which determines
+ * the length of the merged value. Returns the number of words, or
+ * SIZE_MAX if any value is not a whole number of words.
+ */
+static size_t
+fixed64_init(size_t n_vals,
+	     const uint8_t * const *vals, const size_t *len_vals,
+	     struct mtbl_buf *merged_val, size_t *i_longest)
+{
+	size_t len = 0;
+
+	*i_longest = 0;
+	for (size_t i = 0; i < n_vals; i++) {
+		if ((len_vals[i] % sizeof(uint64_t)) != 0)
+			return (SIZE_MAX);
+		if (len_vals[i] > len) {
+			len = len_vals[i];
+			*i_longest = i;
+		}
+	}
+	mtbl_buf_clip(merged_val, 0);
+	if (len > 0)
+		memcpy(mtbl_buf_extend(merged_val, len), vals[*i_longest], len);
+	return (len / sizeof(uint64_t));
+}
+
+mtbl_res
+mtbl_merge_op_sum_fixed64(void *clos,
+			  const uint8_t *key, size_t len_key,
+			  size_t n_vals,
+			  const uint8_t * const *vals, const size_t *len_vals,
+			  struct mtbl_buf *merged_val)
+{
+	size_t i_longest;
+	if (fixed64_init(n_vals, vals, len_vals, merged_val, &i_longest) == SIZE_MAX)
+		return (mtbl_res_failure);
+	uint8_t *out = mtbl_buf_data(merged_val);
+
+	for (size_t i = 0; i < n_vals; i++) {
+		if (i == i_longest)
+			continue;
+		const uint8_t *v = vals[i];
+		size_t n = len_vals[i] / sizeof(uint64_t);
+		for (size_t j = 0; j < n; j++) {
+			size_t off = j * sizeof(uint64_t);
+			store64(out + off, load64(out + off) + load64(v + off));
+		}
+	}
+	return (mtbl_res_success);
+}
+
+mtbl_res
+mtbl_merge_op_min_fixed64(void *clos,
+			  const uint8_t *key, size_t len_key,
+			  size_t n_vals,
+			  const uint8_t * const *vals, const size_t *len_vals,
+			  struct mtbl_buf *merged_val)
+{
+	size_t i_longest;
+	if (fixed64_init(n_vals, vals, len_vals, merged_val, &i_longest) == SIZE_MAX)
+		return (mtbl_res_failure);
+	uint8_t *out = mtbl_buf_data(merged_val);
+
+	for (size_t i = 0; i < n_vals; i++) {
+		const uint8_t *v = vals[i];
+		size_t n = len_vals[i] / sizeof(uint64_t);
+		for (size_t j = 0; j < n; j++) {
+			size_t off = j * sizeof(uint64_t);
+			uint64_t a = load64(out + off);
+			uint64_t b = load64(v + off);
+			store64(out + off, b < a ? b : a);
+		}
+	}
+	return (mtbl_res_success);
+}
+
+mtbl_res
+mtbl_merge_op_max_fixed64(void *clos,
+			  const uint8_t *key, size_t len_key,
+			  size_t n_vals,
+			  const uint8_t * const *vals, const size_t *len_vals,
+			  struct mtbl_buf *merged_val)
+{
+	size_t i_longest;
+	if (fixed64_init(n_vals, vals, len_vals, merged_val, &i_longest) == SIZE_MAX)
+		return (mtbl_res_failure);
+	uint8_t *out = mtbl_buf_data(merged_val);
+
+	for (size_t i = 0; i < n_vals; i++) {
+		const uint8_t *v = vals[i];
+		size_t n = len_vals[i] / sizeof(uint64_t);
+		for (size_t j = 0; j < n; j++) {
+			size_t off = j * sizeof(uint64_t);
+			uint64_t a = load64(out + off);
+			uint64_t b = load64(v + off);
+			store64(out + off, b > a ? b : a);
+		}
+	}
+	return (mtbl_res_success);
+}
+
+mtbl_res
+mtbl_merge_op_sum_varint(void *clos,
+			 const uint8_t *key, size_t len_key,
+			 size_t n_vals,
+			 const uint8_t * const *vals, const size_t *len_vals,
+			 struct mtbl_buf *merged_val)
+{
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < n_vals; i++) {
+		uint64_t v;
+		if (len_vals[i] == 0 ||
+		    mtbl_varint_length_packed(vals[i], len_vals[i]) != len_vals[i])
+		{
+			return (mtbl_res_failure);
+		}
+		mtbl_varint_decode64(vals[i], &v);
+		sum += v;
+	}
+
+	mtbl_buf_clip(merged_val, 0);
+	uint8_t *out = mtbl_buf_extend(merged_val, mtbl_varint_length(sum));
+	mtbl_varint_encode64(out, sum);
+	return (mtbl_res_success);
+}
+
+/*
+ * Decode the length-prefixed string at offset 'pos' of 'val'. Returns false
+ * if the string is truncated.
+ */
+static bool
+union_elem(const uint8_t *val, size_t len_val, size_t pos,
+	   const uint8_t **s, size_t *len_s, size_t *len_elem)
+{
+	uint64_t len;
+	size_t len_prefix = mtbl_varint_length_packed(val + pos, len_val - pos);
+	if (len_prefix == 0)
+		return (false);
+	mtbl_varint_decode64(val + pos, &len);
+	if (len > len_val - pos - len_prefix)
+		return (false);
+	*s = val + pos + len_prefix;
+	*len_s = len;
+	*len_elem = len_prefix + len;
+	return (true);
+}
+
+/*
+ * Each value is a sequence of byte strings in ascending order, each prefixed
+ * by its length as a varint. The merged value is the union of the strings,
+ * in the same encoding, without duplicates.
+ *
+ * The read position within each value is kept at the front of the output
+ * buffer while merging, and the result is moved down over it at the end.
+ */
+mtbl_res
+mtbl_merge_op_union_sorted(void *clos,
+			   const uint8_t *key, size_t len_key,
+			   size_t n_vals,
+			   const uint8_t * const *vals, const size_t *len_vals,
+			   struct mtbl_buf *merged_val)
+{
+	const size_t len_pos = n_vals * sizeof(size_t);
+	size_t len_last = 0;
+	bool have_last = false;
+
+	mtbl_buf_clip(merged_val, 0);
+	memset(mtbl_buf_extend(merged_val, len_pos), 0, len_pos);
+
+	for (;;) {
+		size_t *pos = (size_t *) mtbl_buf_data(merged_val);
+		const uint8_t *min = NULL;
+		size_t len_min = 0, len_elem_min = 0;
+
+		for (size_t i = 0; i < n_vals; i++) {
+			const uint8_t *s;
+			size_t len_s, len_elem;
+			if (pos[i] == len_vals[i])
+				continue;
+			if (!union_elem(vals[i], len_vals[i], pos[i], &s, &len_s, &len_elem))
+				return (mtbl_res_failure);
+			if (min == NULL || bytes_compare(s, len_s, min, len_min) < 0) {
+				min = s;
+				len_min = len_s;
+				len_elem_min = len_elem;
+			}
+		}
+		if (min == NULL)
+			break;
+
+		/* skip past the chosen string in every value containing it */
+		for (size_t i = 0; i < n_vals; i++) {
+			const uint8_t *s;
+			size_t len_s, len_elem;
+			if (pos[i] < len_vals[i] &&
+			    union_elem(vals[i], len_vals[i], pos[i], &s, &len_s, &len_elem) &&
+			    bytes_compare(s, len_s, min, len_min) == 0)
+			{
+				pos[i] += len_elem;
+			}
+		}
+
+		/* repeats within a single value are adjacent to the last output */
+		uint8_t *data = mtbl_buf_data(merged_val);
+		size_t size = mtbl_buf_size(merged_val);
+		if (have_last &&
+		    bytes_compare(data + size - len_last, len_last, min, len_min) == 0)
+		{
+			continue;
+		}
+		memcpy(mtbl_buf_extend(merged_val, len_elem_min), min - (len_elem_min - len_min),
+		       len_elem_min);
+		len_last = len_min;
+		have_last = true;
+	}
+
+	size_t len_out = mtbl_buf_size(merged_val) - len_pos;
+	memmove(mtbl_buf_data(merged_val), mtbl_buf_data(merged_val) + len_pos, len_out);
+	mtbl_buf_clip(merged_val, len_out);
+	return (mtbl_res_success);
+}
+
+static const struct {
+	const char		*name;
+	mtbl_merge_multi_func	func;
+} merge_ops[] = {
+	{ "sum_varint",		mtbl_merge_op_sum_varint },
+	{ "sum_fixed64",	mtbl_merge_op_sum_fixed64 },
+	{ "min_fixed64",	mtbl_merge_op_min_fixed64 },
+	{ "max_fixed64",	mtbl_merge_op_max_fixed64 },
+	{ "union_sorted",	mtbl_merge_op_union_sorted },
+};
+
+mtbl_merge_multi_func
+mtbl_merge_op_lookup(const char *name)
+{
+	for (size_t i = 0; i < sizeof(merge_ops) / sizeof(merge_ops[0]); i++) {
+		if (strcmp(name, merge_ops[i].name) == 0)
+			return (merge_ops[i].func);
+	}
+	return (NULL);
+}
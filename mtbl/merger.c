@@ -17,36 +17,67 @@
 #include "mtbl-private.h"
 #include "vector_types.h"
 
+/*
+ * A source of the merger, whose current entry is kv[pos] of the batch last
+ * read from it. The batch remains valid until the source is next read.
+ */
 struct entry {
 	struct mtbl_iter		*it;
-	ubuf				*key;
-	ubuf				*val;
+	struct mtbl_kv			kv[ITER_BATCH_SIZE];
+	size_t				n_kv;
+	size_t				pos;
+	size_t				idx;
 };
 
+#define entry_kv(e)	(&(e)->kv[(e)->pos])
+
 VECTOR_GENERATE(entry_vec, struct entry *);
 
 VECTOR_GENERATE(source_vec, const struct mtbl_source *);
 
+VECTOR_GENERATE(val_vec, const uint8_t *);
+
+VECTOR_GENERATE(len_vec, size_t);
+
 struct merger_iter {
 	struct mtbl_merger		*m;
 	struct heap			*h;
 	entry_vec			*entries;
 	ubuf				*cur_key;
 	ubuf				*cur_val;
+	ubuf				*merge_val;
+	val_vec				*vals;
+	len_vec				*len_vals;
+	entry_vec			*stale;
+	ubuf				*batch;
+	len_vec				*batch_copied;
+	bool				keys_only;
 	bool				finished;
 };
 
 struct mtbl_merger_options {
 	mtbl_merge_func			merge;
+	mtbl_merge_buf_func		merge_buf;
+	mtbl_merge_multi_func		merge_multi;
 	void				*merge_clos;
+	bool				precedence;
 };
 
+struct merger_stats_shard {
+	struct mtbl_merger_stats	s;
+} __attribute__((aligned(STATS_ALIGN)));
+
 struct mtbl_merger {
 	source_vec			*sources;
 	struct mtbl_source		*source;
 	struct mtbl_merger_options	opt;
+	struct merger_stats_shard	*stats;
 };
 
+/* Iterators on the same merger may be used concurrently, see stats_shard(). */
+#define merger_stat_add(m, field, n) \
+	__atomic_add_fetch(&(m)->stats[stats_shard()].s.field, (n), __ATOMIC_RELAXED)
+
 static struct mtbl_iter *
 merger_iter(void *);
 
@@ -59,6 +90,18 @@ merger_get_prefix(void *, const uint8_t *, size_t);
 static struct mtbl_iter *
 merger_get_range(void *, const uint8_t *, size_t, const uint8_t *, size_t);
 
+static struct mtbl_iter *
+merger_iter_keys(void *);
+
+static struct mtbl_iter *
+merger_get_prefix_keys(void *, const uint8_t *, size_t);
+
+static struct mtbl_iter *
+merger_get_range_keys(void *, const uint8_t *, size_t, const uint8_t *, size_t);
+
+static void
+merger_index(void *, index_visit_func, void *);
+
 struct mtbl_merger_options *
 mtbl_merger_options_init(void)
 {
@@ -79,9 +122,37 @@ mtbl_merger_options_set_merge_func(struct mtbl_merger_options *opt,
 				   mtbl_merge_func merge, void *clos)
 {
 	opt->merge = merge;
+	opt->merge_buf = NULL;
+	opt->merge_multi = NULL;
+	opt->merge_clos = clos;
+}
+
+void
+mtbl_merger_options_set_merge_buf_func(struct mtbl_merger_options *opt,
+				       mtbl_merge_buf_func merge_buf, void *clos)
+{
+	opt->merge = NULL;
+	opt->merge_buf = merge_buf;
+	opt->merge_multi = NULL;
 	opt->merge_clos = clos;
 }
 
+void
+mtbl_merger_options_set_merge_multi_func(struct mtbl_merger_options *opt,
+					 mtbl_merge_multi_func merge_multi, void *clos)
+{
+	opt->merge = NULL;
+	opt->merge_buf = NULL;
+	opt->merge_multi = merge_multi;
+	opt->merge_clos = clos;
+}
+
+void
+mtbl_merger_options_set_precedence(struct mtbl_merger_options *opt, bool precedence)
+{
+	opt->precedence = precedence;
+}
+
 struct mtbl_merger *
 mtbl_merger_init(const struct mtbl_merger_options *opt)
 {
@@ -89,14 +160,21 @@ mtbl_merger_init(const struct mtbl_merger_options *opt)
 
 	m = my_calloc(1, sizeof(*m));
 	m->sources = source_vec_init(0);
+	m->stats = stats_shards_init(STATS_SHARDS * sizeof(struct merger_stats_shard));
 	assert(opt != NULL);
-	assert(opt->merge != NULL);
+	assert(opt->precedence ||
+	       opt->merge != NULL || opt->merge_buf != NULL || opt->merge_multi != NULL);
 	memcpy(&m->opt, opt, sizeof(*opt));
 	m->source = mtbl_source_init(merger_iter,
 				     merger_get,
 				     merger_get_prefix,
 				     merger_get_range,
 				     NULL, m);
+	mtbl_source_set_keys_funcs(m->source,
+				   merger_iter_keys,
+				   merger_get_prefix_keys,
+				   merger_get_range_keys);
+	source_set_index_func(m->source, merger_index);
 	return (m);
 }
 
@@ -106,6 +184,7 @@ mtbl_merger_destroy(struct mtbl_merger **m)
 	if (*m) {
 		source_vec_destroy(&(*m)->sources);
 		mtbl_source_destroy(&(*m)->source);
+		free((*m)->stats);
 		free(*m);
 		*m = NULL;
 	}
@@ -123,42 +202,222 @@ mtbl_merger_add_source(struct mtbl_merger *m, const struct mtbl_source *s)
 	source_vec_add(m->sources, s);
 }
 
+void
+mtbl_merger_stats(struct mtbl_merger *m, struct mtbl_merger_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	for (size_t i = 0; i < STATS_SHARDS; i++) {
+		const struct mtbl_merger_stats *s = &m->stats[i].s;
+		stats->count_iters += __atomic_load_n(&s->count_iters, __ATOMIC_RELAXED);
+		stats->count_entries += __atomic_load_n(&s->count_entries, __ATOMIC_RELAXED);
+		stats->count_duplicates +=
+			__atomic_load_n(&s->count_duplicates, __ATOMIC_RELAXED);
+		stats->count_merges += __atomic_load_n(&s->count_merges, __ATOMIC_RELAXED);
+		stats->count_seeks += __atomic_load_n(&s->count_seeks, __ATOMIC_RELAXED);
+	}
+}
+
+static void
+merger_index(void *clos, index_visit_func visit, void *visit_clos)
+{
+	struct mtbl_merger *m = (struct mtbl_merger *) clos;
+	for (size_t i = 0; i < source_vec_size(m->sources); i++)
+		source_index(source_vec_value(m->sources, i), visit, visit_clos);
+}
+
 static int
 _mtbl_merger_compare(const void *va, const void *vb)
 {
-	const struct entry *a = (const struct entry *) va;
-	const struct entry *b = (const struct entry *) vb;
+	const struct mtbl_kv *a = entry_kv((const struct entry *) va);
+	const struct mtbl_kv *b = entry_kv((const struct entry *) vb);
 
-	if (a->key == NULL && b->key == NULL)
-		return (0);
-	if (a->key == NULL)
-		return (1);
-	if (b->key == NULL)
-		return (-1);
+	int ret = bytes_compare(a->key, a->len_key, b->key, b->len_key);
+	if (ret != 0)
+		return (ret);
 
-	return (bytes_compare(ubuf_data(a->key), ubuf_size(a->key),
-			      ubuf_data(b->key), ubuf_size(b->key)));
+	/* equal keys are visited in the order their sources were added */
+	size_t a_idx = ((const struct entry *) va)->idx;
+	size_t b_idx = ((const struct entry *) vb)->idx;
+	if (a_idx < b_idx)
+		return (-1);
+	return (a_idx > b_idx);
 }
 
+/*
+ * Read the next batch of a source, which invalidates its previous one. A
+ * source which has no more entries is destroyed.
+ */
 static mtbl_res
 entry_fill(struct entry *ent)
 {
 	assert(ent->it != NULL);
 
-	const uint8_t *key, *val;
-	size_t len_key, len_val;
-	mtbl_res res;
+	ent->pos = 0;
+	ent->n_kv = mtbl_iter_next_batch(ent->it, ent->kv, ITER_BATCH_SIZE);
+	if (ent->n_kv == 0) {
+		mtbl_iter_destroy(&ent->it);
+		return (mtbl_res_failure);
+	}
+	return (mtbl_res_success);
+}
 
-	ubuf_clip(ent->key, 0);
-	ubuf_clip(ent->val, 0);
-	res = mtbl_iter_next(ent->it, &key, &len_key, &val, &len_val);
-	if (res == mtbl_res_success) {
-		ubuf_append(ent->key, key, len_key);
-		ubuf_append(ent->val, val, len_val);
+/*
+ * Step past the current entry of 'e', which is at the top of the heap. A
+ * source whose batch is used up leaves the heap, and is only read again by
+ * merger_iter_refill() at the start of the next call on the iterator, so that
+ * everything returned by the current call remains valid.
+ */
+static void
+entry_advance(struct merger_iter *it, struct entry *e)
+{
+	if (++e->pos < e->n_kv) {
+		heap_replace(it->h, e);
 	} else {
-		mtbl_iter_destroy(&ent->it);
+		heap_pop(it->h);
+		entry_vec_add(it->stale, e);
 	}
-	return (res);
+}
+
+static void
+merger_iter_refill(struct merger_iter *it)
+{
+	for (size_t i = 0; i < entry_vec_size(it->stale); i++) {
+		struct entry *e = entry_vec_value(it->stale, i);
+		if (entry_fill(e) == mtbl_res_success)
+			heap_push(it->h, e);
+	}
+	entry_vec_clip(it->stale, 0);
+}
+
+/*
+ * Merge the value 'kv' into the current value. With a buffer merge function,
+ * the merged value is written into a second buffer which is then swapped with
+ * the current value, so that no allocation is needed once both buffers have
+ * grown large enough.
+ */
+static mtbl_res
+merger_merge(struct merger_iter *it, const struct mtbl_kv *kv)
+{
+	const struct mtbl_merger_options *opt = &it->m->opt;
+
+	merger_stat_add(it->m, count_merges, 1);
+	PROBE4(merge__start, it->m, ubuf_data(it->cur_key), ubuf_size(it->cur_key), 2);
+	if (opt->merge_buf != NULL) {
+		ubuf_clip(it->merge_val, 0);
+		mtbl_res res = opt->merge_buf(opt->merge_clos,
+			ubuf_data(it->cur_key), ubuf_size(it->cur_key),
+			ubuf_data(it->cur_val), ubuf_size(it->cur_val),
+			kv->val, kv->len_val,
+			(struct mtbl_buf *) it->merge_val);
+		PROBE3(merge__done, it->m, ubuf_size(it->merge_val), res);
+		if (res != mtbl_res_success)
+			return (res);
+		ubuf *tmp = it->cur_val;
+		it->cur_val = it->merge_val;
+		it->merge_val = tmp;
+		return (mtbl_res_success);
+	}
+
+	uint8_t *merged_val = NULL;
+	size_t len_merged_val = 0;
+	opt->merge(opt->merge_clos,
+		   ubuf_data(it->cur_key), ubuf_size(it->cur_key),
+		   ubuf_data(it->cur_val), ubuf_size(it->cur_val),
+		   kv->val, kv->len_val,
+		   &merged_val, &len_merged_val);
+	PROBE3(merge__done, it->m, len_merged_val,
+	       merged_val != NULL ? mtbl_res_success : mtbl_res_failure);
+	if (merged_val == NULL)
+		return (mtbl_res_failure);
+	ubuf_clip(it->cur_val, 0);
+	ubuf_append(it->cur_val, merged_val, len_merged_val);
+	free(merged_val);
+	return (mtbl_res_success);
+}
+
+/*
+ * With an n-ary merge function, the values for the current key are gathered
+ * end to end in cur_val, with their lengths in len_vals, and merged at once.
+ */
+static mtbl_res
+merger_merge_multi(struct merger_iter *it)
+{
+	const struct mtbl_merger_options *opt = &it->m->opt;
+	const uint8_t *p = ubuf_data(it->cur_val);
+
+	merger_stat_add(it->m, count_merges, 1);
+	val_vec_clip(it->vals, 0);
+	for (size_t i = 0; i < len_vec_size(it->len_vals); i++) {
+		val_vec_add(it->vals, p);
+		p += len_vec_value(it->len_vals, i);
+	}
+
+	ubuf_clip(it->merge_val, 0);
+	PROBE4(merge__start, it->m, ubuf_data(it->cur_key), ubuf_size(it->cur_key),
+	       len_vec_size(it->len_vals));
+	mtbl_res res = opt->merge_multi(opt->merge_clos,
+		ubuf_data(it->cur_key), ubuf_size(it->cur_key),
+		len_vec_size(it->len_vals),
+		val_vec_data(it->vals), len_vec_data(it->len_vals),
+		(struct mtbl_buf *) it->merge_val);
+	PROBE3(merge__done, it->m, ubuf_size(it->merge_val), res);
+	if (res != mtbl_res_success)
+		return (res);
+	ubuf *tmp = it->cur_val;
+	it->cur_val = it->merge_val;
+	it->merge_val = tmp;
+	return (mtbl_res_success);
+}
+
+/*
+ * Gather the least key and its value from each source holding it into cur_key
+ * and cur_val, merging the values unless they are shadowed or not wanted, and
+ * step past them.
+ */
+static mtbl_res
+merger_iter_merge_top(struct merger_iter *it)
+{
+	struct entry *e = heap_peek(it->h);
+	const struct mtbl_kv *kv = entry_kv(e);
+	mtbl_res res;
+
+	ubuf_clip(it->cur_key, 0);
+	ubuf_clip(it->cur_val, 0);
+	len_vec_clip(it->len_vals, 0);
+	ubuf_append(it->cur_key, kv->key, kv->len_key);
+	if (!it->keys_only) {
+		ubuf_append(it->cur_val, kv->val, kv->len_val);
+		len_vec_add(it->len_vals, kv->len_val);
+	}
+	entry_advance(it, e);
+
+	while ((e = heap_peek(it->h)) != NULL) {
+		kv = entry_kv(e);
+		if (bytes_compare(ubuf_data(it->cur_key), ubuf_size(it->cur_key),
+				  kv->key, kv->len_key) != 0)
+		{
+			break;
+		}
+		merger_stat_add(it->m, count_duplicates, 1);
+		if (it->m->opt.precedence || it->keys_only) {
+			/* the value is shadowed by an earlier source, or not wanted */
+		} else if (it->m->opt.merge_multi != NULL) {
+			ubuf_append(it->cur_val, kv->val, kv->len_val);
+			len_vec_add(it->len_vals, kv->len_val);
+		} else {
+			res = merger_merge(it, kv);
+			if (res != mtbl_res_success)
+				return (res);
+		}
+		entry_advance(it, e);
+	}
+
+	if (it->m->opt.merge_multi != NULL && !it->m->opt.precedence && !it->keys_only &&
+	    len_vec_size(it->len_vals) > 1)
+	{
+		return (merger_merge_multi(it));
+	}
+	return (mtbl_res_success);
 }
 
 static mtbl_res
@@ -167,70 +426,105 @@ merger_iter_next(void *v,
 		 const uint8_t **out_val, size_t *out_len_val)
 {
 	struct merger_iter *it = (struct merger_iter *) v;
-	struct entry *e;
 	mtbl_res res;
 
 	if (it->finished)
 		return (mtbl_res_failure);
 
-	ubuf_clip(it->cur_key, 0);
-	ubuf_clip(it->cur_val, 0);
+	merger_iter_refill(it);
+	if (heap_peek(it->h) == NULL) {
+		it->finished = true;
+		return (mtbl_res_failure);
+	}
+	res = merger_iter_merge_top(it);
+	if (res != mtbl_res_success)
+		return (res);
 
-	for (;;) {
-		for (;;) {
-			e = heap_peek(it->h);
-			if (e == NULL) {
-				it->finished = true;
-				break;
-			}
-			if (e->it == NULL)
-				heap_pop(it->h);
-			else
-				break;
-		}
+	*out_key = ubuf_data(it->cur_key);
+	*out_val = ubuf_data(it->cur_val);
+	*out_len_key = ubuf_size(it->cur_key);
+	*out_len_val = ubuf_size(it->cur_val);
+	merger_stat_add(it->m, count_entries, 1);
+
+	return (mtbl_res_success);
+}
 
-		if (it->finished)
+/*
+ * The entries of the source at the top of the heap which sort before the
+ * current entry of every other source are returned as they are, pointing into
+ * the source's batch. Only the entries built from a key held by several
+ * sources are copied, end to end into the batch buffer. The batch ends when a
+ * source runs out of buffered entries, since reading its next batch would
+ * invalidate the entries already returned.
+ */
+static size_t
+merger_iter_next_batch(void *v, struct mtbl_kv *kv, size_t max)
+{
+	struct merger_iter *it = (struct merger_iter *) v;
+	size_t n = 0;
+
+	if (it->finished)
+		return (0);
+
+	merger_iter_refill(it);
+	ubuf_clip(it->batch, 0);
+	len_vec_clip(it->batch_copied, 0);
+
+	while (n < max && entry_vec_size(it->stale) == 0) {
+		struct entry *e = heap_pop(it->h);
+		if (e == NULL) {
+			it->finished = true;
 			break;
+		}
 
-		if (ubuf_size(it->cur_key) == 0) {
-			ubuf_clip(it->cur_val, 0);
-			ubuf_append(it->cur_key, ubuf_data(e->key), ubuf_size(e->key));
-			ubuf_append(it->cur_val, ubuf_data(e->val), ubuf_size(e->val));
-			res = entry_fill(e);
-			if (res == mtbl_res_success)
-				heap_replace(it->h, e);
+		struct entry *next = heap_peek(it->h);
+		size_t n0 = n;
+		while (n < max && e->pos < e->n_kv &&
+		       (next == NULL ||
+			bytes_compare(entry_kv(e)->key, entry_kv(e)->len_key,
+				      entry_kv(next)->key, entry_kv(next)->len_key) < 0))
+		{
+			kv[n] = *entry_kv(e);
+			if (it->keys_only) {
+				kv[n].val = (const uint8_t *) "";
+				kv[n].len_val = 0;
+			}
+			n++;
+			e->pos++;
+		}
+		merger_stat_add(it->m, count_entries, n - n0);
+		if (e->pos == e->n_kv) {
+			entry_vec_add(it->stale, e);
 			continue;
 		}
+		heap_push(it->h, e);
+		if (n > n0 || n == max)
+			continue;
 
-		if (bytes_compare(ubuf_data(it->cur_key), ubuf_size(it->cur_key),
-				  ubuf_data(e->key), ubuf_size(e->key)) == 0)
-		{
-			uint8_t *merged_val = NULL;
-			size_t len_merged_val = 0;
-			it->m->opt.merge(it->m->opt.merge_clos,
-					 ubuf_data(it->cur_key), ubuf_size(it->cur_key),
-					 ubuf_data(it->cur_val), ubuf_size(it->cur_val),
-					 ubuf_data(e->val), ubuf_size(e->val),
-					 &merged_val, &len_merged_val);
-			if (merged_val == NULL)
-				return (mtbl_res_failure);
-			ubuf_clip(it->cur_val, 0);
-			ubuf_append(it->cur_val, merged_val, len_merged_val);
-			free(merged_val);
-			res = entry_fill(e);
-			if (res == mtbl_res_success)
-				heap_replace(it->h, e);
-		} else {
+		/* the least key is held by several sources */
+		if (merger_iter_merge_top(it) != mtbl_res_success) {
+			/* a merge failure ends the iteration */
+			it->finished = true;
 			break;
 		}
+		merger_stat_add(it->m, count_entries, 1);
+		ubuf_append(it->batch, ubuf_data(it->cur_key), ubuf_size(it->cur_key));
+		ubuf_append(it->batch, ubuf_data(it->cur_val), ubuf_size(it->cur_val));
+		kv[n].len_key = ubuf_size(it->cur_key);
+		kv[n].len_val = ubuf_size(it->cur_val);
+		len_vec_add(it->batch_copied, n);
+		n++;
 	}
 
-	*out_key = ubuf_data(it->cur_key);
-	*out_val = ubuf_data(it->cur_val);
-	*out_len_key = ubuf_size(it->cur_key);
-	*out_len_val = ubuf_size(it->cur_val);
-
-	return (mtbl_res_success);
+	/* the batch buffer may have moved while it grew */
+	const uint8_t *p = ubuf_data(it->batch);
+	for (size_t i = 0; i < len_vec_size(it->batch_copied); i++) {
+		struct mtbl_kv *ckv = &kv[len_vec_value(it->batch_copied, i)];
+		ckv->key = p;
+		ckv->val = p + ckv->len_key;
+		p += ckv->len_key + ckv->len_val;
+	}
+	return (n);
 }
 
 static void
@@ -241,107 +535,225 @@ merger_iter_free(void *v)
 		heap_destroy(&it->h);
 		for (size_t i = 0; i < entry_vec_size(it->entries); i++) {
 			struct entry *ent = entry_vec_value(it->entries, i);
-			ubuf_destroy(&ent->key);
-			ubuf_destroy(&ent->val);
 			mtbl_iter_destroy(&ent->it);
 			free(ent);
 		}
 		entry_vec_destroy(&it->entries);
+		entry_vec_destroy(&it->stale);
 		ubuf_destroy(&it->cur_key);
 		ubuf_destroy(&it->cur_val);
+		ubuf_destroy(&it->merge_val);
+		val_vec_destroy(&it->vals);
+		len_vec_destroy(&it->len_vals);
+		ubuf_destroy(&it->batch);
+		len_vec_destroy(&it->batch_copied);
 		free(it);
 	}
 }
 
+/*
+ * Skip the buffered entries of each source which are behind the target, seek
+ * the sources which have none left, and rebuild the heap from the sources
+ * which still have entries.
+ */
+static mtbl_res
+merger_iter_seek(void *v, const uint8_t *key, size_t len_key)
+{
+	struct merger_iter *it = (struct merger_iter *) v;
+
+	if (it->finished)
+		return (mtbl_res_success);
+
+	merger_stat_add(it->m, count_seeks, 1);
+	while (heap_pop(it->h) != NULL);
+	entry_vec_clip(it->stale, 0);
+	for (size_t i = 0; i < entry_vec_size(it->entries); i++) {
+		struct entry *e = entry_vec_value(it->entries, i);
+		if (e->it == NULL)
+			continue;
+		while (e->pos < e->n_kv &&
+		       bytes_compare(entry_kv(e)->key, entry_kv(e)->len_key, key, len_key) < 0)
+		{
+			e->pos++;
+		}
+		if (e->pos == e->n_kv) {
+			mtbl_res res = mtbl_iter_seek(e->it, key, len_key);
+			if (res != mtbl_res_success)
+				return (res);
+			if (entry_fill(e) != mtbl_res_success)
+				continue;
+		}
+		heap_push(it->h, e);
+	}
+	return (mtbl_res_success);
+}
+
+static struct mtbl_iter *
+merger_iter_wrap(struct merger_iter *it)
+{
+	struct mtbl_iter *iter = mtbl_iter_init(merger_iter_next, merger_iter_free, it);
+	mtbl_iter_set_seek_func(iter, merger_iter_seek);
+	mtbl_iter_set_next_batch_func(iter, merger_iter_next_batch);
+	return (iter);
+}
+
 static struct merger_iter *
-merger_iter_init(struct mtbl_merger *m)
+merger_iter_init(struct mtbl_merger *m, bool keys_only)
 {
 	struct merger_iter *it = my_calloc(1, sizeof(*it));
 	it->m = m;
+	it->keys_only = keys_only;
+	merger_stat_add(m, count_iters, 1);
 	it->h = heap_init(_mtbl_merger_compare);
 	it->entries = entry_vec_init(source_vec_size(m->sources));
+	it->stale = entry_vec_init(source_vec_size(m->sources));
 	it->cur_key = ubuf_init(256);
 	it->cur_val = ubuf_init(256);
+	it->merge_val = ubuf_init(256);
+	it->vals = val_vec_init(16);
+	it->len_vals = len_vec_init(16);
+	it->batch = ubuf_init(256);
+	it->batch_copied = len_vec_init(16);
 	return (it);
 }
 
-static void
-merger_iter_add_entry(struct merger_iter *it, struct mtbl_iter *ent_it)
+static mtbl_res
+merger_iter_add_entry(struct merger_iter *it, struct mtbl_iter *ent_it, size_t idx)
 {
 	struct entry *ent = my_calloc(1, sizeof(*ent));
-	ent->key = ubuf_init(256);
-	ent->val = ubuf_init(256);
 	ent->it = ent_it;
-	entry_fill(ent);
-	heap_push(it->h, ent);
+	ent->idx = idx;
+	mtbl_res res = entry_fill(ent);
+	if (res == mtbl_res_success)
+		heap_push(it->h, ent);
 	entry_vec_add(it->entries, ent);
+	return (res);
 }
 
+/*
+ * Key-only iterators do not merge the values of duplicate keys, and read their
+ * sources through the sources' own key-only iterators.
+ */
 static struct mtbl_iter *
-merger_iter(void *clos)
+merger_iter_all(struct mtbl_merger *m, bool keys_only)
 {
-	struct mtbl_merger *m = (struct mtbl_merger *) clos;
-	struct merger_iter *it = merger_iter_init(m);
+	struct merger_iter *it = merger_iter_init(m, keys_only);
 	for (size_t i = 0; i < source_vec_size(m->sources); i++) {
 		const struct mtbl_source *s = source_vec_value(m->sources, i);
-		merger_iter_add_entry(it, mtbl_source_iter(s));
+		merger_iter_add_entry(it, keys_only ? mtbl_source_iter_keys(s)
+						    : mtbl_source_iter(s), i);
 	}
-	return (mtbl_iter_init(merger_iter_next, merger_iter_free, it));
+	return (merger_iter_wrap(it));
+}
+
+static struct mtbl_iter *
+merger_iter(void *clos)
+{
+	return (merger_iter_all((struct mtbl_merger *) clos, false));
+}
+
+static struct mtbl_iter *
+merger_iter_keys(void *clos)
+{
+	return (merger_iter_all((struct mtbl_merger *) clos, true));
 }
 
 static struct mtbl_iter *
 merger_get(void *clos, const uint8_t *key, size_t len_key)
 {
 	struct mtbl_merger *m = (struct mtbl_merger *) clos;
-	struct merger_iter *it = merger_iter_init(m);
+	struct merger_iter *it = merger_iter_init(m, false);
 	for (size_t i = 0; i < source_vec_size(m->sources); i++) {
 		const struct mtbl_source *s = source_vec_value(m->sources, i);
 		struct mtbl_iter *s_it = mtbl_source_get_range(s, key, len_key, key, len_key);
-		if (s_it != NULL)
-			merger_iter_add_entry(it, s_it);
+		if (s_it == NULL)
+			continue;
+		/*
+		 * With precedence, the first source containing the key shadows
+		 * all of the later ones, which need not be searched.
+		 */
+		if (merger_iter_add_entry(it, s_it, i) == mtbl_res_success &&
+		    m->opt.precedence)
+		{
+			break;
+		}
 	}
 	if (entry_vec_size(it->entries) == 0) {
 		merger_iter_free(it);
 		return (NULL);
 	}
-	return (mtbl_iter_init(merger_iter_next, merger_iter_free, it));
+	return (merger_iter_wrap(it));
 }
 
 static struct mtbl_iter *
-merger_get_range(void *clos,
-		 const uint8_t *key0, size_t len_key0,
-		 const uint8_t *key1, size_t len_key1)
+merger_get_range_all(struct mtbl_merger *m,
+		     const uint8_t *key0, size_t len_key0,
+		     const uint8_t *key1, size_t len_key1,
+		     bool keys_only)
 {
-	struct mtbl_merger *m = (struct mtbl_merger *) clos;
-	struct merger_iter *it = merger_iter_init(m);
+	struct merger_iter *it = merger_iter_init(m, keys_only);
 	for (size_t i = 0; i < source_vec_size(m->sources); i++) {
 		const struct mtbl_source *s = source_vec_value(m->sources, i);
-		struct mtbl_iter *s_it = mtbl_source_get_range(s, key0, len_key0, key1, len_key1);
+		struct mtbl_iter *s_it = keys_only ?
+			mtbl_source_get_range_keys(s, key0, len_key0, key1, len_key1) :
+			mtbl_source_get_range(s, key0, len_key0, key1, len_key1);
 		if (s_it != NULL)
-			merger_iter_add_entry(it, s_it);
+			merger_iter_add_entry(it, s_it, i);
 	}
 	if (entry_vec_size(it->entries) == 0) {
 		merger_iter_free(it);
 		return (NULL);
 	}
-	return (mtbl_iter_init(merger_iter_next, merger_iter_free, it));
+	return (merger_iter_wrap(it));
 }
 
 static struct mtbl_iter *
-merger_get_prefix(void *clos,
-		  const uint8_t *key, size_t len_key)
+merger_get_range(void *clos,
+		 const uint8_t *key0, size_t len_key0,
+		 const uint8_t *key1, size_t len_key1)
 {
-	struct mtbl_merger *m = (struct mtbl_merger *) clos;
-	struct merger_iter *it = merger_iter_init(m);
+	return (merger_get_range_all((struct mtbl_merger *) clos,
+				     key0, len_key0, key1, len_key1, false));
+}
+
+static struct mtbl_iter *
+merger_get_range_keys(void *clos,
+		      const uint8_t *key0, size_t len_key0,
+		      const uint8_t *key1, size_t len_key1)
+{
+	return (merger_get_range_all((struct mtbl_merger *) clos,
+				     key0, len_key0, key1, len_key1, true));
+}
+
+static struct mtbl_iter *
+merger_get_prefix_all(struct mtbl_merger *m,
+		      const uint8_t *key, size_t len_key,
+		      bool keys_only)
+{
+	struct merger_iter *it = merger_iter_init(m, keys_only);
 	for (size_t i = 0; i < source_vec_size(m->sources); i++) {
 		const struct mtbl_source *s = source_vec_value(m->sources, i);
-		struct mtbl_iter *s_it = mtbl_source_get_prefix(s, key, len_key);
+		struct mtbl_iter *s_it = keys_only ?
+			mtbl_source_get_prefix_keys(s, key, len_key) :
+			mtbl_source_get_prefix(s, key, len_key);
 		if (s_it != NULL)
-			merger_iter_add_entry(it, s_it);
+			merger_iter_add_entry(it, s_it, i);
 	}
 	if (entry_vec_size(it->entries) == 0) {
 		merger_iter_free(it);
 		return (NULL);
 	}
-	return (mtbl_iter_init(merger_iter_next, merger_iter_free, it));
+	return (merger_iter_wrap(it));
+}
+
+static struct mtbl_iter *
+merger_get_prefix(void *clos, const uint8_t *key, size_t len_key)
+{
+	return (merger_get_prefix_all((struct mtbl_merger *) clos, key, len_key, false));
+}
+
+static struct mtbl_iter *
+merger_get_prefix_keys(void *clos, const uint8_t *key, size_t len_key)
+{
+	return (merger_get_prefix_all((struct mtbl_merger *) clos, key, len_key, true));
 }
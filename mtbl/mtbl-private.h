@@ -28,6 +28,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <assert.h>
 #include <ctype.h>
 #include <dirent.h>
@@ -35,11 +36,13 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "mtbl.h"
@@ -48,6 +51,7 @@
 #include <zlib.h>
 
 #define MTBL_MAGIC			0x77846676
+#define MTBL_MAGIC_SPLIT		0x77846677
 #define MTBL_TRAILER_SIZE		512
 
 #define DEFAULT_COMPRESSION_TYPE	MTBL_COMPRESSION_ZLIB
@@ -58,8 +62,22 @@
 #define DEFAULT_SORTER_TEMP_DIR		"/var/tmp"
 #define DEFAULT_SORTER_MEMORY		1073741824
 #define MIN_SORTER_MEMORY		10485760
+#define MIN_SORTER_FAN_IN		2
+#define MAX_SORTER_FAN_IN		1024
+#define MAX_SORTER_OPEN_RUNS		4
+#define DEFAULT_SORTER_SORT_THREADS	1
+#define MAX_SORTER_SORT_THREADS		64
+#define MAX_SORTER_PARTITIONS		256
+#define SORTER_PARTITION_SAMPLE_SIZE	262144
+
+#define MIN_PSORT_ENTRIES		65536
+#define MAX_SORTER_READAHEAD_THREADS	64
+#define READAHEAD_BATCH_SIZE		65536
+#define READAHEAD_QUEUE_DEPTH		2
 #define INITIAL_SORTER_VEC_SIZE		131072
 
+#define ITER_BATCH_SIZE			64
+
 /* types */
 
 struct block;
@@ -67,6 +85,7 @@ struct block_builder;
 struct block_iter;
 struct trailer;
 struct heap;
+struct readahead;
 
 /* block */
 
@@ -84,6 +103,7 @@ void block_iter_prev(struct block_iter *);
 bool block_iter_get(struct block_iter *,
 	const uint8_t **key, size_t *key_len,
 	const uint8_t **val, size_t *val_len);
+uint8_t *block_detach(struct block *);
 
 /* block builder */
 
@@ -98,6 +118,43 @@ void block_builder_add(struct block_builder *,
 	const uint8_t *val, size_t len_val);
 bool block_builder_empty(struct block_builder *);
 
+/* iter */
+
+/*
+ * Returns a new reference to a pin keeping the value last returned by the
+ * iterator valid, or NULL if the value cannot be pinned without a copy.
+ */
+typedef struct mtbl_pin *(*iter_pin_func)(void *clos);
+
+void iter_set_pin_func(struct mtbl_iter *, iter_pin_func);
+struct mtbl_pin *iter_pin(struct mtbl_iter *);
+
+/* pin */
+
+typedef void (*pin_free_func)(uint8_t *data, size_t len);
+
+struct mtbl_pin *pin_init(uint8_t *data, size_t len, pin_free_func);
+struct mtbl_pin *pin_init_copy(const uint8_t *data, size_t len);
+const uint8_t *pin_data(const struct mtbl_pin *);
+
+/* source */
+
+/*
+ * Called for each index entry of a reader, with the size of the data block
+ * whose keys are at most 'key' and greater than the key of the previous entry.
+ */
+typedef void (*index_visit_func)(void *clos,
+				 const uint8_t *key, size_t len_key,
+				 uint64_t bytes);
+typedef void (*source_index_func)(void *clos, index_visit_func, void *visit_clos);
+
+void source_set_index_func(struct mtbl_source *, source_index_func);
+bool source_index(const struct mtbl_source *, index_visit_func, void *visit_clos);
+
+/* reader */
+
+void reader_advise_sequential(struct mtbl_reader *);
+
 /* trailer */
 
 struct trailer {
@@ -110,11 +167,55 @@ struct trailer {
 	uint64_t	bytes_index_block;
 	uint64_t	bytes_keys;
 	uint64_t	bytes_values;
+	uint64_t	data_block_layout;
 };
 
+/*
+ * In the split layout, each data block is followed by a second block holding
+ * the values of its entries end to end, compressed separately. The value of
+ * each entry in the data block itself is the varint offset and length of its
+ * value in the value block.
+ */
+#define DATA_BLOCK_LAYOUT_DEFAULT	0
+#define DATA_BLOCK_LAYOUT_SPLIT		1
+
 void trailer_write(struct trailer *t, uint8_t *buf);
 bool trailer_read(const uint8_t *buf, struct trailer *t);
 
+/* stats */
+
+/*
+ * Statistics of objects which may be used from many threads at once are kept
+ * in STATS_SHARDS copies, each on its own cache line, and each thread updates
+ * one of them, so that the threads do not contend for the counters.
+ */
+#define STATS_SHARDS		16
+#define STATS_ALIGN		64
+
+unsigned stats_shard(void);
+void *stats_shards_init(size_t size);
+uint64_t stats_now_ns(void);
+
+/* probes */
+
+/*
+ * USDT tracepoints in the "mtbl" provider, enabled with --enable-usdt. When
+ * disabled, they compile to nothing; when enabled, each is a single nop until
+ * a tracer attaches to it. The probes are listed in mtbl(7).
+ */
+#ifdef HAVE_USDT
+# include <sys/sdt.h>
+# define PROBE1(name, a)		DTRACE_PROBE1(mtbl, name, a)
+# define PROBE2(name, a, b)		DTRACE_PROBE2(mtbl, name, a, b)
+# define PROBE3(name, a, b, c)		DTRACE_PROBE3(mtbl, name, a, b, c)
+# define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(mtbl, name, a, b, c, d)
+#else
+# define PROBE1(name, a)		do {} while (0)
+# define PROBE2(name, a, b)		do {} while (0)
+# define PROBE3(name, a, b, c)		do {} while (0)
+# define PROBE4(name, a, b, c, d)	do {} while (0)
+#endif
+
 /* misc */
 
 static inline int
@@ -172,4 +273,16 @@ void *heap_peek(struct heap *);
 void *heap_get(struct heap *, size_t);
 size_t heap_size(struct heap *);
 
+/* psort */
+
+void psort(void **base, size_t n, size_t n_threads,
+	   int (*cmp)(const void *, const void *));
+
+/* readahead */
+
+struct readahead *readahead_init(size_t n_threads);
+void readahead_destroy(struct readahead **);
+struct mtbl_iter *readahead_iter(struct readahead *, struct mtbl_iter *);
+struct mtbl_source *readahead_source(struct readahead *, const struct mtbl_source *);
+
 #endif /* MTBL_PRIVATE_H */
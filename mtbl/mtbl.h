@@ -31,6 +31,11 @@ typedef enum {
 	MTBL_COMPRESSION_ZLIB = 2
 } mtbl_compression_type;
 
+typedef enum {
+	MTBL_SORTER_TEMP_ROUND_ROBIN = 0,
+	MTBL_SORTER_TEMP_FREE_SPACE = 1
+} mtbl_sorter_temp_placement;
+
 typedef enum {
 	mtbl_res_failure = 0,
 	mtbl_res_success = 1
@@ -38,7 +43,9 @@ typedef enum {
 
 /* exported types */
 
+struct mtbl_buf;
 struct mtbl_iter;
+struct mtbl_pin;
 struct mtbl_source;
 
 struct mtbl_reader;
@@ -58,26 +65,126 @@ typedef void
 	const uint8_t *val1, size_t len_val1,
 	uint8_t **merged_val, size_t *len_merged_val);
 
+typedef mtbl_res
+(*mtbl_merge_buf_func)(void *clos,
+	const uint8_t *key, size_t len_key,
+	const uint8_t *val0, size_t len_val0,
+	const uint8_t *val1, size_t len_val1,
+	struct mtbl_buf *merged_val);
+
+typedef mtbl_res
+(*mtbl_merge_multi_func)(void *clos,
+	const uint8_t *key, size_t len_key,
+	size_t n_vals,
+	const uint8_t * const *vals, const size_t *len_vals,
+	struct mtbl_buf *merged_val);
+
 typedef void *
 (*mtbl_merge_init_func)(void);
 
 typedef void
 (*mtbl_merge_free_func)(void *clos);
 
+/* buf */
+
+struct mtbl_buf *
+mtbl_buf_init(void);
+
+void
+mtbl_buf_destroy(struct mtbl_buf **);
+
+uint8_t *
+mtbl_buf_data(struct mtbl_buf *);
+
+size_t
+mtbl_buf_size(struct mtbl_buf *);
+
+void
+mtbl_buf_append(struct mtbl_buf *, const uint8_t *, size_t);
+
+uint8_t *
+mtbl_buf_extend(struct mtbl_buf *, size_t);
+
+void
+mtbl_buf_clip(struct mtbl_buf *, size_t);
+
+/* merge ops */
+
+mtbl_res
+mtbl_merge_op_sum_varint(void *clos,
+	const uint8_t *key, size_t len_key,
+	size_t n_vals,
+	const uint8_t * const *vals, const size_t *len_vals,
+	struct mtbl_buf *merged_val);
+
+mtbl_res
+mtbl_merge_op_sum_fixed64(void *clos,
+	const uint8_t *key, size_t len_key,
+	size_t n_vals,
+	const uint8_t * const *vals, const size_t *len_vals,
+	struct mtbl_buf *merged_val);
+
+mtbl_res
+mtbl_merge_op_min_fixed64(void *clos,
+	const uint8_t *key, size_t len_key,
+	size_t n_vals,
+	const uint8_t * const *vals, const size_t *len_vals,
+	struct mtbl_buf *merged_val);
+
+mtbl_res
+mtbl_merge_op_max_fixed64(void *clos,
+	const uint8_t *key, size_t len_key,
+	size_t n_vals,
+	const uint8_t * const *vals, const size_t *len_vals,
+	struct mtbl_buf *merged_val);
+
+mtbl_res
+mtbl_merge_op_union_sorted(void *clos,
+	const uint8_t *key, size_t len_key,
+	size_t n_vals,
+	const uint8_t * const *vals, const size_t *len_vals,
+	struct mtbl_buf *merged_val);
+
+mtbl_merge_multi_func
+mtbl_merge_op_lookup(const char *name);
+
 /* iter */
 
+struct mtbl_kv {
+	const uint8_t	*key;
+	size_t		len_key;
+	const uint8_t	*val;
+	size_t		len_val;
+};
+
 typedef mtbl_res
 (*mtbl_iter_next_func)(
 	void *,
 	const uint8_t **key, size_t *len_key,
 	const uint8_t **val, size_t *len_val);
 
+typedef mtbl_res
+(*mtbl_iter_seek_func)(
+	void *,
+	const uint8_t *key, size_t len_key);
+
+typedef size_t
+(*mtbl_iter_next_batch_func)(
+	void *,
+	struct mtbl_kv *kv, size_t max);
+
 typedef void
 (*mtbl_iter_free_func)(void *);
 
 struct mtbl_iter *
 mtbl_iter_init(mtbl_iter_next_func, mtbl_iter_free_func, void *clos);
 
+void
+mtbl_iter_set_seek_func(struct mtbl_iter *, mtbl_iter_seek_func);
+
+void
+mtbl_iter_set_next_batch_func(struct mtbl_iter *, mtbl_iter_next_batch_func);
+
 void
 mtbl_iter_destroy(struct mtbl_iter **);
 
@@ -88,6 +195,32 @@ mtbl_iter_next(
 	const uint8_t **val, size_t *len_val)
 __attribute__((warn_unused_result));
 
+size_t
+mtbl_iter_next_batch(
+	struct mtbl_iter *,
+	struct mtbl_kv *kv, size_t max);
+
+mtbl_res
+mtbl_iter_seek(
+	struct mtbl_iter *,
+	const uint8_t *key, size_t len_key);
+
+mtbl_res
+mtbl_iter_next_pinned(
+	struct mtbl_iter *,
+	const uint8_t **key, size_t *len_key,
+	const uint8_t **val, size_t *len_val,
+	struct mtbl_pin **pin)
+__attribute__((warn_unused_result));
+
+/* pin */
+
+struct mtbl_pin *
+mtbl_pin_retain(struct mtbl_pin *);
+
+void
+mtbl_pin_release(struct mtbl_pin **);
+
 /* source */
 
 typedef struct mtbl_iter *
@@ -116,6 +249,13 @@ mtbl_source_init(
 	mtbl_source_free_func,
 	void *clos);
 
+void
+mtbl_source_set_keys_funcs(
+	struct mtbl_source *,
+	mtbl_source_iter_func,
+	mtbl_source_get_prefix_func,
+	mtbl_source_get_range_func);
+
 void
 mtbl_source_destroy(struct mtbl_source **);
 
@@ -134,6 +274,38 @@ mtbl_source_get_range(
 	const uint8_t *key0, size_t len_key0,
 	const uint8_t *key1, size_t len_key1);
 
+struct mtbl_iter *
+mtbl_source_iter_keys(const struct mtbl_source *);
+
+struct mtbl_iter *
+mtbl_source_get_prefix_keys(const struct mtbl_source *, const uint8_t *key, size_t len_key);
+
+struct mtbl_iter *
+mtbl_source_get_range_keys(
+	const struct mtbl_source *,
+	const uint8_t *key0, size_t len_key0,
+	const uint8_t *key1, size_t len_key1);
+
+size_t
+mtbl_source_split(const struct mtbl_source *, size_t n, struct mtbl_iter **iters);
+
+struct mtbl_source *
+mtbl_source_intersection(
+	const struct mtbl_source * const *sources,
+	size_t n_sources);
+
+struct mtbl_source *
+mtbl_source_join(
+	const struct mtbl_source * const *sources,
+	size_t n_sources,
+	mtbl_merge_multi_func,
+	void *clos);
+
+struct mtbl_source *
+mtbl_source_difference(
+	const struct mtbl_source *,
+	const struct mtbl_source *);
+
 mtbl_res
 mtbl_source_write(const struct mtbl_source *, struct mtbl_writer *)
 __attribute__((warn_unused_result));
@@ -146,7 +318,19 @@ mtbl_writer_init(const char *fname, const struct mtbl_writer_options *);
 struct mtbl_writer *
 mtbl_writer_init_fd(int fd, const struct mtbl_writer_options *);
 
-void
+typedef mtbl_res
+(*mtbl_writer_write_func)(void *clos, const uint8_t *data, size_t len);
+
+struct mtbl_writer *
+mtbl_writer_init_func(
+	mtbl_writer_write_func,
+	void *clos,
+	const struct mtbl_writer_options *);
+
+struct mtbl_writer *
+mtbl_writer_init_buf(struct mtbl_buf *, const struct mtbl_writer_options *);
+
+mtbl_res
 mtbl_writer_destroy(struct mtbl_writer **);
 
 mtbl_res
@@ -174,6 +358,11 @@ mtbl_writer_options_set_block_size(
 	struct mtbl_writer_options *,
 	size_t);
 
+void
+mtbl_writer_options_set_split_values(
+	struct mtbl_writer_options *,
+	bool);
+
 void
 mtbl_writer_options_set_block_restart_interval(
 	struct mtbl_writer_options *,
@@ -187,12 +376,31 @@ mtbl_reader_init(const char *fname, const struct mtbl_reader_options *);
 struct mtbl_reader *
 mtbl_reader_init_fd(int fd, const struct mtbl_reader_options *);
 
+struct mtbl_reader *
+mtbl_reader_init_buffer(
+	const uint8_t *data, size_t len_data,
+	const struct mtbl_reader_options *);
+
 void
 mtbl_reader_destroy(struct mtbl_reader **);
 
 const struct mtbl_source *
 mtbl_reader_source(struct mtbl_reader *);
 
+struct mtbl_reader_stats {
+	uint64_t	count_iters;
+	uint64_t	count_index_seeks;
+	uint64_t	count_blocks_read;
+	uint64_t	count_blocks_decompressed;
+	uint64_t	count_checksums_verified;
+	uint64_t	bytes_read;
+	uint64_t	bytes_decompressed;
+	uint64_t	time_blocks_ns;
+};
+
+void
+mtbl_reader_stats(struct mtbl_reader *, struct mtbl_reader_stats *);
+
 /* reader options */
 
 struct mtbl_reader_options *
@@ -204,6 +412,9 @@ mtbl_reader_options_destroy(struct mtbl_reader_options **);
 void
 mtbl_reader_options_set_verify_checksums(struct mtbl_reader_options *, bool);
 
+void
+mtbl_reader_options_set_timing(struct mtbl_reader_options *, bool);
+
 /* merger */
 
 struct mtbl_merger *
@@ -218,6 +429,17 @@ mtbl_merger_add_source(struct mtbl_merger *, const struct mtbl_source *);
 const struct mtbl_source *
 mtbl_merger_source(struct mtbl_merger *);
 
+struct mtbl_merger_stats {
+	uint64_t	count_iters;
+	uint64_t	count_entries;
+	uint64_t	count_duplicates;
+	uint64_t	count_merges;
+	uint64_t	count_seeks;
+};
+
+void
+mtbl_merger_stats(struct mtbl_merger *, struct mtbl_merger_stats *);
+
 /* merger options */
 
 struct mtbl_merger_options *
@@ -232,6 +454,23 @@ mtbl_merger_options_set_merge_func(
 	mtbl_merge_func,
 	void *clos);
 
+void
+mtbl_merger_options_set_merge_buf_func(
+	struct mtbl_merger_options *,
+	mtbl_merge_buf_func,
+	void *clos);
+
+void
+mtbl_merger_options_set_merge_multi_func(
+	struct mtbl_merger_options *,
+	mtbl_merge_multi_func,
+	void *clos);
+
+void
+mtbl_merger_options_set_precedence(
+	struct mtbl_merger_options *,
+	bool);
+
 /* sorter */
 
 struct mtbl_sorter *
@@ -250,9 +489,31 @@ mtbl_res
 mtbl_sorter_write(struct mtbl_sorter *, struct mtbl_writer *)
 __attribute__((warn_unused_result));
 
+mtbl_res
+mtbl_sorter_write_partitions(struct mtbl_sorter *,
+	struct mtbl_writer **, size_t)
+__attribute__((warn_unused_result));
+
 struct mtbl_iter *
 mtbl_sorter_iter(struct mtbl_sorter *s);
 
+struct mtbl_sorter_stats {
+	uint64_t	count_entries;
+	uint64_t	count_spills;
+	uint64_t	count_spills_presorted;
+	uint64_t	count_runs;
+	uint64_t	count_runs_open;
+	uint64_t	count_chunks;
+	uint64_t	count_merge_passes;
+	uint64_t	count_merges;
+	uint64_t	bytes_spilled;
+	uint64_t	bytes_merged;
+	uint64_t	time_spills_ns;
+};
+
+void
+mtbl_sorter_stats(struct mtbl_sorter *, struct mtbl_sorter_stats *);
+
 /* sorter options */
 
 struct mtbl_sorter_options *
@@ -267,16 +528,73 @@ mtbl_sorter_options_set_merge_func(
 	mtbl_merge_func merge_fp,
 	void *clos);
 
+void
+mtbl_sorter_options_set_merge_buf_func(
+	struct mtbl_sorter_options *,
+	mtbl_merge_buf_func merge_fp,
+	void *clos);
+
+void
+mtbl_sorter_options_set_merge_multi_func(
+	struct mtbl_sorter_options *,
+	mtbl_merge_multi_func merge_fp,
+	void *clos);
+
 void
 mtbl_sorter_options_set_temp_dir(
 	struct mtbl_sorter_options *,
 	const char *);
 
+void
+mtbl_sorter_options_add_temp_dir(
+	struct mtbl_sorter_options *,
+	const char *);
+
+void
+mtbl_sorter_options_set_temp_placement(
+	struct mtbl_sorter_options *,
+	mtbl_sorter_temp_placement);
+
 void
 mtbl_sorter_options_set_max_memory(
 	struct mtbl_sorter_options *,
 	size_t);
 
+void
+mtbl_sorter_options_set_max_fan_in(
+	struct mtbl_sorter_options *,
+	size_t);
+
+void
+mtbl_sorter_options_set_preaggregate(
+	struct mtbl_sorter_options *,
+	bool);
+
+void
+mtbl_sorter_options_set_sort_threads(
+	struct mtbl_sorter_options *,
+	size_t);
+
+void
+mtbl_sorter_options_set_background_spill(
+	struct mtbl_sorter_options *,
+	bool);
+
+void
+mtbl_sorter_options_set_thread_safe(
+	struct mtbl_sorter_options *,
+	bool);
+
+void
+mtbl_sorter_options_set_partitions(
+	struct mtbl_sorter_options *,
+	size_t);
+
+void
+mtbl_sorter_options_set_readahead_threads(
+	struct mtbl_sorter_options *,
+	size_t);
+
 /* crc32c */
 
 uint32_t
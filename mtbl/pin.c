@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "mtbl-private.h"
+
+/*
+ * A pin holds a reference-counted region of memory from which values have
+ * been returned, such as a decompressed block or the mapping of a reader, and
+ * frees it once the last reference is released. The references may be
+ * released from any thread.
+ */
+struct mtbl_pin {
+	uint32_t			refs;
+	uint8_t				*data;
+	size_t				len;
+	pin_free_func			free_data;
+};
+
+struct mtbl_pin *
+pin_init(uint8_t *data, size_t len, pin_free_func free_data)
+{
+	struct mtbl_pin *pin = my_calloc(1, sizeof(*pin));
+	pin->refs = 1;
+	pin->data = data;
+	pin->len = len;
+	pin->free_data = free_data;
+	return (pin);
+}
+
+/* The copy is allocated along with the pin, and freed with it. */
+struct mtbl_pin *
+pin_init_copy(const uint8_t *data, size_t len)
+{
+	struct mtbl_pin *pin = my_malloc(sizeof(*pin) + len);
+	pin->refs = 1;
+	pin->data = (uint8_t *) (pin + 1);
+	pin->len = len;
+	pin->free_data = NULL;
+	if (len > 0)
+		memcpy(pin->data, data, len);
+	return (pin);
+}
+
+const uint8_t *
+pin_data(const struct mtbl_pin *pin)
+{
+	return (pin->data);
+}
+
+struct mtbl_pin *
+mtbl_pin_retain(struct mtbl_pin *pin)
+{
+	__atomic_add_fetch(&pin->refs, 1, __ATOMIC_RELAXED);
+	return (pin);
+}
+
+void
+mtbl_pin_release(struct mtbl_pin **pin)
+{
+	if (*pin == NULL)
+		return;
+	if (__atomic_sub_fetch(&(*pin)->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		if ((*pin)->free_data != NULL)
+			(*pin)->free_data((*pin)->data, (*pin)->len);
+		free(*pin);
+	}
+	*pin = NULL;
+}
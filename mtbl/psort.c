@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "mtbl-private.h"
+
+/*
+ * Parallel merge sort of an array of pointers. The array is divided into
+ * 'n_threads' segments which are sorted concurrently with qsort(), and then
+ * adjacent pairs of sorted segments are merged concurrently, halving the
+ * number of segments in each pass, until a single sorted segment remains.
+ */
+
+struct psort_seg {
+	void			**src;
+	void			**dst;
+	size_t			lo;
+	size_t			mid;
+	size_t			hi;
+	int			(*cmp)(const void *, const void *);
+};
+
+static void *
+psort_qsort_thr(void *arg)
+{
+	struct psort_seg *seg = (struct psort_seg *) arg;
+	qsort(&seg->src[seg->lo], seg->hi - seg->lo, sizeof(void *), seg->cmp);
+	return (NULL);
+}
+
+static void *
+psort_merge_thr(void *arg)
+{
+	struct psort_seg *seg = (struct psort_seg *) arg;
+	void **src = seg->src;
+	void **dst = seg->dst;
+	size_t i = seg->lo, j = seg->mid, k = seg->lo;
+
+	while (i < seg->mid && j < seg->hi) {
+		if (seg->cmp(&src[j], &src[i]) < 0)
+			dst[k++] = src[j++];
+		else
+			dst[k++] = src[i++];
+	}
+	while (i < seg->mid)
+		dst[k++] = src[i++];
+	while (j < seg->hi)
+		dst[k++] = src[j++];
+	return (NULL);
+}
+
+static void
+psort_run(struct psort_seg *segs, size_t n_segs, void *(*fn)(void *))
+{
+	pthread_t thr[n_segs];
+
+	for (size_t i = 1; i < n_segs; i++) {
+		int ret = pthread_create(&thr[i], NULL, fn, &segs[i]);
+		assert(ret == 0);
+	}
+	fn(&segs[0]);
+	for (size_t i = 1; i < n_segs; i++) {
+		int ret = pthread_join(thr[i], NULL);
+		assert(ret == 0);
+	}
+}
+
+void
+psort(void **base, size_t n, size_t n_threads,
+      int (*cmp)(const void *, const void *))
+{
+	if (n_threads > n / MIN_PSORT_ENTRIES)
+		n_threads = n / MIN_PSORT_ENTRIES;
+	if (n_threads <= 1) {
+		qsort(base, n, sizeof(void *), cmp);
+		return;
+	}
+
+	size_t n_segs = n_threads;
+	size_t bounds[n_segs + 1];
+	for (size_t i = 0; i <= n_segs; i++)
+		bounds[i] = (n * i) / n_segs;
+
+	void **tmp = my_malloc(n * sizeof(void *));
+	void **src = base, **dst = tmp;
+	struct psort_seg segs[n_segs];
+
+	for (size_t i = 0; i < n_segs; i++) {
+		segs[i].src = src;
+		segs[i].lo = bounds[i];
+		segs[i].hi = bounds[i + 1];
+		segs[i].cmp = cmp;
+	}
+	psort_run(segs, n_segs, psort_qsort_thr);
+
+	while (n_segs > 1) {
+		size_t n_pairs = 0;
+		for (size_t i = 0; i < n_segs; i += 2) {
+			struct psort_seg *seg = &segs[n_pairs];
+			seg->src = src;
+			seg->dst = dst;
+			seg->lo = bounds[i];
+			seg->cmp = cmp;
+			if (i + 1 < n_segs) {
+				seg->mid = bounds[i + 1];
+				seg->hi = bounds[i + 2];
+			} else {
+				/* odd segment out, copy it through */
+				seg->mid = bounds[i + 1];
+				seg->hi = bounds[i + 1];
+			}
+			bounds[n_pairs] = bounds[i];
+			n_pairs += 1;
+		}
+		bounds[n_pairs] = n;
+		psort_run(segs, n_pairs, psort_merge_thr);
+
+		void **t = src;
+		src = dst;
+		dst = t;
+		n_segs = n_pairs;
+	}
+
+	if (src != base)
+		memcpy(base, src, n * sizeof(void *));
+	free(tmp);
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "mtbl-private.h"
+#include "vector_types.h"
+
+/*
+ * Read-ahead of iterators by a pool of worker threads. Each wrapped iterator
+ * is advanced by the workers (which is where blocks are read and
+ * decompressed), and its entries are copied into batches which are queued
+ * for the consumer. At most READAHEAD_QUEUE_DEPTH batches are queued per
+ * iterator, and each iterator is advanced by at most one worker at a time.
+ *
+ * A batch is a sequence of entries, each encoded as the 32-bit length of the
+ * key, the 32-bit length of the value, the key, and the value.
+ */
+
+struct ra_iter {
+	struct readahead		*ra;
+	struct mtbl_iter		*it;
+	ubuf				*queue[READAHEAD_QUEUE_DEPTH];
+	size_t				q_head;
+	size_t				q_len;
+	ubuf				*cur;
+	size_t				pos;
+	bool				busy;
+	bool				done;
+	bool				closed;
+};
+
+VECTOR_GENERATE(ra_iter_vec, struct ra_iter *);
+
+struct ra_source {
+	struct readahead		*ra;
+	const struct mtbl_source	*source;
+};
+
+struct readahead {
+	pthread_mutex_t			lock;
+	pthread_cond_t			work_cond;
+	pthread_cond_t			data_cond;
+	ra_iter_vec			*iters;
+	size_t				next;
+	size_t				n_threads;
+	pthread_t			*threads;
+	bool				shutdown;
+};
+
+/*
+ * Find an iterator which needs another batch and mark it busy. Called with
+ * the pool locked. Iterators are scanned starting after the last one chosen,
+ * so that all of them are kept fed.
+ */
+static struct ra_iter *
+ra_claim(struct readahead *ra)
+{
+	size_t n = ra_iter_vec_size(ra->iters);
+	for (size_t i = 0; i < n; i++) {
+		size_t idx = (ra->next + i) % n;
+		struct ra_iter *rit = ra_iter_vec_value(ra->iters, idx);
+		if (!rit->busy && !rit->done && !rit->closed &&
+		    rit->q_len < READAHEAD_QUEUE_DEPTH)
+		{
+			ra->next = idx + 1;
+			rit->busy = true;
+			return (rit);
+		}
+	}
+	return (NULL);
+}
+
+static bool
+ra_fill(struct ra_iter *rit, ubuf *batch)
+{
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	uint8_t lens[2 * sizeof(uint32_t)];
+
+	ubuf_clip(batch, 0);
+	while (ubuf_size(batch) < READAHEAD_BATCH_SIZE) {
+		if (mtbl_iter_next(rit->it, &key, &len_key, &val, &len_val) != mtbl_res_success)
+			return (false);
+		mtbl_fixed_encode32(lens, len_key);
+		mtbl_fixed_encode32(lens + sizeof(uint32_t), len_val);
+		ubuf_append(batch, lens, sizeof(lens));
+		ubuf_append(batch, key, len_key);
+		ubuf_append(batch, val, len_val);
+	}
+	return (true);
+}
+
+static void *
+ra_thr(void *arg)
+{
+	struct readahead *ra = (struct readahead *) arg;
+
+	pthread_mutex_lock(&ra->lock);
+	for (;;) {
+		struct ra_iter *rit;
+		while ((rit = ra_claim(ra)) == NULL && !ra->shutdown)
+			pthread_cond_wait(&ra->work_cond, &ra->lock);
+		if (rit == NULL)
+			break;
+		pthread_mutex_unlock(&ra->lock);
+
+		ubuf *batch = ubuf_init(READAHEAD_BATCH_SIZE);
+		bool more = ra_fill(rit, batch);
+
+		pthread_mutex_lock(&ra->lock);
+		if (ubuf_size(batch) > 0) {
+			size_t tail = (rit->q_head + rit->q_len) % READAHEAD_QUEUE_DEPTH;
+			rit->queue[tail] = batch;
+			rit->q_len += 1;
+		} else {
+			ubuf_destroy(&batch);
+		}
+		if (!more)
+			rit->done = true;
+		rit->busy = false;
+		pthread_cond_broadcast(&ra->data_cond);
+	}
+	pthread_mutex_unlock(&ra->lock);
+	return (NULL);
+}
+
+struct readahead *
+readahead_init(size_t n_threads)
+{
+	struct readahead *ra = my_calloc(1, sizeof(*ra));
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->work_cond, NULL);
+	pthread_cond_init(&ra->data_cond, NULL);
+	ra->iters = ra_iter_vec_init(1);
+	ra->n_threads = n_threads;
+	ra->threads = my_calloc(n_threads, sizeof(pthread_t));
+	for (size_t i = 0; i < n_threads; i++) {
+		int ret = pthread_create(&ra->threads[i], NULL, ra_thr, ra);
+		assert(ret == 0);
+	}
+	return (ra);
+}
+
+void
+readahead_destroy(struct readahead **ra)
+{
+	if (*ra) {
+		pthread_mutex_lock(&(*ra)->lock);
+		(*ra)->shutdown = true;
+		pthread_cond_broadcast(&(*ra)->work_cond);
+		pthread_mutex_unlock(&(*ra)->lock);
+		for (size_t i = 0; i < (*ra)->n_threads; i++)
+			pthread_join((*ra)->threads[i], NULL);
+		free((*ra)->threads);
+		assert(ra_iter_vec_size((*ra)->iters) == 0);
+		ra_iter_vec_destroy(&(*ra)->iters);
+		pthread_mutex_destroy(&(*ra)->lock);
+		pthread_cond_destroy(&(*ra)->work_cond);
+		pthread_cond_destroy(&(*ra)->data_cond);
+		free(*ra);
+		*ra = NULL;
+	}
+}
+
+static mtbl_res
+ra_iter_next(void *v,
+	     const uint8_t **key, size_t *len_key,
+	     const uint8_t **val, size_t *len_val)
+{
+	struct ra_iter *rit = (struct ra_iter *) v;
+	struct readahead *ra = rit->ra;
+
+	if (rit->cur == NULL || rit->pos >= ubuf_size(rit->cur)) {
+		/* the previous batch is no longer referenced by the caller */
+		ubuf_destroy(&rit->cur);
+
+		pthread_mutex_lock(&ra->lock);
+		while (rit->q_len == 0 && !rit->done)
+			pthread_cond_wait(&ra->data_cond, &ra->lock);
+		if (rit->q_len > 0) {
+			rit->cur = rit->queue[rit->q_head];
+			rit->q_head = (rit->q_head + 1) % READAHEAD_QUEUE_DEPTH;
+			rit->q_len -= 1;
+			rit->pos = 0;
+			if (!rit->done)
+				pthread_cond_signal(&ra->work_cond);
+		}
+		pthread_mutex_unlock(&ra->lock);
+		if (rit->cur == NULL)
+			return (mtbl_res_failure);
+	}
+
+	const uint8_t *p = ubuf_data(rit->cur) + rit->pos;
+	*len_key = mtbl_fixed_decode32(p);
+	*len_val = mtbl_fixed_decode32(p + sizeof(uint32_t));
+	*key = p + 2 * sizeof(uint32_t);
+	*val = *key + *len_key;
+	rit->pos += 2 * sizeof(uint32_t) + *len_key + *len_val;
+	return (mtbl_res_success);
+}
+
+static void
+ra_iter_free(void *v)
+{
+	struct ra_iter *rit = (struct ra_iter *) v;
+	struct readahead *ra = rit->ra;
+
+	pthread_mutex_lock(&ra->lock);
+	rit->closed = true;
+	while (rit->busy)
+		pthread_cond_wait(&ra->data_cond, &ra->lock);
+	for (size_t i = 0; i < ra_iter_vec_size(ra->iters); i++) {
+		if (ra_iter_vec_value(ra->iters, i) == rit) {
+			size_t last = ra_iter_vec_size(ra->iters) - 1;
+			ra_iter_vec_data(ra->iters)[i] = ra_iter_vec_value(ra->iters, last);
+			ra_iter_vec_clip(ra->iters, last);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ra->lock);
+
+	for (size_t i = 0; i < rit->q_len; i++)
+		ubuf_destroy(&rit->queue[(rit->q_head + i) % READAHEAD_QUEUE_DEPTH]);
+	ubuf_destroy(&rit->cur);
+	mtbl_iter_destroy(&rit->it);
+	free(rit);
+}
+
+/*
+ * Wrap 'it' so that it is read ahead by the worker pool. The returned
+ * iterator takes ownership of 'it', and must be destroyed before the pool.
+ */
+struct mtbl_iter *
+readahead_iter(struct readahead *ra, struct mtbl_iter *it)
+{
+	struct ra_iter *rit = my_calloc(1, sizeof(*rit));
+	rit->ra = ra;
+	rit->it = it;
+	if (it == NULL)
+		rit->done = true;
+
+	pthread_mutex_lock(&ra->lock);
+	ra_iter_vec_add(ra->iters, rit);
+	pthread_cond_signal(&ra->work_cond);
+	pthread_mutex_unlock(&ra->lock);
+
+	return (mtbl_iter_init(ra_iter_next, ra_iter_free, rit));
+}
+
+static struct mtbl_iter *
+ra_source_iter(void *clos)
+{
+	struct ra_source *rs = (struct ra_source *) clos;
+	return (readahead_iter(rs->ra, mtbl_source_iter(rs->source)));
+}
+
+static struct mtbl_iter *
+ra_source_get(void *clos, const uint8_t *key, size_t len_key)
+{
+	struct ra_source *rs = (struct ra_source *) clos;
+	return (mtbl_source_get(rs->source, key, len_key));
+}
+
+static struct mtbl_iter *
+ra_source_get_prefix(void *clos, const uint8_t *key, size_t len_key)
+{
+	struct ra_source *rs = (struct ra_source *) clos;
+	return (mtbl_source_get_prefix(rs->source, key, len_key));
+}
+
+static struct mtbl_iter *
+ra_source_get_range(void *clos,
+		    const uint8_t *key0, size_t len_key0,
+		    const uint8_t *key1, size_t len_key1)
+{
+	struct ra_source *rs = (struct ra_source *) clos;
+	return (mtbl_source_get_range(rs->source, key0, len_key0, key1, len_key1));
+}
+
+/*
+ * Wrap 'source' so that full iterations over it are read ahead by the worker
+ * pool. Lookups are passed through to 'source' unchanged.
+ */
+struct mtbl_source *
+readahead_source(struct readahead *ra, const struct mtbl_source *source)
+{
+	struct ra_source *rs = my_calloc(1, sizeof(*rs));
+	rs->ra = ra;
+	rs->source = source;
+	return (mtbl_source_init(ra_source_iter,
+				 ra_source_get,
+				 ra_source_get_prefix,
+				 ra_source_get_range,
+				 free, rs));
+}
@@ -29,7 +29,16 @@ struct reader_iter {
 	struct block			*b;
 	struct block_iter		*bi;
 	struct block_iter		*index_iter;
+	struct mtbl_pin			*block_pin;
+	struct mtbl_pin			*vals_pin;
+	uint64_t			offset;
 	ubuf				*k;
+	ubuf				*batch_keys;
+	uint8_t				*vals;
+	size_t				len_vals;
+	bool				vals_loaded;
+	bool				vals_free;
+	bool				keys_only;
 	bool				first;
 	bool				valid;
 	reader_iter_type		it_type;
@@ -37,8 +46,13 @@ struct reader_iter {
 
 struct mtbl_reader_options {
 	bool				verify_checksums;
+	bool				timing;
 };
 
+struct reader_stats_shard {
+	struct mtbl_reader_stats	s;
+} __attribute__((aligned(STATS_ALIGN)));
+
 struct mtbl_reader {
 	int				fd;
 	struct trailer			t;
@@ -47,11 +61,29 @@ struct mtbl_reader {
 	struct mtbl_reader_options	opt;
 	struct block			*index;
 	struct mtbl_source		*source;
+	struct mtbl_pin			*map_pin;
+	struct reader_stats_shard	*stats;
 };
 
+/* Iterators on the same reader may be used concurrently, see stats_shard(). */
+#define reader_stat_add(r, field, n) \
+	__atomic_add_fetch(&(r)->stats[stats_shard()].s.field, (n), __ATOMIC_RELAXED)
+
 static mtbl_res
 reader_iter_next(void *, const uint8_t **, size_t *, const uint8_t **, size_t *);
 
+static mtbl_res
+reader_iter_seek(void *, const uint8_t *, size_t);
+
+static size_t
+reader_iter_next_batch(void *, struct mtbl_kv *, size_t);
+
+static void
+reader_iter_drop_values(struct reader_iter *);
+
+static struct mtbl_pin *
+reader_iter_pin(void *);
+
 static void
 reader_iter_free(void *);
 
@@ -67,6 +99,18 @@ reader_get_prefix(void *, const uint8_t *, size_t);
 static struct mtbl_iter *
 reader_get_range(void *, const uint8_t *, size_t, const uint8_t *, size_t);
 
+static struct mtbl_iter *
+reader_iter_keys(void *);
+
+static struct mtbl_iter *
+reader_get_prefix_keys(void *, const uint8_t *, size_t);
+
+static struct mtbl_iter *
+reader_get_range_keys(void *, const uint8_t *, size_t, const uint8_t *, size_t);
+
+static void
+reader_index(void *, index_visit_func, void *);
+
 struct mtbl_reader_options *
 mtbl_reader_options_init(void)
 {
@@ -89,38 +133,56 @@ mtbl_reader_options_set_verify_checksums(struct mtbl_reader_options *opt,
 	opt->verify_checksums = verify_checksums;
 }
 
-struct mtbl_reader *
-mtbl_reader_init_fd(int orig_fd, const struct mtbl_reader_options *opt)
+void
+mtbl_reader_options_set_timing(struct mtbl_reader_options *opt, bool timing)
+{
+	opt->timing = timing;
+}
+
+static void
+reader_unmap(uint8_t *data, size_t len)
+{
+	munmap(data, len);
+}
+
+static void
+reader_free_contents(uint8_t *data, size_t len)
+{
+	free(data);
+}
+
+/*
+ * Open the table in 'data', which is held by 'map_pin'. On failure, the pin is
+ * released.
+ */
+static struct mtbl_reader *
+reader_init(uint8_t *data, size_t len_data, struct mtbl_pin *map_pin,
+	    const struct mtbl_reader_options *opt)
 {
 	struct mtbl_reader *r;
-	struct stat ss;
 	size_t trailer_offset;
-	int fd;
 
 	size_t index_len;
 	uint32_t index_crc;
 	uint8_t *index_data;
 
-	assert(orig_fd >= 0);
-	fd = dup(orig_fd);
-	assert(fd >= 0);
-	int ret = fstat(fd, &ss);
-	assert(ret == 0);
-
 	r = my_calloc(1, sizeof(*r));
 	if (opt != NULL)
 		memcpy(&r->opt, opt, sizeof(*opt));
-	r->fd = fd;
-	r->len_data = ss.st_size;
-	r->data = mmap(NULL, r->len_data, PROT_READ, MAP_PRIVATE, r->fd, 0);
-	if (r->data == MAP_FAILED) {
-		close(r->fd);
-		free(r);
+	r->fd = -1;
+	r->stats = stats_shards_init(STATS_SHARDS * sizeof(struct reader_stats_shard));
+	r->data = data;
+	r->len_data = len_data;
+	r->map_pin = map_pin;
+
+	if (r->len_data < MTBL_TRAILER_SIZE) {
+		mtbl_reader_destroy(&r);
 		return (NULL);
 	}
-
 	trailer_offset = r->len_data - MTBL_TRAILER_SIZE;
-	if (!trailer_read(r->data + trailer_offset, &r->t)) {
+	if (!trailer_read(r->data + trailer_offset, &r->t) ||
+	    r->t.index_block_offset + 2 * sizeof(uint32_t) > trailer_offset)
+	{
 		mtbl_reader_destroy(&r);
 		return (NULL);
 	}
@@ -128,6 +190,10 @@ mtbl_reader_init_fd(int orig_fd, const struct mtbl_reader_options *opt)
 	index_len = mtbl_fixed_decode32(r->data + r->t.index_block_offset + 0);
 	index_crc = mtbl_fixed_decode32(r->data + r->t.index_block_offset + sizeof(uint32_t));
 	index_data = r->data + r->t.index_block_offset + 2 * sizeof(uint32_t);
+	if (index_len > trailer_offset - r->t.index_block_offset - 2 * sizeof(uint32_t)) {
+		mtbl_reader_destroy(&r);
+		return (NULL);
+	}
 	assert(index_crc == mtbl_crc32c(index_data, index_len));
 	r->index = block_init(index_data, index_len, false);
 	r->source = mtbl_source_init(reader_iter,
@@ -135,9 +201,54 @@ mtbl_reader_init_fd(int orig_fd, const struct mtbl_reader_options *opt)
 				     reader_get_prefix,
 				     reader_get_range,
 				     NULL, r);
+	mtbl_source_set_keys_funcs(r->source,
+				   reader_iter_keys,
+				   reader_get_prefix_keys,
+				   reader_get_range_keys);
+	source_set_index_func(r->source, reader_index);
+	return (r);
+}
+
+struct mtbl_reader *
+mtbl_reader_init_fd(int orig_fd, const struct mtbl_reader_options *opt)
+{
+	struct mtbl_reader *r;
+	struct stat ss;
+	uint8_t *data;
+	int fd;
+
+	assert(orig_fd >= 0);
+	fd = dup(orig_fd);
+	assert(fd >= 0);
+	int ret = fstat(fd, &ss);
+	assert(ret == 0);
+
+	data = mmap(NULL, ss.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return (NULL);
+	}
+	r = reader_init(data, ss.st_size, pin_init(data, ss.st_size, reader_unmap), opt);
+	if (r == NULL) {
+		close(fd);
+		return (NULL);
+	}
+	r->fd = fd;
 	return (r);
 }
 
+/*
+ * The buffer belongs to the caller, so the reader's pin on it frees nothing.
+ * Values pinned from the reader are only valid as long as the buffer is.
+ */
+struct mtbl_reader *
+mtbl_reader_init_buffer(const uint8_t *data, size_t len_data,
+			const struct mtbl_reader_options *opt)
+{
+	uint8_t *d = (uint8_t *) data;
+	return (reader_init(d, len_data, pin_init(d, len_data, NULL), opt));
+}
+
 struct mtbl_reader *
 mtbl_reader_init(const char *fname, const struct mtbl_reader_options *opt)
 {
@@ -158,24 +269,61 @@ mtbl_reader_destroy(struct mtbl_reader **r)
 {
 	if (*r != NULL) {
 		block_destroy(&(*r)->index);
-		munmap((*r)->data, (*r)->len_data);
-		close((*r)->fd);
+		mtbl_pin_release(&(*r)->map_pin);
+		if ((*r)->fd >= 0)
+			close((*r)->fd);
 		mtbl_source_destroy(&(*r)->source);
+		free((*r)->stats);
 		free(*r);
 		*r = NULL;
 	}
 }
 
+/*
+ * Hint that the reader will be consumed in order, so that the kernel reads
+ * ahead aggressively and drops pages behind the reader.
+ */
+void
+reader_advise_sequential(struct mtbl_reader *r)
+{
+	(void) madvise(r->data, r->len_data, MADV_SEQUENTIAL);
+}
+
 const struct mtbl_source *
 mtbl_reader_source(struct mtbl_reader *r)
 {
 	return (r->source);
 }
 
-static struct block *
-get_block(struct mtbl_reader *r, uint64_t offset)
+void
+mtbl_reader_stats(struct mtbl_reader *r, struct mtbl_reader_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	for (size_t i = 0; i < STATS_SHARDS; i++) {
+		const struct mtbl_reader_stats *s = &r->stats[i].s;
+		stats->count_iters += __atomic_load_n(&s->count_iters, __ATOMIC_RELAXED);
+		stats->count_index_seeks +=
+			__atomic_load_n(&s->count_index_seeks, __ATOMIC_RELAXED);
+		stats->count_blocks_read +=
+			__atomic_load_n(&s->count_blocks_read, __ATOMIC_RELAXED);
+		stats->count_blocks_decompressed +=
+			__atomic_load_n(&s->count_blocks_decompressed, __ATOMIC_RELAXED);
+		stats->count_checksums_verified +=
+			__atomic_load_n(&s->count_checksums_verified, __ATOMIC_RELAXED);
+		stats->bytes_read += __atomic_load_n(&s->bytes_read, __ATOMIC_RELAXED);
+		stats->bytes_decompressed +=
+			__atomic_load_n(&s->bytes_decompressed, __ATOMIC_RELAXED);
+		stats->time_blocks_ns += __atomic_load_n(&s->time_blocks_ns, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Return the decompressed contents of the block stored at 'offset'. If
+ * 'needs_free' is set on return, the caller must free them.
+ */
+static uint8_t *
+get_frame(struct mtbl_reader *r, uint64_t offset, size_t *size, bool *needs_free)
 {
-	bool needs_free = false;
 	uint8_t *block_contents = NULL, *raw_contents = NULL;
 	size_t block_contents_size = 0, raw_contents_size = 0;
 	snappy_status res;
@@ -183,6 +331,9 @@ get_block(struct mtbl_reader *r, uint64_t offset)
 	z_stream zs;
 
 	assert(offset < r->len_data);
+	*needs_free = false;
+	uint64_t t0 = r->opt.timing ? stats_now_ns() : 0;
+	PROBE2(block__read__start, r, offset);
 
 	raw_contents_size = mtbl_fixed_decode32(&r->data[offset + 0]);
 	raw_contents = &r->data[offset + 2 * sizeof(uint32_t)];
@@ -192,15 +343,18 @@ get_block(struct mtbl_reader *r, uint64_t offset)
 		block_crc = mtbl_fixed_decode32(&r->data[offset + sizeof(uint32_t)]);
 		calc_crc = mtbl_crc32c(raw_contents, raw_contents_size);
 		assert(block_crc == calc_crc);
+		reader_stat_add(r, count_checksums_verified, 1);
 	}
 
+	if (r->t.compression_algorithm != MTBL_COMPRESSION_NONE)
+		PROBE3(block__decompress__start, r, offset, raw_contents_size);
 	switch (r->t.compression_algorithm) {
 	case MTBL_COMPRESSION_NONE:
 		block_contents = raw_contents;
 		block_contents_size = raw_contents_size;
 		break;
 	case MTBL_COMPRESSION_SNAPPY:
-		needs_free = true;
+		*needs_free = true;
 		block_contents_size = 2 * r->t.data_block_size;
 		block_contents = my_calloc(1, block_contents_size);
 		res = snappy_uncompress((const char *)raw_contents, raw_contents_size,
@@ -208,7 +362,7 @@ get_block(struct mtbl_reader *r, uint64_t offset)
 		assert(res == SNAPPY_OK);
 		break;
 	case MTBL_COMPRESSION_ZLIB:
-		needs_free = true;
+		*needs_free = true;
 		block_contents_size = 2 * r->t.data_block_size;
 		zs.zalloc = Z_NULL;
 		zs.zfree = Z_NULL;
@@ -229,38 +383,109 @@ get_block(struct mtbl_reader *r, uint64_t offset)
 		break;
 	}
 
-	return (block_init(block_contents, block_contents_size, needs_free));
+	reader_stat_add(r, count_blocks_read, 1);
+	reader_stat_add(r, bytes_read, raw_contents_size);
+	if (r->t.compression_algorithm != MTBL_COMPRESSION_NONE) {
+		PROBE3(block__decompress__done, r, offset, block_contents_size);
+		reader_stat_add(r, count_blocks_decompressed, 1);
+		reader_stat_add(r, bytes_decompressed, block_contents_size);
+	}
+	if (r->opt.timing)
+		reader_stat_add(r, time_blocks_ns, stats_now_ns() - t0);
+	PROBE4(block__read__done, r, offset, raw_contents_size, block_contents_size);
+
+	*size = block_contents_size;
+	return (block_contents);
 }
 
 static struct block *
-get_block_at_index(struct mtbl_reader *r, struct block_iter *index_iter)
+get_block(struct mtbl_reader *r, uint64_t offset)
+{
+	bool needs_free = false;
+	size_t size = 0;
+	uint8_t *contents = get_frame(r, offset, &size, &needs_free);
+	return (block_init(contents, size, needs_free));
+}
+
+static bool
+get_offset_at_index(struct block_iter *index_iter, uint64_t *offset)
 {
 	const uint8_t *ikey, *ival;
 	size_t len_ikey, len_ival;
 
 	if (block_iter_get(index_iter, &ikey, &len_ikey, &ival, &len_ival)) {
-		struct block *b;
-		uint64_t offset;
-
-		mtbl_varint_decode64(ival, &offset);
-		b = get_block(r, offset);
-		return (b);
+		mtbl_varint_decode64(ival, offset);
+		return (true);
 	}
+	return (false);
+}
 
+static struct block *
+get_block_at_index(struct mtbl_reader *r, struct block_iter *index_iter, uint64_t *offset)
+{
+	if (get_offset_at_index(index_iter, offset))
+		return (get_block(r, *offset));
 	return (NULL);
 }
 
-static struct mtbl_iter *
-reader_iter(void *clos)
+/*
+ * The size of each data block is the distance to the next one, or to the index
+ * block for the last, so each index key is held until the next is decoded.
+ */
+static void
+reader_index(void *clos, index_visit_func visit, void *visit_clos)
 {
 	struct mtbl_reader *r = (struct mtbl_reader *) clos;
+	struct block_iter *bi = block_iter_init(r->index);
+	ubuf *last_key = ubuf_init(64);
+	uint64_t last_offset = 0, offset;
+	bool have_last = false;
+
+	block_iter_seek_to_first(bi);
+	while (get_offset_at_index(bi, &offset)) {
+		const uint8_t *ikey, *ival;
+		size_t len_ikey, len_ival;
+
+		if (have_last)
+			visit(visit_clos, ubuf_data(last_key), ubuf_size(last_key),
+			      offset - last_offset);
+		block_iter_get(bi, &ikey, &len_ikey, &ival, &len_ival);
+		ubuf_clip(last_key, 0);
+		ubuf_append(last_key, ikey, len_ikey);
+		last_offset = offset;
+		have_last = true;
+		block_iter_next(bi);
+	}
+	if (have_last)
+		visit(visit_clos, ubuf_data(last_key), ubuf_size(last_key),
+		      r->t.index_block_offset - last_offset);
+
+	ubuf_destroy(&last_key);
+	block_iter_destroy(&bi);
+}
+
+static struct mtbl_iter *
+reader_iter_wrap(struct reader_iter *it)
+{
+	struct mtbl_iter *iter = mtbl_iter_init(reader_iter_next, reader_iter_free, it);
+	mtbl_iter_set_seek_func(iter, reader_iter_seek);
+	mtbl_iter_set_next_batch_func(iter, reader_iter_next_batch);
+	iter_set_pin_func(iter, reader_iter_pin);
+	it->batch_keys = ubuf_init(0);
+	return (iter);
+}
+
+static struct mtbl_iter *
+reader_iter_all(struct mtbl_reader *r, bool keys_only)
+{
 	struct reader_iter *it = my_calloc(1, sizeof(*it));
 
 	it->r = r;
 	it->index_iter = block_iter_init(r->index);
+	reader_stat_add(r, count_iters, 1);
 
 	block_iter_seek_to_first(it->index_iter);
-	it->b = get_block_at_index(r, it->index_iter);
+	it->b = get_block_at_index(r, it->index_iter, &it->offset);
 	if (it->b == NULL) {
 		block_iter_destroy(&it->index_iter);
 		block_destroy(&it->b);
@@ -273,8 +498,21 @@ reader_iter(void *clos)
 
 	it->first = true;
 	it->valid = true;
+	it->keys_only = keys_only;
 	it->it_type = READER_ITER_TYPE_ITER;
-	return (mtbl_iter_init(reader_iter_next, reader_iter_free, it));
+	return (reader_iter_wrap(it));
+}
+
+static struct mtbl_iter *
+reader_iter(void *clos)
+{
+	return (reader_iter_all((struct mtbl_reader *) clos, false));
+}
+
+static struct mtbl_iter *
+reader_iter_keys(void *clos)
+{
+	return (reader_iter_all((struct mtbl_reader *) clos, true));
 }
 
 static struct reader_iter *
@@ -284,9 +522,13 @@ reader_iter_init(struct mtbl_reader *r, const uint8_t *key, size_t len_key)
 
 	it->r = r;
 	it->index_iter = block_iter_init(r->index);
+	reader_stat_add(r, count_iters, 1);
 
+	PROBE3(index__seek__start, r, key, len_key);
 	block_iter_seek(it->index_iter, key, len_key);
-	it->b = get_block_at_index(r, it->index_iter);
+	PROBE1(index__seek__done, r);
+	reader_stat_add(r, count_index_seeks, 1);
+	it->b = get_block_at_index(r, it->index_iter, &it->offset);
 	if (it->b == NULL) {
 		block_iter_destroy(&it->index_iter);
 		block_destroy(&it->b);
@@ -312,35 +554,68 @@ reader_get(void *clos, const uint8_t *key, size_t len_key)
 	it->k = ubuf_init(len_key);
 	ubuf_append(it->k, key, len_key);
 	it->it_type = READER_ITER_TYPE_GET;
-	return (mtbl_iter_init(reader_iter_next, reader_iter_free, it));
+	return (reader_iter_wrap(it));
 }
 
 static struct mtbl_iter *
-reader_get_prefix(void *clos, const uint8_t *key, size_t len_key)
+reader_get_prefix_all(struct mtbl_reader *r,
+		      const uint8_t *key, size_t len_key,
+		      bool keys_only)
 {
-	struct mtbl_reader *r = (struct mtbl_reader *) clos;
 	struct reader_iter *it = reader_iter_init(r, key, len_key);
 	if (it == NULL)
 		return (NULL);
 	it->k = ubuf_init(len_key);
 	ubuf_append(it->k, key, len_key);
+	it->keys_only = keys_only;
 	it->it_type = READER_ITER_TYPE_GET_PREFIX;
-	return (mtbl_iter_init(reader_iter_next, reader_iter_free, it));
+	return (reader_iter_wrap(it));
 }
 
 static struct mtbl_iter *
-reader_get_range(void *clos,
-		 const uint8_t *key0, size_t len_key0,
-		 const uint8_t *key1, size_t len_key1)
+reader_get_prefix(void *clos, const uint8_t *key, size_t len_key)
+{
+	return (reader_get_prefix_all((struct mtbl_reader *) clos, key, len_key, false));
+}
+
+static struct mtbl_iter *
+reader_get_prefix_keys(void *clos, const uint8_t *key, size_t len_key)
+{
+	return (reader_get_prefix_all((struct mtbl_reader *) clos, key, len_key, true));
+}
+
+static struct mtbl_iter *
+reader_get_range_all(struct mtbl_reader *r,
+		     const uint8_t *key0, size_t len_key0,
+		     const uint8_t *key1, size_t len_key1,
+		     bool keys_only)
 {
-	struct mtbl_reader *r = (struct mtbl_reader *) clos;
 	struct reader_iter *it = reader_iter_init(r, key0, len_key0);
 	if (it == NULL)
 		return (NULL);
 	it->k = ubuf_init(len_key1);
 	ubuf_append(it->k, key1, len_key1);
+	it->keys_only = keys_only;
 	it->it_type = READER_ITER_TYPE_GET_RANGE;
-	return (mtbl_iter_init(reader_iter_next, reader_iter_free, it));
+	return (reader_iter_wrap(it));
+}
+
+static struct mtbl_iter *
+reader_get_range(void *clos,
+		 const uint8_t *key0, size_t len_key0,
+		 const uint8_t *key1, size_t len_key1)
+{
+	return (reader_get_range_all((struct mtbl_reader *) clos,
+				     key0, len_key0, key1, len_key1, false));
+}
+
+static struct mtbl_iter *
+reader_get_range_keys(void *clos,
+		      const uint8_t *key0, size_t len_key0,
+		      const uint8_t *key1, size_t len_key1)
+{
+	return (reader_get_range_all((struct mtbl_reader *) clos,
+				     key0, len_key0, key1, len_key1, true));
 }
 
 static void
@@ -349,13 +624,112 @@ reader_iter_free(void *v)
 	struct reader_iter *it = (struct reader_iter *) v;
 	if (it) {
 		ubuf_destroy(&it->k);
+		ubuf_destroy(&it->batch_keys);
+		reader_iter_drop_values(it);
 		block_destroy(&it->b);
+		mtbl_pin_release(&it->block_pin);
 		block_iter_destroy(&it->bi);
 		block_iter_destroy(&it->index_iter);
 		free(it);
 	}
 }
 
+static void
+reader_iter_drop_values(struct reader_iter *it)
+{
+	mtbl_pin_release(&it->vals_pin);
+	if (it->vals_free)
+		free(it->vals);
+	it->vals = NULL;
+	it->len_vals = 0;
+	it->vals_loaded = false;
+	it->vals_free = false;
+}
+
+/*
+ * Translate the value of the current entry as stored in the data block into
+ * the value returned to the caller. In the split layout, this is where the
+ * value block is read, the first time one of its values is needed, so that
+ * key-only iterators never read it at all.
+ */
+static void
+reader_iter_value(struct reader_iter *it, const uint8_t **val, size_t *len_val)
+{
+	uint64_t off, len;
+
+	if (it->keys_only) {
+		*val = (const uint8_t *) "";
+		*len_val = 0;
+		return;
+	}
+	if (it->r->t.data_block_layout != DATA_BLOCK_LAYOUT_SPLIT)
+		return;
+
+	size_t len_off = mtbl_varint_decode64(*val, &off);
+	mtbl_varint_decode64(*val + len_off, &len);
+	if (!it->vals_loaded) {
+		uint64_t vals_offset = it->offset + 2 * sizeof(uint32_t) +
+			mtbl_fixed_decode32(&it->r->data[it->offset]);
+		it->vals = get_frame(it->r, vals_offset, &it->len_vals, &it->vals_free);
+		it->vals_loaded = true;
+	}
+	assert(off + len <= it->len_vals);
+	*val = it->vals + off;
+	*len_val = len;
+}
+
+/*
+ * Values point into the mapping of the file, the decompressed data block, or
+ * the value block of the split layout. The decompressed blocks are handed
+ * over to a pin the first time one of their values is pinned, so that they
+ * outlive the iterator's use of them.
+ */
+static struct mtbl_pin *
+reader_iter_pin(void *v)
+{
+	struct reader_iter *it = (struct reader_iter *) v;
+
+	if (it->keys_only)
+		return (mtbl_pin_retain(it->r->map_pin));
+
+	if (it->r->t.data_block_layout == DATA_BLOCK_LAYOUT_SPLIT) {
+		if (it->vals_pin == NULL && it->vals_free) {
+			it->vals_pin = pin_init(it->vals, it->len_vals, reader_free_contents);
+			it->vals_free = false;
+		}
+		if (it->vals_pin != NULL)
+			return (mtbl_pin_retain(it->vals_pin));
+		return (mtbl_pin_retain(it->r->map_pin));
+	}
+
+	if (it->block_pin == NULL) {
+		uint8_t *contents = block_detach(it->b);
+		if (contents == NULL)
+			return (mtbl_pin_retain(it->r->map_pin));
+		it->block_pin = pin_init(contents, 0, reader_free_contents);
+	}
+	return (mtbl_pin_retain(it->block_pin));
+}
+
+static bool
+reader_iter_in_bounds(struct reader_iter *it, const uint8_t *key, size_t len_key)
+{
+	switch (it->it_type) {
+	case READER_ITER_TYPE_ITER:
+		return (true);
+	case READER_ITER_TYPE_GET:
+		return (bytes_compare(key, len_key, ubuf_data(it->k), ubuf_size(it->k)) == 0);
+	case READER_ITER_TYPE_GET_PREFIX:
+		return (ubuf_size(it->k) <= len_key &&
+			memcmp(ubuf_data(it->k), key, ubuf_size(it->k)) == 0);
+	case READER_ITER_TYPE_GET_RANGE:
+		return (bytes_compare(key, len_key, ubuf_data(it->k), ubuf_size(it->k)) <= 0);
+	default:
+		assert(0);
+	}
+	return (false);
+}
+
 static mtbl_res
 reader_iter_next(void *v,
 	       const uint8_t **key, size_t *len_key,
@@ -371,11 +745,13 @@ reader_iter_next(void *v,
 
 	it->valid = block_iter_get(it->bi, key, len_key, val, len_val);
 	if (!it->valid) {
+		reader_iter_drop_values(it);
 		block_destroy(&it->b);
+		mtbl_pin_release(&it->block_pin);
 		block_iter_destroy(&it->bi);
 		if (!block_iter_next(it->index_iter))
 			return (mtbl_res_failure);
-		it->b = get_block_at_index(it->r, it->index_iter);
+		it->b = get_block_at_index(it->r, it->index_iter, &it->offset);
 		it->bi = block_iter_init(it->b);
 		block_iter_seek_to_first(it->bi);
 		it->valid = block_iter_get(it->bi, key, len_key, val, len_val);
@@ -383,29 +759,100 @@ reader_iter_next(void *v,
 			return (mtbl_res_failure);
 	}
 
-	switch (it->it_type) {
-	case READER_ITER_TYPE_ITER:
-		break;
-	case READER_ITER_TYPE_GET:
-		if (bytes_compare(*key, *len_key, ubuf_data(it->k), ubuf_size(it->k)) != 0)
-			it->valid = false;
-		break;
-	case READER_ITER_TYPE_GET_PREFIX:
-		if (!(ubuf_size(it->k) <= *len_key &&
-		      memcmp(ubuf_data(it->k), *key, ubuf_size(it->k)) == 0))
-		{
+	it->valid = reader_iter_in_bounds(it, *key, *len_key);
+	if (it->valid) {
+		reader_iter_value(it, val, len_val);
+		return (mtbl_res_success);
+	}
+	return (mtbl_res_failure);
+}
+
+/*
+ * Return the rest of the current block, or the next block if the current
+ * one has been consumed. Values point into the block, which is kept until
+ * the next call, but the keys are decoded into the same buffer one after
+ * another and so are copied into batch_keys.
+ */
+static size_t
+reader_iter_next_batch(void *v, struct mtbl_kv *kv, size_t max)
+{
+	struct reader_iter *it = (struct reader_iter *) v;
+	size_t n = 0;
+
+	ubuf_clip(it->batch_keys, 0);
+	if (reader_iter_next(it, &kv[0].key, &kv[0].len_key,
+			     &kv[0].val, &kv[0].len_val) != mtbl_res_success)
+	{
+		return (0);
+	}
+	ubuf_append(it->batch_keys, kv[0].key, kv[0].len_key);
+	n++;
+
+	while (n < max && block_iter_next(it->bi)) {
+		struct mtbl_kv *e = &kv[n];
+		block_iter_get(it->bi, &e->key, &e->len_key, &e->val, &e->len_val);
+		if (!reader_iter_in_bounds(it, e->key, e->len_key)) {
 			it->valid = false;
+			break;
 		}
-		break;
-	case READER_ITER_TYPE_GET_RANGE:
-		if (bytes_compare(*key, *len_key, ubuf_data(it->k), ubuf_size(it->k)) > 0)
-			it->valid = false;
-		break;
-	default:
-		assert(0);
+		reader_iter_value(it, &e->val, &e->len_val);
+		ubuf_append(it->batch_keys, e->key, e->len_key);
+		n++;
+	}
+
+	const uint8_t *p = ubuf_data(it->batch_keys);
+	for (size_t i = 0; i < n; i++) {
+		kv[i].key = p;
+		p += kv[i].len_key;
 	}
+	return (n);
+}
 
-	if (it->valid)
+/*
+ * Move forward to the first entry whose key is at least 'key', using the
+ * index to skip over the blocks in between without reading them. The
+ * current block is reused if the target is within it.
+ */
+static mtbl_res
+reader_iter_seek(void *v, const uint8_t *key, size_t len_key)
+{
+	struct reader_iter *it = (struct reader_iter *) v;
+	const uint8_t *k, *val;
+	size_t len_k, len_val;
+	uint64_t offset;
+
+	if (!it->valid)
 		return (mtbl_res_success);
-	return (mtbl_res_failure);
+
+	/*
+	 * If the entry under the block iterator, whether it is the next entry
+	 * or the one last returned, is already at or past the target, then so
+	 * is the next entry.
+	 */
+	if (block_iter_get(it->bi, &k, &len_k, &val, &len_val) &&
+	    bytes_compare(k, len_k, key, len_key) >= 0)
+	{
+		return (mtbl_res_success);
+	}
+
+	PROBE3(index__seek__start, it->r, key, len_key);
+	block_iter_seek(it->index_iter, key, len_key);
+	PROBE1(index__seek__done, it->r);
+	reader_stat_add(it->r, count_index_seeks, 1);
+	if (!get_offset_at_index(it->index_iter, &offset)) {
+		it->valid = false;
+		return (mtbl_res_success);
+	}
+	if (offset != it->offset) {
+		reader_iter_drop_values(it);
+		block_iter_destroy(&it->bi);
+		block_destroy(&it->b);
+		mtbl_pin_release(&it->block_pin);
+		it->b = get_block(it->r, offset);
+		it->bi = block_iter_init(it->b);
+		it->offset = offset;
+	}
+	block_iter_seek(it->bi, key, len_key);
+	it->first = true;
+	return (mtbl_res_success);
 }
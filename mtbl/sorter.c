@@ -18,11 +18,18 @@
 #include "vector_types.h"
 
 VECTOR_GENERATE(reader_vec, struct mtbl_reader *);
+VECTOR_GENERATE(source_vec, struct mtbl_source *);
 
 struct sorter_iter {
 	reader_vec			*readers;
+	source_vec			*mem_sources;
+	source_vec			*ra_sources;
+	struct readahead		*ra;
 	struct mtbl_merger		*m;
 	struct mtbl_iter		*m_iter;
+	struct mtbl_iter		**part_iters;
+	size_t				n_parts;
+	size_t				i_part;
 };
 
 struct entry {
@@ -36,43 +43,179 @@ struct entry {
 
 VECTOR_GENERATE(entry_vec, struct entry *);
 
+/*
+ * Iterator over a sorted array of entries with unique keys, used to read the
+ * final in-memory buffer without writing it to disk.
+ */
+struct mem_iter {
+	struct entry			**array;
+	size_t				i;
+	size_t				n;
+	ubuf				*prefix;
+};
+
+/*
+ * Open-addressed hash table mapping keys to positions in the sorter's
+ * entry_vec, used when pre-aggregation is enabled. Each slot stores a 32-bit
+ * hash of the key (to avoid touching the entry on most mismatches) and the
+ * index of the entry in the vector, plus one. An index of zero marks an empty
+ * slot.
+ */
+struct entry_slot {
+	uint32_t			hash;
+	uint32_t			idx;
+};
+
+struct entry_table {
+	struct entry_slot		*slots;
+	size_t				n_slots;
+	size_t				n_used;
+};
+
 struct chunk {
 	int				fd;
+	unsigned			level;
+	off_t				size;
 };
 
 VECTOR_GENERATE(chunk_vec, struct chunk *);
 
+/*
+ * A run is a chunk which is still open for writing. Spilled entries which sort
+ * after the last key written to an open run are appended to it, so sorted or
+ * nearly sorted input produces a few long runs instead of one chunk per
+ * spill.
+ */
+struct run {
+	struct chunk			*c;
+	struct mtbl_writer		*w;
+	ubuf				*last_key;
+};
+
+VECTOR_GENERATE(run_vec, struct run *);
+
+VECTOR_GENERATE(val_vec, const uint8_t *);
+
+VECTOR_GENERATE(len_vec, size_t);
+
+/*
+ * An input buffer and the runs it has spilled into. A sorter normally has a
+ * single buffer, but in thread-safe mode each thread calling mtbl_sorter_add()
+ * is given its own, so producers only contend when a run is turned into a
+ * chunk. Duplicates are merged into 'merge_val' as entries are added, and
+ * with the 'collapse_' buffers when the buffer is sorted, which may happen on
+ * the background spill thread.
+ */
+struct sorter_buf {
+	entry_vec			*vec;
+	struct entry_table		table;
+	size_t				entry_bytes;
+	bool				vec_sorted;
+	run_vec				*runs;
+	ubuf				*merge_val;
+	ubuf				*collapse_val;
+	val_vec				*collapse_vals;
+	len_vec				*collapse_len_vals;
+	uint64_t			count_entries;
+	uint64_t			count_merges;
+};
+
+VECTOR_GENERATE(buf_vec, struct sorter_buf *);
+
 struct mtbl_sorter_options {
 	size_t				max_memory;
-	char				*tmp_dname;
+	size_t				max_fan_in;
+	bool				preaggregate;
+	size_t				sort_threads;
+	bool				background_spill;
+	bool				thread_safe;
+	size_t				partitions;
+	size_t				readahead_threads;
+	char				**tmp_dnames;
+	size_t				n_tmp_dnames;
+	mtbl_sorter_temp_placement	temp_placement;
 	mtbl_merge_func			merge;
+	mtbl_merge_buf_func		merge_buf;
+	mtbl_merge_multi_func		merge_multi;
 	void				*merge_clos;
 };
 
+/*
+ * A range partition of a partitioned sorter. Each partition is a complete
+ * sorter of its own, with its own background spill thread.
+ */
+struct partition {
+	struct mtbl_sorter		*s;
+	struct mtbl_writer		*w;
+	struct mtbl_iter		*it;
+	mtbl_res			res;
+	pthread_t			thr;
+};
+
 struct mtbl_sorter {
+	struct partition		*parts;
+	ubuf				**bounds;
 	chunk_vec			*chunks;
-	entry_vec			*vec;
-	size_t				entry_bytes;
+	struct sorter_buf		*buf;
+	buf_vec				*bufs;
+	size_t				n_bufs;
+	pthread_key_t			buf_key;
+	pthread_mutex_t			lock;
+	size_t				max_vec_memory;
+	size_t				next_tmp_dname;
 	bool				iterating;
 
+	pthread_t			spill_thr;
+	pthread_mutex_t			spill_lock;
+	pthread_cond_t			spill_cond;
+	entry_vec			*spill_vec;
+	bool				spill_vec_sorted;
+	bool				spill_thr_started;
+	bool				spill_shutdown;
+	mtbl_res			spill_res;
+
+	struct mtbl_sorter_stats	stats;
+
 	struct mtbl_sorter_options	opt;
 };
 
+/*
+ * Statistics may be updated by the background spill thread while being read
+ * by mtbl_sorter_stats().
+ */
+#define sorter_stat_add(s, field, n) \
+	__atomic_add_fetch(&(s)->stats.field, (n), __ATOMIC_RELAXED)
+#define sorter_stat_sub(s, field, n) \
+	__atomic_sub_fetch(&(s)->stats.field, (n), __ATOMIC_RELAXED)
+
+static void _mtbl_sorter_chunk_destroy(struct chunk **);
+static void _mtbl_sorter_run_destroy(struct run **);
+
 struct mtbl_sorter_options *
 mtbl_sorter_options_init(void)
 {
 	struct mtbl_sorter_options *opt;
 	opt = my_calloc(1, sizeof(*opt));
 	opt->max_memory = DEFAULT_SORTER_MEMORY;
-	mtbl_sorter_options_set_temp_dir(opt, DEFAULT_SORTER_TEMP_DIR);
+	opt->sort_threads = DEFAULT_SORTER_SORT_THREADS;
 	return (opt);
 }
 
+static void
+_mtbl_sorter_options_clear_temp_dirs(struct mtbl_sorter_options *opt)
+{
+	for (size_t i = 0; i < opt->n_tmp_dnames; i++)
+		free(opt->tmp_dnames[i]);
+	free(opt->tmp_dnames);
+	opt->tmp_dnames = NULL;
+	opt->n_tmp_dnames = 0;
+}
+
 void
 mtbl_sorter_options_destroy(struct mtbl_sorter_options **opt)
 {
 	if (*opt) {
-		free((*opt)->tmp_dname);
+		_mtbl_sorter_options_clear_temp_dirs(*opt);
 		free(*opt);
 		*opt = NULL;
 	}
@@ -83,6 +226,28 @@ mtbl_sorter_options_set_merge_func(struct mtbl_sorter_options *opt,
 				   mtbl_merge_func merge, void *clos)
 {
 	opt->merge = merge;
+	opt->merge_buf = NULL;
+	opt->merge_multi = NULL;
+	opt->merge_clos = clos;
+}
+
+void
+mtbl_sorter_options_set_merge_buf_func(struct mtbl_sorter_options *opt,
+				       mtbl_merge_buf_func merge_buf, void *clos)
+{
+	opt->merge = NULL;
+	opt->merge_buf = merge_buf;
+	opt->merge_multi = NULL;
+	opt->merge_clos = clos;
+}
+
+void
+mtbl_sorter_options_set_merge_multi_func(struct mtbl_sorter_options *opt,
+					 mtbl_merge_multi_func merge_multi, void *clos)
+{
+	opt->merge = NULL;
+	opt->merge_buf = NULL;
+	opt->merge_multi = merge_multi;
 	opt->merge_clos = clos;
 }
 
@@ -90,8 +255,24 @@ void
 mtbl_sorter_options_set_temp_dir(struct mtbl_sorter_options *opt,
 				 const char *temp_dir)
 {
-	free(opt->tmp_dname);
-	opt->tmp_dname = strdup(temp_dir);
+	_mtbl_sorter_options_clear_temp_dirs(opt);
+	mtbl_sorter_options_add_temp_dir(opt, temp_dir);
+}
+
+void
+mtbl_sorter_options_add_temp_dir(struct mtbl_sorter_options *opt,
+				 const char *temp_dir)
+{
+	opt->tmp_dnames = my_realloc(opt->tmp_dnames,
+				     (opt->n_tmp_dnames + 1) * sizeof(char *));
+	opt->tmp_dnames[opt->n_tmp_dnames++] = strdup(temp_dir);
+}
+
+void
+mtbl_sorter_options_set_temp_placement(struct mtbl_sorter_options *opt,
+				       mtbl_sorter_temp_placement temp_placement)
+{
+	opt->temp_placement = temp_placement;
 }
 
 void
@@ -103,18 +284,164 @@ mtbl_sorter_options_set_max_memory(struct mtbl_sorter_options *opt,
 	opt->max_memory = max_memory;
 }
 
+void
+mtbl_sorter_options_set_max_fan_in(struct mtbl_sorter_options *opt,
+				   size_t max_fan_in)
+{
+	if (max_fan_in != 0 && max_fan_in < MIN_SORTER_FAN_IN)
+		max_fan_in = MIN_SORTER_FAN_IN;
+	if (max_fan_in > MAX_SORTER_FAN_IN)
+		max_fan_in = MAX_SORTER_FAN_IN;
+	opt->max_fan_in = max_fan_in;
+}
+
+void
+mtbl_sorter_options_set_preaggregate(struct mtbl_sorter_options *opt,
+				     bool preaggregate)
+{
+	opt->preaggregate = preaggregate;
+}
+
+void
+mtbl_sorter_options_set_sort_threads(struct mtbl_sorter_options *opt,
+				     size_t sort_threads)
+{
+	if (sort_threads < 1)
+		sort_threads = 1;
+	if (sort_threads > MAX_SORTER_SORT_THREADS)
+		sort_threads = MAX_SORTER_SORT_THREADS;
+	opt->sort_threads = sort_threads;
+}
+
+void
+mtbl_sorter_options_set_background_spill(struct mtbl_sorter_options *opt,
+					 bool background_spill)
+{
+	opt->background_spill = background_spill;
+}
+
+void
+mtbl_sorter_options_set_thread_safe(struct mtbl_sorter_options *opt,
+				    bool thread_safe)
+{
+	opt->thread_safe = thread_safe;
+}
+
+static struct sorter_buf *
+_mtbl_sorter_buf_init(void)
+{
+	struct sorter_buf *b = my_calloc(1, sizeof(*b));
+	b->vec = entry_vec_init(INITIAL_SORTER_VEC_SIZE);
+	b->vec_sorted = true;
+	b->runs = run_vec_init(MAX_SORTER_OPEN_RUNS + 1);
+	b->merge_val = ubuf_init(64);
+	b->collapse_val = ubuf_init(64);
+	b->collapse_vals = val_vec_init(16);
+	b->collapse_len_vals = len_vec_init(16);
+	return (b);
+}
+
+static void
+_mtbl_sorter_vec_destroy(entry_vec **vec)
+{
+	if (*vec) {
+		for (unsigned i = 0; i < entry_vec_size(*vec); i++) {
+			struct entry *ent = entry_vec_value(*vec, i);
+			free(ent);
+		}
+		entry_vec_destroy(vec);
+	}
+}
+
+static void
+_mtbl_sorter_buf_destroy(struct sorter_buf **b)
+{
+	if (*b) {
+		_mtbl_sorter_vec_destroy(&((*b)->vec));
+		free((*b)->table.slots);
+		for (unsigned i = 0; i < run_vec_size((*b)->runs); i++) {
+			struct run *r = run_vec_value((*b)->runs, i);
+			_mtbl_sorter_run_destroy(&r);
+		}
+		run_vec_destroy(&((*b)->runs));
+		ubuf_destroy(&((*b)->merge_val));
+		ubuf_destroy(&((*b)->collapse_val));
+		val_vec_destroy(&((*b)->collapse_vals));
+		len_vec_destroy(&((*b)->collapse_len_vals));
+		free(*b);
+		*b = NULL;
+	}
+}
+
+void
+mtbl_sorter_options_set_partitions(struct mtbl_sorter_options *opt,
+				   size_t partitions)
+{
+	if (partitions > MAX_SORTER_PARTITIONS)
+		partitions = MAX_SORTER_PARTITIONS;
+	opt->partitions = partitions;
+}
+
+void
+mtbl_sorter_options_set_readahead_threads(struct mtbl_sorter_options *opt,
+					  size_t readahead_threads)
+{
+	if (readahead_threads > MAX_SORTER_READAHEAD_THREADS)
+		readahead_threads = MAX_SORTER_READAHEAD_THREADS;
+	opt->readahead_threads = readahead_threads;
+}
+
 struct mtbl_sorter *
 mtbl_sorter_init(struct mtbl_sorter_options *opt)
 {
 	struct mtbl_sorter *s;
 
+	/*
+	 * Entries are routed to the partitions through an unlocked buffer, so
+	 * a partitioned sorter cannot accept them from several threads.
+	 */
+	if (opt != NULL && opt->partitions > 1 && opt->thread_safe)
+		return (NULL);
+
 	s = my_calloc(1, sizeof(*s));
-	if (opt != NULL) {
+	if (opt != NULL)
 		memcpy(&s->opt, opt, sizeof(*opt));
-		s->opt.tmp_dname = strdup(opt->tmp_dname);
+	s->opt.tmp_dnames = NULL;
+	s->opt.n_tmp_dnames = 0;
+	if (opt != NULL && opt->n_tmp_dnames > 0) {
+		for (size_t i = 0; i < opt->n_tmp_dnames; i++)
+			mtbl_sorter_options_add_temp_dir(&s->opt, opt->tmp_dnames[i]);
+	} else {
+		mtbl_sorter_options_add_temp_dir(&s->opt, DEFAULT_SORTER_TEMP_DIR);
 	}
-	s->vec = entry_vec_init(INITIAL_SORTER_VEC_SIZE);
 	s->chunks = chunk_vec_init(1);
+	s->bufs = buf_vec_init(1);
+	pthread_mutex_init(&s->lock, NULL);
+
+	/*
+	 * In thread-safe mode, buffers are created as threads first add
+	 * entries, and each producer spills its own buffer.
+	 */
+	if (s->opt.thread_safe) {
+		int ret = pthread_key_create(&s->buf_key, NULL);
+		assert(ret == 0);
+		s->opt.background_spill = false;
+	} else {
+		s->buf = _mtbl_sorter_buf_init();
+		buf_vec_add(s->bufs, s->buf);
+		s->n_bufs = 1;
+	}
+
+	/*
+	 * With background spilling, one buffer is being written to disk while
+	 * another is being filled, so each gets half of the memory budget.
+	 */
+	s->max_vec_memory = s->opt.max_memory;
+	if (s->opt.background_spill)
+		s->max_vec_memory /= 2;
+	pthread_mutex_init(&s->spill_lock, NULL);
+	pthread_cond_init(&s->spill_cond, NULL);
+	s->spill_res = mtbl_res_success;
 
 	return (s);
 }
@@ -123,18 +450,37 @@ void
 mtbl_sorter_destroy(struct mtbl_sorter **s)
 {
 	if (*s) {
-		for (unsigned i = 0; i < entry_vec_size((*s)->vec); i++) {
-			struct entry *ent = entry_vec_value((*s)->vec, i);
-			free(ent);
+		if ((*s)->spill_thr_started) {
+			pthread_mutex_lock(&(*s)->spill_lock);
+			(*s)->spill_shutdown = true;
+			pthread_cond_broadcast(&(*s)->spill_cond);
+			pthread_mutex_unlock(&(*s)->spill_lock);
+			pthread_join((*s)->spill_thr, NULL);
 		}
-		entry_vec_destroy(&((*s)->vec));
+		pthread_mutex_destroy(&(*s)->spill_lock);
+		pthread_cond_destroy(&(*s)->spill_cond);
+		if ((*s)->opt.thread_safe)
+			pthread_key_delete((*s)->buf_key);
+		pthread_mutex_destroy(&(*s)->lock);
+		for (unsigned i = 0; i < buf_vec_size((*s)->bufs); i++) {
+			struct sorter_buf *b = buf_vec_value((*s)->bufs, i);
+			_mtbl_sorter_buf_destroy(&b);
+		}
+		buf_vec_destroy(&((*s)->bufs));
 		for (unsigned i = 0; i < chunk_vec_size((*s)->chunks); i++) {
 			struct chunk *c = chunk_vec_value((*s)->chunks, i);
-			close(c->fd);
-			free(c);
+			_mtbl_sorter_chunk_destroy(&c);
 		}
 		chunk_vec_destroy(&((*s)->chunks));
-		free((*s)->opt.tmp_dname);
+		if ((*s)->parts != NULL) {
+			for (size_t i = 0; i < (*s)->opt.partitions; i++)
+				mtbl_sorter_destroy(&(*s)->parts[i].s);
+			for (size_t i = 0; i + 1 < (*s)->opt.partitions; i++)
+				ubuf_destroy(&(*s)->bounds[i]);
+			free((*s)->parts);
+			free((*s)->bounds);
+		}
+		_mtbl_sorter_options_clear_temp_dirs(&(*s)->opt);
 		free(*s);
 		*s = NULL;
 	}
@@ -150,17 +496,231 @@ _mtbl_sorter_compare(const void *va, const void *vb)
 			      entry_key(b), b->len_key));
 }
 
+static inline uint32_t
+_mtbl_sorter_hash(const uint8_t *key, size_t len_key)
+{
+	/* 32-bit FNV-1a */
+	uint32_t h = 2166136261U;
+	for (size_t i = 0; i < len_key; i++) {
+		h ^= key[i];
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+static void
+_mtbl_sorter_table_reset(struct sorter_buf *b)
+{
+	if (b->table.slots != NULL)
+		memset(b->table.slots, 0, b->table.n_slots * sizeof(struct entry_slot));
+	b->table.n_used = 0;
+}
+
+static size_t
+_mtbl_sorter_table_bytes(struct sorter_buf *b)
+{
+	return (b->table.n_slots * sizeof(struct entry_slot));
+}
+
+static void
+_mtbl_sorter_table_grow(struct sorter_buf *b)
+{
+	struct entry_slot *old_slots = b->table.slots;
+	size_t old_n_slots = b->table.n_slots;
+
+	b->table.n_slots = old_n_slots ? 2 * old_n_slots : INITIAL_SORTER_VEC_SIZE;
+	b->table.slots = my_calloc(b->table.n_slots, sizeof(struct entry_slot));
+
+	const size_t mask = b->table.n_slots - 1;
+	for (size_t i = 0; i < old_n_slots; i++) {
+		struct entry_slot *old = &old_slots[i];
+		if (old->idx == 0)
+			continue;
+		size_t pos = old->hash & mask;
+		while (b->table.slots[pos].idx != 0)
+			pos = (pos + 1) & mask;
+		b->table.slots[pos] = *old;
+	}
+	free(old_slots);
+}
+
+/*
+ * Find the slot for 'key'. Returns a pointer to either the slot holding the
+ * existing entry, or the empty slot where it should be inserted.
+ */
+static struct entry_slot *
+_mtbl_sorter_table_find(struct sorter_buf *b,
+			const uint8_t *key, size_t len_key, uint32_t hash)
+{
+	const size_t mask = b->table.n_slots - 1;
+	size_t pos = hash & mask;
+	for (;;) {
+		struct entry_slot *slot = &b->table.slots[pos];
+		if (slot->idx == 0)
+			return (slot);
+		if (slot->hash == hash) {
+			struct entry *ent = entry_vec_value(b->vec, slot->idx - 1);
+			if (bytes_compare(entry_key(ent), ent->len_key, key, len_key) == 0)
+				return (slot);
+		}
+		pos = (pos + 1) & mask;
+	}
+}
+
+/*
+ * Replace the value of the entry '*ent'. The new value overwrites the old one
+ * in place unless its length differs.
+ */
+static void
+_mtbl_sorter_set_val(struct entry **ent, const uint8_t *val, size_t len_val)
+{
+	assert(len_val <= UINT_MAX);
+	if (len_val != (*ent)->len_val) {
+		*ent = my_realloc(*ent, sizeof(**ent) + (*ent)->len_key + len_val);
+		(*ent)->len_val = len_val;
+	}
+	memcpy(entry_val(*ent), val, len_val);
+}
+
+/*
+ * Merge 'val' into the entry '*ent', replacing it. A buffer or n-ary merge
+ * function writes into 'merge_val', which is owned by the caller and reused
+ * across merges. Returns mtbl_res_failure if the merge function fails.
+ */
 static mtbl_res
-_mtbl_sorter_write_chunk(struct mtbl_sorter *s)
+_mtbl_sorter_merge_entry(struct mtbl_sorter *s, ubuf *merge_val,
+			 struct entry **ent, const uint8_t *val, size_t len_val)
+{
+	mtbl_res res;
+
+	if (s->opt.merge_buf != NULL || s->opt.merge_multi != NULL) {
+		ubuf_clip(merge_val, 0);
+		if (s->opt.merge_multi != NULL) {
+			const uint8_t *vals[2] = { entry_val(*ent), val };
+			const size_t len_vals[2] = { (*ent)->len_val, len_val };
+			res = s->opt.merge_multi(s->opt.merge_clos,
+						 entry_key(*ent), (*ent)->len_key,
+						 2, vals, len_vals,
+						 (struct mtbl_buf *) merge_val);
+		} else {
+			res = s->opt.merge_buf(s->opt.merge_clos,
+					       entry_key(*ent), (*ent)->len_key,
+					       entry_val(*ent), (*ent)->len_val,
+					       val, len_val,
+					       (struct mtbl_buf *) merge_val);
+		}
+		if (res != mtbl_res_success)
+			return (res);
+		_mtbl_sorter_set_val(ent, ubuf_data(merge_val), ubuf_size(merge_val));
+		return (mtbl_res_success);
+	}
+
+	uint8_t *merged = NULL;
+	size_t len_merged = 0;
+	assert(s->opt.merge != NULL);
+	s->opt.merge(s->opt.merge_clos,
+		     entry_key(*ent), (*ent)->len_key,
+		     entry_val(*ent), (*ent)->len_val,
+		     val, len_val,
+		     &merged, &len_merged);
+	if (merged == NULL)
+		return (mtbl_res_failure);
+	_mtbl_sorter_set_val(ent, merged, len_merged);
+	free(merged);
+	return (mtbl_res_success);
+}
+
+/*
+ * Merge the 'n' entries in 'array', which all have the same key, into the
+ * first one, with a single call to the n-ary merge function. The values are
+ * gathered into the collapse vectors of buffer 'b', which are reused from one
+ * group of duplicates to the next.
+ */
+static mtbl_res
+_mtbl_sorter_merge_multi(struct mtbl_sorter *s, struct sorter_buf *b,
+			 struct entry **array, size_t n)
+{
+	val_vec_clip(b->collapse_vals, 0);
+	len_vec_clip(b->collapse_len_vals, 0);
+	for (size_t i = 0; i < n; i++) {
+		val_vec_add(b->collapse_vals, entry_val(array[i]));
+		len_vec_add(b->collapse_len_vals, array[i]->len_val);
+	}
+
+	ubuf_clip(b->collapse_val, 0);
+	mtbl_res res = s->opt.merge_multi(s->opt.merge_clos,
+					  entry_key(array[0]), array[0]->len_key,
+					  n, val_vec_data(b->collapse_vals),
+					  len_vec_data(b->collapse_len_vals),
+					  (struct mtbl_buf *) b->collapse_val);
+	if (res == mtbl_res_success) {
+		_mtbl_sorter_set_val(&array[0], ubuf_data(b->collapse_val),
+				     ubuf_size(b->collapse_val));
+	}
+	return (res);
+}
+
+static struct mtbl_merger *
+_mtbl_sorter_merger_init(struct mtbl_sorter *s)
+{
+	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+	if (s->opt.merge_multi != NULL)
+		mtbl_merger_options_set_merge_multi_func(mopt, s->opt.merge_multi, s->opt.merge_clos);
+	else if (s->opt.merge_buf != NULL)
+		mtbl_merger_options_set_merge_buf_func(mopt, s->opt.merge_buf, s->opt.merge_clos);
+	else
+		mtbl_merger_options_set_merge_func(mopt, s->opt.merge, s->opt.merge_clos);
+	struct mtbl_merger *m = mtbl_merger_init(mopt);
+	mtbl_merger_options_destroy(&mopt);
+	return (m);
+}
+
+/*
+ * Choose the temporary directory for the next chunk. Chunks are either spread
+ * across the directories in turn, so that spills and the final merge use all
+ * of the underlying devices, or placed in the directory with the most free
+ * space.
+ */
+static const char *
+_mtbl_sorter_temp_dir(struct mtbl_sorter *s)
+{
+	size_t n = s->opt.n_tmp_dnames;
+	size_t next = __atomic_fetch_add(&s->next_tmp_dname, 1, __ATOMIC_RELAXED);
+
+	if (n == 1)
+		return (s->opt.tmp_dnames[0]);
+	if (s->opt.temp_placement == MTBL_SORTER_TEMP_FREE_SPACE) {
+		const char *best = NULL;
+		uint64_t best_avail = 0;
+		for (size_t i = 0; i < n; i++) {
+			/* start at a different directory each time to break ties */
+			const char *dname = s->opt.tmp_dnames[(next + i) % n];
+			struct statvfs sv;
+			if (statvfs(dname, &sv) != 0)
+				continue;
+			uint64_t avail = (uint64_t) sv.f_bavail * sv.f_frsize;
+			if (best == NULL || avail > best_avail) {
+				best = dname;
+				best_avail = avail;
+			}
+		}
+		if (best != NULL)
+			return (best);
+	}
+	return (s->opt.tmp_dnames[next % n]);
+}
+
+static struct chunk *
+_mtbl_sorter_chunk_init(struct mtbl_sorter *s, unsigned level)
 {
-	mtbl_res res = mtbl_res_success;
-	assert(!s->iterating);
 	struct chunk *c = my_calloc(1, sizeof(*c));
+	c->level = level;
 
+	const char *tmp_dname = _mtbl_sorter_temp_dir(s);
 	char template[64];
 	sprintf(template, "/.mtbl.%ld.XXXXXX", (long)getpid());
-	ubuf *tmp_fname = ubuf_init(strlen(s->opt.tmp_dname) + strlen(template) + 1);
-	ubuf_append(tmp_fname, (uint8_t *) s->opt.tmp_dname, strlen(s->opt.tmp_dname));
+	ubuf *tmp_fname = ubuf_init(strlen(tmp_dname) + strlen(template) + 1);
+	ubuf_append(tmp_fname, (uint8_t *) tmp_dname, strlen(tmp_dname));
 	ubuf_append(tmp_fname, (uint8_t *) template, strlen(template));
 	ubuf_append(tmp_fname, (const uint8_t *) "\x00", 1);
 
@@ -170,164 +730,1208 @@ _mtbl_sorter_write_chunk(struct mtbl_sorter *s)
 	assert(unlink_ret == 0);
 	ubuf_destroy(&tmp_fname);
 
+	return (c);
+}
+
+static struct mtbl_writer *
+_mtbl_sorter_chunk_writer(struct chunk *c)
+{
 	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
 	mtbl_writer_options_set_compression(wopt, MTBL_COMPRESSION_SNAPPY);
 	struct mtbl_writer *w = mtbl_writer_init_fd(c->fd, wopt);
 	mtbl_writer_options_destroy(&wopt);
-
-	size_t entries_written = 0;
-	struct entry **array = entry_vec_data(s->vec);
-	qsort(array, entry_vec_size(s->vec), sizeof(void *), _mtbl_sorter_compare);
-	for (unsigned i = 0; i < entry_vec_size(s->vec); i++) {
-		struct entry *ent = entry_vec_value(s->vec, i);
-
-		if (i + 1 < entry_vec_size(s->vec)) {
-			struct entry *next_ent = entry_vec_value(s->vec, i + 1);
-			struct entry *merge_ent = NULL;
-
-			if (_mtbl_sorter_compare(&ent, &next_ent) == 0) {
-				assert(s->opt.merge != NULL);
-				uint8_t *merge_val = NULL;
-				size_t len_merge_val = 0;
-				s->opt.merge(s->opt.merge_clos,
-					     entry_key(ent), ent->len_key,
-					     entry_val(ent), ent->len_val,
-					     entry_val(next_ent), next_ent->len_val,
-					     &merge_val, &len_merge_val);
-				if (merge_val == NULL) {
-					mtbl_writer_destroy(&w);
-					return (mtbl_res_failure);
-				}
-				size_t len = sizeof(struct entry) + ent->len_key + len_merge_val;
-				merge_ent = my_malloc(len);
-				merge_ent->len_key = ent->len_key;
-				merge_ent->len_val = len_merge_val;
-				memcpy(entry_key(merge_ent), entry_key(ent), ent->len_key);
-				memcpy(entry_val(merge_ent), merge_val, len_merge_val);
-				free(merge_val);
-				free(ent);
-				free(next_ent);
-				entry_vec_data(s->vec)[i + 1] = merge_ent;
-				continue;
-			}
-		}
-		res = mtbl_writer_add(w,
-				      entry_key(ent), ent->len_key,
-				      entry_val(ent), ent->len_val);
-		free(ent);
-		entries_written += 1;
-		if (res != mtbl_res_success)
-			break;
-	}
-	mtbl_writer_destroy(&w);
-	entry_vec_destroy(&s->vec);
-	s->vec = entry_vec_init(INITIAL_SORTER_VEC_SIZE);
-	s->entry_bytes = 0;
-	chunk_vec_add(s->chunks, c);
-	return (res);
+	return (w);
 }
 
-mtbl_res
-mtbl_sorter_write(struct mtbl_sorter *s, struct mtbl_writer *w)
+static void
+_mtbl_sorter_chunk_finish(struct chunk *c)
 {
-	if (s->iterating)
-		return (mtbl_res_failure);
-	struct mtbl_iter *it = mtbl_sorter_iter(s);
-	const uint8_t *key, *val;
-	size_t len_key, len_val;
-	mtbl_res res = mtbl_res_success;
+	struct stat ss;
+	int ret = fstat(c->fd, &ss);
+	assert(ret == 0);
+	c->size = ss.st_size;
+}
 
-	if (it == NULL)
-		return (mtbl_res_failure);
-	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
-		res = mtbl_writer_add(w, key, len_key, val, len_val);
-		if (res != mtbl_res_success)
-			break;
+static void
+_mtbl_sorter_chunk_destroy(struct chunk **c)
+{
+	if (*c) {
+		close((*c)->fd);
+		free(*c);
+		*c = NULL;
 	}
-	mtbl_iter_destroy(&it);
-	return (res);
 }
 
-mtbl_res
-mtbl_sorter_add(struct mtbl_sorter *s,
-		const uint8_t *key, size_t len_key,
-		const uint8_t *val, size_t len_val)
+static mtbl_res
+_mtbl_sorter_merge_chunks(struct mtbl_sorter *s, struct chunk **cs, size_t n_cs,
+			  struct chunk *out)
 {
-	mtbl_res res = mtbl_res_success;
-	if (s->iterating)
-		return (mtbl_res_failure);
-	assert(len_key <= UINT_MAX);
-	assert(len_val <= UINT_MAX);
+	struct mtbl_merger *m = _mtbl_sorter_merger_init(s);
 
-	struct entry *ent;
-	size_t entry_bytes;
+	struct mtbl_reader *readers[n_cs];
+	for (size_t i = 0; i < n_cs; i++) {
+		readers[i] = mtbl_reader_init_fd(cs[i]->fd, NULL);
+		assert(readers[i] != NULL);
+		reader_advise_sequential(readers[i]);
+		mtbl_merger_add_source(m, mtbl_reader_source(readers[i]));
+	}
+
+	struct mtbl_writer *w = _mtbl_sorter_chunk_writer(out);
+	mtbl_res res = mtbl_source_write(mtbl_merger_source(m), w);
+	mtbl_writer_destroy(&w);
+	_mtbl_sorter_chunk_finish(out);
 
-	entry_bytes = sizeof(*ent) + len_key + len_val;
-	ent = my_malloc(entry_bytes);
-	ent->len_key = len_key;
-	ent->len_val = len_val;
-	memcpy(entry_key(ent), key, len_key);
-	memcpy(entry_val(ent), val, len_val);
-	entry_vec_append(s->vec, &ent, 1);
-	s->entry_bytes += entry_bytes;
-
-	if (s->entry_bytes + entry_vec_bytes(s->vec) >= s->opt.max_memory)
-		res = _mtbl_sorter_write_chunk(s);
+	mtbl_merger_destroy(&m);
+	for (size_t i = 0; i < n_cs; i++)
+		mtbl_reader_destroy(&readers[i]);
 	return (res);
 }
 
-static mtbl_res
-sorter_iter_next(void *v,
-		 const uint8_t **key, size_t *len_key,
-		 const uint8_t **val, size_t *len_val)
+static int
+_mtbl_sorter_chunk_compare_size(const void *va, const void *vb)
 {
-	struct sorter_iter *it = (struct sorter_iter *) v;
-	return (mtbl_iter_next(it->m_iter, key, len_key, val, len_val));
+	const struct chunk *a = *((const struct chunk **) va);
+	const struct chunk *b = *((const struct chunk **) vb);
+
+	if (a->size < b->size)
+		return (-1);
+	if (a->size > b->size)
+		return (1);
+	return (0);
 }
 
+/*
+ * Remove the 'n_cs' chunks in 'cs' from s->chunks. Called with the sorter
+ * locked.
+ */
 static void
-sorter_iter_free(void *v)
+_mtbl_sorter_chunks_remove(struct mtbl_sorter *s, struct chunk **cs, size_t n_cs)
 {
-	struct sorter_iter *it = (struct sorter_iter *) v;
-	if (it) {
-		mtbl_iter_destroy(&it->m_iter);
-		mtbl_merger_destroy(&it->m);
-		for (size_t i = 0; i < reader_vec_size(it->readers); i++) {
-			struct mtbl_reader *r = reader_vec_value(it->readers, i);
-			mtbl_reader_destroy(&r);
+	size_t j = 0;
+	for (size_t i = 0; i < chunk_vec_size(s->chunks); i++) {
+		struct chunk *c = chunk_vec_value(s->chunks, i);
+		bool removed = false;
+		for (size_t k = 0; k < n_cs; k++) {
+			if (c == cs[k]) {
+				removed = true;
+				break;
+			}
 		}
-		reader_vec_destroy(&it->readers);
-		free(it);
+		if (!removed)
+			chunk_vec_data(s->chunks)[j++] = c;
 	}
+	chunk_vec_clip(s->chunks, j);
 }
 
-struct mtbl_iter *
-mtbl_sorter_iter(struct mtbl_sorter *s)
+/*
+ * Merge 'n_cs' chunks, which the caller has removed from s->chunks, into a
+ * single new chunk at level 'level'. The merge itself runs without the sorter
+ * locked, so that other producers may keep turning their runs into chunks in
+ * the meantime. If the merge fails, the chunks are put back unchanged.
+ */
+static mtbl_res
+_mtbl_sorter_merge_pass(struct mtbl_sorter *s, struct chunk **cs, size_t n_cs,
+			unsigned level)
+{
+	struct chunk *out = _mtbl_sorter_chunk_init(s, level);
+	mtbl_res res = _mtbl_sorter_merge_chunks(s, cs, n_cs, out);
+
+	pthread_mutex_lock(&s->lock);
+	if (res == mtbl_res_success) {
+		for (size_t i = 0; i < n_cs; i++)
+			_mtbl_sorter_chunk_destroy(&cs[i]);
+		chunk_vec_add(s->chunks, out);
+		sorter_stat_add(s, count_merge_passes, 1);
+		sorter_stat_add(s, bytes_merged, out->size);
+		sorter_stat_sub(s, count_chunks, n_cs - 1);
+	} else {
+		_mtbl_sorter_chunk_destroy(&out);
+		chunk_vec_append(s->chunks, cs, n_cs);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return (res);
+}
+
+/*
+ * Called after each spill. Chunks are organized into levels; once a level
+ * accumulates max_fan_in chunks, they are merged into a single chunk at the
+ * next level. This bounds the number of chunks at each level while writing
+ * each entry O(log_{max_fan_in}(n_chunks)) times. The chunks to merge are
+ * chosen with the sorter locked, and merged after it has been unlocked.
+ */
+static mtbl_res
+_mtbl_sorter_maybe_merge(struct mtbl_sorter *s)
+{
+	if (s->opt.max_fan_in == 0)
+		return (mtbl_res_success);
+
+	for (;;) {
+		struct chunk *cs[s->opt.max_fan_in];
+		unsigned level, max_level = 0;
+		size_t n_cs = 0;
+
+		pthread_mutex_lock(&s->lock);
+		for (size_t i = 0; i < chunk_vec_size(s->chunks); i++) {
+			struct chunk *c = chunk_vec_value(s->chunks, i);
+			if (c->level > max_level)
+				max_level = c->level;
+		}
+		for (level = 0; level <= max_level; level++) {
+			n_cs = 0;
+			for (size_t i = 0; i < chunk_vec_size(s->chunks); i++) {
+				struct chunk *c = chunk_vec_value(s->chunks, i);
+				if (c->level == level && n_cs < s->opt.max_fan_in)
+					cs[n_cs++] = c;
+			}
+			if (n_cs == s->opt.max_fan_in)
+				break;
+		}
+		if (n_cs == s->opt.max_fan_in)
+			_mtbl_sorter_chunks_remove(s, cs, n_cs);
+		pthread_mutex_unlock(&s->lock);
+
+		if (n_cs < s->opt.max_fan_in)
+			break;
+		mtbl_res res = _mtbl_sorter_merge_pass(s, cs, n_cs, level + 1);
+		if (res != mtbl_res_success)
+			return (res);
+	}
+	return (mtbl_res_success);
+}
+
+/*
+ * Called before the final merge. Chunks from different levels may still
+ * exceed max_fan_in in total, so repeatedly merge the smallest chunks until
+ * the final merge width, including 'n_other' in-memory sources, is within
+ * bounds.
+ */
+static mtbl_res
+_mtbl_sorter_reduce_fan_in(struct mtbl_sorter *s, size_t n_other)
+{
+	if (s->opt.max_fan_in == 0)
+		return (mtbl_res_success);
+	assert(n_other < s->opt.max_fan_in);
+	const size_t max_chunks = s->opt.max_fan_in - n_other;
+
+	while (chunk_vec_size(s->chunks) > max_chunks) {
+		size_t n_chunks = chunk_vec_size(s->chunks);
+		size_t n_cs = n_chunks - max_chunks + 1;
+		if (n_cs > s->opt.max_fan_in)
+			n_cs = s->opt.max_fan_in;
+
+		struct chunk *cs[n_chunks];
+		unsigned level = 0;
+		memcpy(cs, chunk_vec_data(s->chunks), sizeof(cs));
+		qsort(cs, n_chunks, sizeof(cs[0]), _mtbl_sorter_chunk_compare_size);
+		for (size_t i = 0; i < n_cs; i++) {
+			if (cs[i]->level + 1 > level)
+				level = cs[i]->level + 1;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		_mtbl_sorter_chunks_remove(s, cs, n_cs);
+		pthread_mutex_unlock(&s->lock);
+		mtbl_res res = _mtbl_sorter_merge_pass(s, cs, n_cs, level);
+		if (res != mtbl_res_success)
+			return (res);
+	}
+	return (mtbl_res_success);
+}
+
+static struct run *
+_mtbl_sorter_run_init(struct mtbl_sorter *s)
+{
+	struct run *r = my_calloc(1, sizeof(*r));
+	r->c = _mtbl_sorter_chunk_init(s, 0);
+	r->w = _mtbl_sorter_chunk_writer(r->c);
+	r->last_key = ubuf_init(256);
+	sorter_stat_add(s, count_runs, 1);
+	sorter_stat_add(s, count_runs_open, 1);
+	return (r);
+}
+
+static void
+_mtbl_sorter_run_destroy(struct run **r)
+{
+	if (*r) {
+		mtbl_writer_destroy(&(*r)->w);
+		_mtbl_sorter_chunk_destroy(&(*r)->c);
+		ubuf_destroy(&(*r)->last_key);
+		free(*r);
+		*r = NULL;
+	}
+}
+
+static int
+_mtbl_sorter_run_compare(const void *va, const void *vb)
+{
+	const struct run *a = *((const struct run **) va);
+	const struct run *b = *((const struct run **) vb);
+
+	/* descending order of last key */
+	return (bytes_compare(ubuf_data(b->last_key), ubuf_size(b->last_key),
+			      ubuf_data(a->last_key), ubuf_size(a->last_key)));
+}
+
+/*
+ * Finish writing the open run at position 'i' of buffer 'b' and turn it into
+ * a chunk. The list of chunks is shared by all of the buffers, so it is only
+ * modified with the sorter locked.
+ */
+static mtbl_res
+_mtbl_sorter_run_close(struct mtbl_sorter *s, struct sorter_buf *b, size_t i)
+{
+	struct run *r = run_vec_value(b->runs, i);
+
+	for (size_t j = i + 1; j < run_vec_size(b->runs); j++)
+		run_vec_data(b->runs)[j - 1] = run_vec_value(b->runs, j);
+	run_vec_clip(b->runs, run_vec_size(b->runs) - 1);
+
+	mtbl_writer_destroy(&r->w);
+	_mtbl_sorter_chunk_finish(r->c);
+	sorter_stat_add(s, bytes_spilled, r->c->size);
+	pthread_mutex_lock(&s->lock);
+	chunk_vec_add(s->chunks, r->c);
+	sorter_stat_sub(s, count_runs_open, 1);
+	sorter_stat_add(s, count_chunks, 1);
+	pthread_mutex_unlock(&s->lock);
+	r->c = NULL;
+	_mtbl_sorter_run_destroy(&r);
+
+	return (_mtbl_sorter_maybe_merge(s));
+}
+
+static mtbl_res
+_mtbl_sorter_run_close_all(struct mtbl_sorter *s, struct sorter_buf *b)
+{
+	while (run_vec_size(b->runs) > 0) {
+		mtbl_res res = _mtbl_sorter_run_close(s, b, 0);
+		if (res != mtbl_res_success)
+			return (res);
+	}
+	return (mtbl_res_success);
+}
+
+static mtbl_res
+_mtbl_sorter_run_append(struct run *r, struct entry **array, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		struct entry *ent = array[i];
+		mtbl_res res = mtbl_writer_add(r->w,
+					       entry_key(ent), ent->len_key,
+					       entry_val(ent), ent->len_val);
+		if (res != mtbl_res_success)
+			return (res);
+	}
+	ubuf_clip(r->last_key, 0);
+	ubuf_append(r->last_key, entry_key(array[n - 1]), array[n - 1]->len_key);
+	return (mtbl_res_success);
+}
+
+/*
+ * Return the index of the first entry in the sorted array whose key is greater
+ * than 'key'.
+ */
+static size_t
+_mtbl_sorter_upper_bound(struct entry **array, size_t n,
+			 const uint8_t *key, size_t len_key)
+{
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (bytes_compare(entry_key(array[mid]), array[mid]->len_key,
+				  key, len_key) <= 0)
+		{
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo);
+}
+
+/*
+ * Merge adjacent entries with duplicate keys in a sorted array of buffer 'b',
+ * compacting it in place. With an n-ary merge function, each group of
+ * duplicates is merged with a single call. On failure, all of the entries in
+ * the array are freed.
+ */
+static mtbl_res
+_mtbl_sorter_collapse(struct mtbl_sorter *s, struct sorter_buf *b,
+		      struct entry **array, size_t *n)
+{
+	mtbl_res res = mtbl_res_success;
+	size_t i = 0, j = 0;
+	while (i < *n) {
+		size_t k = i + 1;
+		while (k < *n && _mtbl_sorter_compare(&array[i], &array[k]) == 0)
+			k++;
+
+		if (k - i > 1 && s->opt.merge_multi != NULL) {
+			res = _mtbl_sorter_merge_multi(s, b, &array[i], k - i);
+			sorter_stat_add(s, count_merges, 1);
+		} else {
+			for (size_t l = i + 1; l < k && res == mtbl_res_success; l++) {
+				res = _mtbl_sorter_merge_entry(s, b->collapse_val, &array[i],
+					entry_val(array[l]), array[l]->len_val);
+				sorter_stat_add(s, count_merges, 1);
+			}
+		}
+		if (res != mtbl_res_success) {
+			for (size_t l = 0; l < j; l++)
+				free(array[l]);
+			for (size_t l = i; l < *n; l++)
+				free(array[l]);
+			j = 0;
+			break;
+		}
+
+		for (size_t l = i + 1; l < k; l++)
+			free(array[l]);
+		array[j++] = array[i];
+		i = k;
+	}
+	*n = j;
+	return (res);
+}
+
+/*
+ * Write a sorted array of entries with unique keys to the open runs. Each open
+ * run, in descending order of last key written, receives the suffix of the
+ * remaining entries which sort after its last key; whatever is left starts a
+ * new run. If too many runs are open, the run least likely to be extended
+ * (the one with the smallest last key) is closed.
+ */
+static mtbl_res
+_mtbl_sorter_distribute(struct mtbl_sorter *s, struct sorter_buf *b,
+			struct entry **array, size_t n)
+{
+	mtbl_res res = mtbl_res_success;
+	size_t hi = n;
+
+	qsort(run_vec_data(b->runs), run_vec_size(b->runs), sizeof(struct run *),
+	      _mtbl_sorter_run_compare);
+
+	for (size_t i = 0; i < run_vec_size(b->runs) && hi > 0; i++) {
+		struct run *r = run_vec_value(b->runs, i);
+		size_t lo = _mtbl_sorter_upper_bound(array, hi,
+			ubuf_data(r->last_key), ubuf_size(r->last_key));
+		if (lo < hi) {
+			res = _mtbl_sorter_run_append(r, &array[lo], hi - lo);
+			if (res != mtbl_res_success)
+				return (res);
+			hi = lo;
+		}
+	}
+
+	if (hi > 0) {
+		struct run *r = _mtbl_sorter_run_init(s);
+		run_vec_add(b->runs, r);
+		res = _mtbl_sorter_run_append(r, array, hi);
+		if (res != mtbl_res_success)
+			return (res);
+	}
+
+	while (run_vec_size(b->runs) > MAX_SORTER_OPEN_RUNS) {
+		size_t i_min = 0;
+		for (size_t i = 1; i < run_vec_size(b->runs); i++) {
+			if (_mtbl_sorter_run_compare(&run_vec_data(b->runs)[i],
+						     &run_vec_data(b->runs)[i_min]) > 0)
+			{
+				i_min = i;
+			}
+		}
+		res = _mtbl_sorter_run_close(s, b, i_min);
+		if (res != mtbl_res_success)
+			return (res);
+	}
+	return (res);
+}
+
+/*
+ * Sort the entries in 'vec' and write them to the runs of buffer 'b'. The
+ * entries are freed.
+ */
+static mtbl_res
+_mtbl_sorter_spill_vec(struct mtbl_sorter *s, struct sorter_buf *b,
+		       entry_vec *vec, bool sorted)
+{
+	mtbl_res res;
+
+	struct entry **array = entry_vec_data(vec);
+	size_t n = entry_vec_size(vec);
+	uint64_t t0 = stats_now_ns();
+	PROBE3(spill__start, s, b, n);
+	if (sorted)
+		sorter_stat_add(s, count_spills_presorted, 1);
+	else
+		psort((void **) array, n, s->opt.sort_threads, _mtbl_sorter_compare);
+
+	res = _mtbl_sorter_collapse(s, b, array, &n);
+	if (res == mtbl_res_success)
+		res = _mtbl_sorter_distribute(s, b, array, n);
+	for (size_t i = 0; i < n; i++)
+		free(array[i]);
+	entry_vec_clip(vec, 0);
+
+	sorter_stat_add(s, count_spills, 1);
+	sorter_stat_add(s, time_spills_ns, stats_now_ns() - t0);
+	PROBE4(spill__done, s, b, n, res);
+	return (res);
+}
+
+static void *
+_mtbl_sorter_spill_thr(void *arg)
+{
+	struct mtbl_sorter *s = (struct mtbl_sorter *) arg;
+
+	pthread_mutex_lock(&s->spill_lock);
+	for (;;) {
+		while (s->spill_vec == NULL && !s->spill_shutdown)
+			pthread_cond_wait(&s->spill_cond, &s->spill_lock);
+		if (s->spill_vec == NULL)
+			break;
+
+		entry_vec *vec = s->spill_vec;
+		bool sorted = s->spill_vec_sorted;
+		pthread_mutex_unlock(&s->spill_lock);
+
+		mtbl_res res = _mtbl_sorter_spill_vec(s, s->buf, vec, sorted);
+		entry_vec_destroy(&vec);
+
+		pthread_mutex_lock(&s->spill_lock);
+		s->spill_vec = NULL;
+		if (res != mtbl_res_success)
+			__atomic_store_n(&s->spill_res, res, __ATOMIC_RELAXED);
+		pthread_cond_broadcast(&s->spill_cond);
+	}
+	pthread_mutex_unlock(&s->spill_lock);
+	return (NULL);
+}
+
+/*
+ * Wait for the background spill thread, if any, to finish writing the buffer
+ * it was handed. Returns the first error encountered by the background thread.
+ */
+static mtbl_res
+_mtbl_sorter_spill_wait(struct mtbl_sorter *s)
+{
+	mtbl_res res = mtbl_res_success;
+	if (s->spill_thr_started) {
+		pthread_mutex_lock(&s->spill_lock);
+		while (s->spill_vec != NULL)
+			pthread_cond_wait(&s->spill_cond, &s->spill_lock);
+		res = s->spill_res;
+		pthread_mutex_unlock(&s->spill_lock);
+	}
+	return (res);
+}
+
+static mtbl_res
+_mtbl_sorter_spill(struct mtbl_sorter *s, struct sorter_buf *b)
+{
+	mtbl_res res;
+	entry_vec *vec = b->vec;
+	bool sorted = b->vec_sorted;
+
+	res = _mtbl_sorter_spill_wait(s);
+	if (res != mtbl_res_success)
+		return (res);
+
+	b->vec = entry_vec_init(INITIAL_SORTER_VEC_SIZE);
+	b->vec_sorted = true;
+	b->entry_bytes = 0;
+	_mtbl_sorter_table_reset(b);
+
+	/*
+	 * If the input is arriving in sorted order, hold back the entries with
+	 * the largest key, since the next entry added may be a duplicate of
+	 * them. This keeps the run open for appending.
+	 */
+	if (sorted) {
+		size_t n = entry_vec_size(vec);
+		size_t i = n - 1;
+		struct entry **array = entry_vec_data(vec);
+		while (i > 0 && _mtbl_sorter_compare(&array[i - 1], &array[i]) == 0)
+			i -= 1;
+		if (i > 0) {
+			entry_vec_append(b->vec, &array[i], n - i);
+			entry_vec_clip(vec, i);
+			for (size_t j = 0; j < n - i; j++) {
+				struct entry *ent = entry_vec_value(b->vec, j);
+				b->entry_bytes += sizeof(*ent) + ent->len_key + ent->len_val;
+			}
+			if (s->opt.preaggregate) {
+				struct entry *ent = entry_vec_value(b->vec, 0);
+				uint32_t hash = _mtbl_sorter_hash(entry_key(ent), ent->len_key);
+				struct entry_slot *slot = _mtbl_sorter_table_find(b,
+					entry_key(ent), ent->len_key, hash);
+				slot->hash = hash;
+				slot->idx = 1;
+				b->table.n_used = 1;
+			}
+		}
+	}
+
+	if (s->opt.background_spill) {
+		if (!s->spill_thr_started) {
+			int ret = pthread_create(&s->spill_thr, NULL,
+						 _mtbl_sorter_spill_thr, s);
+			assert(ret == 0);
+			s->spill_thr_started = true;
+		}
+		pthread_mutex_lock(&s->spill_lock);
+		s->spill_vec = vec;
+		s->spill_vec_sorted = sorted;
+		pthread_cond_broadcast(&s->spill_cond);
+		pthread_mutex_unlock(&s->spill_lock);
+		return (mtbl_res_success);
+	}
+
+	res = _mtbl_sorter_spill_vec(s, b, vec, sorted);
+	entry_vec_destroy(&vec);
+	return (res);
+}
+
+/*
+ * Choose the partition boundaries from the entries buffered so far, create
+ * the partitions, and move the buffered entries into them. The boundaries are
+ * evenly spaced quantiles of the distinct keys in the buffer.
+ */
+static mtbl_res
+_mtbl_sorter_partition(struct mtbl_sorter *s)
 {
 	mtbl_res res;
+	struct sorter_buf *b = s->buf;
+	struct entry **array = entry_vec_data(b->vec);
+	size_t n = entry_vec_size(b->vec);
+	const size_t n_parts = s->opt.partitions;
+
+	if (!b->vec_sorted)
+		psort((void **) array, n, s->opt.sort_threads, _mtbl_sorter_compare);
+	res = _mtbl_sorter_collapse(s, b, array, &n);
+	entry_vec_clip(b->vec, n);
+	if (res != mtbl_res_success)
+		return (res);
+
+	struct mtbl_sorter_options popt = s->opt;
+	popt.partitions = 0;
+	popt.background_spill = true;
+	popt.max_memory = s->opt.max_memory / n_parts;
+	if (popt.max_memory < MIN_SORTER_MEMORY)
+		popt.max_memory = MIN_SORTER_MEMORY;
+
+	struct partition *parts = my_calloc(n_parts, sizeof(*parts));
+	s->bounds = my_calloc(n_parts - 1, sizeof(*s->bounds));
+	for (size_t i = 0; i < n_parts; i++)
+		parts[i].s = mtbl_sorter_init(&popt);
+	for (size_t i = 0; i + 1 < n_parts; i++) {
+		s->bounds[i] = ubuf_init(64);
+		if (n > 0) {
+			struct entry *ent = array[(i + 1) * n / n_parts];
+			ubuf_append(s->bounds[i], entry_key(ent), ent->len_key);
+		}
+	}
+
+	/* mtbl_sorter_stats() may look at the partitions from another thread */
+	__atomic_store_n(&s->parts, parts, __ATOMIC_RELEASE);
+
+	for (size_t i = 0; i < n; i++) {
+		struct entry *ent = array[i];
+		if (res == mtbl_res_success) {
+			res = mtbl_sorter_add(s, entry_key(ent), ent->len_key,
+					      entry_val(ent), ent->len_val);
+		}
+		free(ent);
+	}
+	entry_vec_destroy(&b->vec);
+	b->vec = entry_vec_init(1);
+	b->entry_bytes = 0;
+	_mtbl_sorter_table_reset(b);
+
+	/*
+	 * The entries moved into the partitions are now counted by them, and
+	 * those merged away in the sample remain counted here.
+	 */
+	__atomic_store_n(&b->count_entries, b->count_entries - n, __ATOMIC_RELAXED);
+	return (res);
+}
+
+/*
+ * Return the partition whose key range contains 'key'. Partition i holds the
+ * keys which sort at or after boundary i - 1 and before boundary i.
+ */
+static struct mtbl_sorter *
+_mtbl_sorter_route(struct mtbl_sorter *s, const uint8_t *key, size_t len_key)
+{
+	size_t lo = 0, hi = s->opt.partitions - 1;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (bytes_compare(ubuf_data(s->bounds[mid]), ubuf_size(s->bounds[mid]),
+				  key, len_key) <= 0)
+		{
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (s->parts[lo].s);
+}
+
+static void *
+_mtbl_sorter_part_iter_thr(void *arg)
+{
+	struct partition *p = (struct partition *) arg;
+	p->it = mtbl_sorter_iter(p->s);
+	p->res = (p->it != NULL) ? mtbl_res_success : mtbl_res_failure;
+	return (NULL);
+}
+
+static void *
+_mtbl_sorter_part_write_thr(void *arg)
+{
+	struct partition *p = (struct partition *) arg;
+	p->res = mtbl_sorter_write(p->s, p->w);
+	return (NULL);
+}
+
+/*
+ * Run 'fn' on every partition concurrently, one thread per partition.
+ */
+static mtbl_res
+_mtbl_sorter_parts_run(struct mtbl_sorter *s, void *(*fn)(void *))
+{
+	mtbl_res res = mtbl_res_success;
+
+	for (size_t i = 0; i < s->opt.partitions; i++) {
+		int ret = pthread_create(&s->parts[i].thr, NULL, fn, &s->parts[i]);
+		assert(ret == 0);
+	}
+	for (size_t i = 0; i < s->opt.partitions; i++) {
+		int ret = pthread_join(s->parts[i].thr, NULL);
+		assert(ret == 0);
+		if (s->parts[i].res != mtbl_res_success)
+			res = mtbl_res_failure;
+	}
+	return (res);
+}
+
+mtbl_res
+mtbl_sorter_write_partitions(struct mtbl_sorter *s,
+			     struct mtbl_writer **w, size_t n_w)
+{
+	mtbl_res res;
+
+	if (s->iterating || s->opt.partitions < 2 || n_w != s->opt.partitions)
+		return (mtbl_res_failure);
+	if (s->parts == NULL) {
+		res = _mtbl_sorter_partition(s);
+		if (res != mtbl_res_success)
+			return (res);
+	}
+
+	for (size_t i = 0; i < n_w; i++)
+		s->parts[i].w = w[i];
+	res = _mtbl_sorter_parts_run(s, _mtbl_sorter_part_write_thr);
+	s->iterating = true;
+	return (res);
+}
+
+mtbl_res
+mtbl_sorter_write(struct mtbl_sorter *s, struct mtbl_writer *w)
+{
+	if (s->iterating)
+		return (mtbl_res_failure);
+	struct mtbl_iter *it = mtbl_sorter_iter(s);
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	mtbl_res res = mtbl_res_success;
+
+	if (it == NULL)
+		return (mtbl_res_failure);
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		res = mtbl_writer_add(w, key, len_key, val, len_val);
+		if (res != mtbl_res_success)
+			break;
+	}
+	mtbl_iter_destroy(&it);
+	return (res);
+}
+
+/*
+ * Return the buffer that entries added by the calling thread go into.
+ */
+static struct sorter_buf *
+_mtbl_sorter_get_buf(struct mtbl_sorter *s)
+{
+	if (!s->opt.thread_safe)
+		return (s->buf);
+
+	struct sorter_buf *b = pthread_getspecific(s->buf_key);
+	if (b == NULL) {
+		b = _mtbl_sorter_buf_init();
+		pthread_mutex_lock(&s->lock);
+		buf_vec_add(s->bufs, b);
+		pthread_mutex_unlock(&s->lock);
+		__atomic_add_fetch(&s->n_bufs, 1, __ATOMIC_RELAXED);
+		int ret = pthread_setspecific(s->buf_key, b);
+		assert(ret == 0);
+	}
+	return (b);
+}
+
+mtbl_res
+mtbl_sorter_add(struct mtbl_sorter *s,
+		const uint8_t *key, size_t len_key,
+		const uint8_t *val, size_t len_val)
+{
+	mtbl_res res = mtbl_res_success;
+	if (s->iterating)
+		return (mtbl_res_failure);
+	if (__atomic_load_n(&s->spill_res, __ATOMIC_RELAXED) != mtbl_res_success)
+		return (mtbl_res_failure);
+	assert(len_key <= UINT_MAX);
+	assert(len_val <= UINT_MAX);
+
+	if (s->parts != NULL) {
+		return (mtbl_sorter_add(_mtbl_sorter_route(s, key, len_key),
+					key, len_key, val, len_val));
+	}
+
+	struct sorter_buf *b = _mtbl_sorter_get_buf(s);
+	struct entry *ent;
+	size_t entry_bytes;
+	bool merged = false;
+
+	if (s->opt.preaggregate && entry_vec_size(b->vec) < UINT32_MAX) {
+		if (2 * (b->table.n_used + 1) > b->table.n_slots)
+			_mtbl_sorter_table_grow(b);
+		uint32_t hash = _mtbl_sorter_hash(key, len_key);
+		struct entry_slot *slot = _mtbl_sorter_table_find(b, key, len_key, hash);
+		if (slot->idx != 0) {
+			struct entry **pent = &entry_vec_data(b->vec)[slot->idx - 1];
+			size_t len_old_val = (*pent)->len_val;
+			res = _mtbl_sorter_merge_entry(s, b->merge_val, pent, val, len_val);
+			if (res != mtbl_res_success)
+				return (res);
+			__atomic_store_n(&b->count_merges, b->count_merges + 1, __ATOMIC_RELAXED);
+			b->entry_bytes -= len_old_val;
+			b->entry_bytes += (*pent)->len_val;
+			merged = true;
+		} else {
+			slot->hash = hash;
+			slot->idx = entry_vec_size(b->vec) + 1;
+			b->table.n_used += 1;
+		}
+	}
+
+	if (!merged) {
+		if (b->vec_sorted && entry_vec_size(b->vec) > 0) {
+			struct entry *last = entry_vec_value(b->vec, entry_vec_size(b->vec) - 1);
+			if (bytes_compare(entry_key(last), last->len_key, key, len_key) > 0)
+				b->vec_sorted = false;
+		}
+		entry_bytes = sizeof(*ent) + len_key + len_val;
+		ent = my_malloc(entry_bytes);
+		ent->len_key = len_key;
+		ent->len_val = len_val;
+		memcpy(entry_key(ent), key, len_key);
+		memcpy(entry_val(ent), val, len_val);
+		entry_vec_append(b->vec, &ent, 1);
+		b->entry_bytes += entry_bytes;
+	}
+
+	/*
+	 * Only the owning thread writes to the buffer's entry count, but
+	 * mtbl_sorter_stats() may read it from another thread.
+	 */
+	__atomic_store_n(&b->count_entries, b->count_entries + 1, __ATOMIC_RELAXED);
+
+	/* The memory limit is divided evenly among the producers' buffers. */
+	size_t max_buf_memory = s->max_vec_memory;
+	if (s->opt.thread_safe)
+		max_buf_memory /= __atomic_load_n(&s->n_bufs, __ATOMIC_RELAXED);
+
+	bool full = (b->entry_bytes + entry_vec_bytes(b->vec) +
+		     _mtbl_sorter_table_bytes(b) >= max_buf_memory);
+
+	/*
+	 * A partitioned sorter buffers its first entries as a sample for
+	 * choosing the partition boundaries, and routes entries to the
+	 * partitions from then on.
+	 */
+	if (s->opt.partitions > 1) {
+		if (full || entry_vec_size(b->vec) >= SORTER_PARTITION_SAMPLE_SIZE)
+			res = _mtbl_sorter_partition(s);
+	} else if (full) {
+		res = _mtbl_sorter_spill(s, b);
+	}
+	return (res);
+}
+
+/*
+ * Return the index of the first entry in the sorted array whose key is not
+ * less than 'key'.
+ */
+static size_t
+_mtbl_sorter_lower_bound(struct entry **array, size_t n,
+			 const uint8_t *key, size_t len_key)
+{
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (bytes_compare(entry_key(array[mid]), array[mid]->len_key,
+				  key, len_key) < 0)
+		{
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo);
+}
+
+static mtbl_res
+mem_iter_next(void *v,
+	      const uint8_t **key, size_t *len_key,
+	      const uint8_t **val, size_t *len_val)
+{
+	struct mem_iter *it = (struct mem_iter *) v;
+	if (it->i >= it->n)
+		return (mtbl_res_failure);
+
+	struct entry *ent = it->array[it->i];
+	if (it->prefix != NULL &&
+	    !(ubuf_size(it->prefix) <= ent->len_key &&
+	      memcmp(ubuf_data(it->prefix), entry_key(ent), ubuf_size(it->prefix)) == 0))
+	{
+		it->i = it->n;
+		return (mtbl_res_failure);
+	}
+	it->i += 1;
+
+	*key = entry_key(ent);
+	*len_key = ent->len_key;
+	*val = entry_val(ent);
+	*len_val = ent->len_val;
+	return (mtbl_res_success);
+}
+
+static void
+mem_iter_free(void *v)
+{
+	struct mem_iter *it = (struct mem_iter *) v;
+	if (it) {
+		ubuf_destroy(&it->prefix);
+		free(it);
+	}
+}
+
+static struct mtbl_iter *
+mem_iter_init(entry_vec *vec, size_t i, size_t n,
+	      const uint8_t *prefix, size_t len_prefix)
+{
+	struct mem_iter *it = my_calloc(1, sizeof(*it));
+	it->array = entry_vec_data(vec);
+	it->i = i;
+	it->n = n;
+	if (prefix != NULL) {
+		it->prefix = ubuf_init(len_prefix);
+		ubuf_append(it->prefix, prefix, len_prefix);
+	}
+	return (mtbl_iter_init(mem_iter_next, mem_iter_free, it));
+}
+
+static struct mtbl_iter *
+mem_source_iter(void *clos)
+{
+	entry_vec *vec = (entry_vec *) clos;
+	return (mem_iter_init(vec, 0, entry_vec_size(vec), NULL, 0));
+}
+
+static struct mtbl_iter *
+mem_source_get_range(void *clos,
+		     const uint8_t *key0, size_t len_key0,
+		     const uint8_t *key1, size_t len_key1)
+{
+	entry_vec *vec = (entry_vec *) clos;
+	struct entry **array = entry_vec_data(vec);
+	size_t n = entry_vec_size(vec);
+	size_t lo = _mtbl_sorter_lower_bound(array, n, key0, len_key0);
+	size_t hi = _mtbl_sorter_upper_bound(array, n, key1, len_key1);
+	if (hi < lo)
+		hi = lo;
+	return (mem_iter_init(vec, lo, hi, NULL, 0));
+}
+
+static void
+mem_source_free(void *clos)
+{
+	entry_vec *vec = (entry_vec *) clos;
+	_mtbl_sorter_vec_destroy(&vec);
+}
+
+static struct mtbl_iter *
+mem_source_get(void *clos, const uint8_t *key, size_t len_key)
+{
+	return (mem_source_get_range(clos, key, len_key, key, len_key));
+}
+
+static struct mtbl_iter *
+mem_source_get_prefix(void *clos, const uint8_t *key, size_t len_key)
+{
+	entry_vec *vec = (entry_vec *) clos;
+	size_t lo = _mtbl_sorter_lower_bound(entry_vec_data(vec), entry_vec_size(vec),
+					     key, len_key);
+	return (mem_iter_init(vec, lo, entry_vec_size(vec), key, len_key));
+}
+
+static mtbl_res
+sorter_iter_next(void *v,
+		 const uint8_t **key, size_t *len_key,
+		 const uint8_t **val, size_t *len_val)
+{
+	struct sorter_iter *it = (struct sorter_iter *) v;
+	if (it->part_iters != NULL) {
+		/* the partitions hold disjoint, ascending key ranges */
+		while (it->i_part < it->n_parts) {
+			if (mtbl_iter_next(it->part_iters[it->i_part],
+					   key, len_key, val, len_val) == mtbl_res_success)
+			{
+				return (mtbl_res_success);
+			}
+			it->i_part += 1;
+		}
+		return (mtbl_res_failure);
+	}
+	return (mtbl_iter_next(it->m_iter, key, len_key, val, len_val));
+}
+
+static void
+sorter_iter_free(void *v)
+{
+	struct sorter_iter *it = (struct sorter_iter *) v;
+	if (it) {
+		for (size_t i = 0; i < it->n_parts; i++)
+			mtbl_iter_destroy(&it->part_iters[i]);
+		free(it->part_iters);
+		mtbl_iter_destroy(&it->m_iter);
+		mtbl_merger_destroy(&it->m);
+		for (size_t i = 0; i < source_vec_size(it->ra_sources); i++) {
+			struct mtbl_source *src = source_vec_value(it->ra_sources, i);
+			mtbl_source_destroy(&src);
+		}
+		source_vec_destroy(&it->ra_sources);
+		readahead_destroy(&it->ra);
+		for (size_t i = 0; i < source_vec_size(it->mem_sources); i++) {
+			struct mtbl_source *src = source_vec_value(it->mem_sources, i);
+			mtbl_source_destroy(&src);
+		}
+		source_vec_destroy(&it->mem_sources);
+		for (size_t i = 0; i < reader_vec_size(it->readers); i++) {
+			struct mtbl_reader *r = reader_vec_value(it->readers, i);
+			mtbl_reader_destroy(&r);
+		}
+		reader_vec_destroy(&it->readers);
+		free(it);
+	}
+}
+
+static struct mtbl_iter *
+_mtbl_sorter_iter_partitioned(struct mtbl_sorter *s)
+{
+	mtbl_res res = _mtbl_sorter_parts_run(s, _mtbl_sorter_part_iter_thr);
+
 	struct sorter_iter *it = my_calloc(1, sizeof(*it));
 	it->readers = reader_vec_init(0);
+	it->mem_sources = source_vec_init(1);
+	it->ra_sources = source_vec_init(1);
+	it->n_parts = s->opt.partitions;
+	it->part_iters = my_calloc(it->n_parts, sizeof(struct mtbl_iter *));
+	for (size_t i = 0; i < it->n_parts; i++) {
+		it->part_iters[i] = s->parts[i].it;
+		s->parts[i].it = NULL;
+	}
+	if (res != mtbl_res_success) {
+		sorter_iter_free(it);
+		return (NULL);
+	}
 
-	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
-	mtbl_merger_options_set_merge_func(mopt, s->opt.merge, s->opt.merge_clos);
-	it->m = mtbl_merger_init(mopt);
-	mtbl_merger_options_destroy(&mopt);
+	s->iterating = true;
+	return (mtbl_iter_init(sorter_iter_next, sorter_iter_free, it));
+}
+
+struct mtbl_iter *
+mtbl_sorter_iter(struct mtbl_sorter *s)
+{
+	mtbl_res res;
+	size_t n_mem = 0;
+
+	/*
+	 * Each partition prepares its final merge on its own thread, and the
+	 * partitions are then read back one after the other.
+	 */
+	if (s->parts != NULL)
+		return (_mtbl_sorter_iter_partitioned(s));
+
+	res = _mtbl_sorter_spill_wait(s);
+	if (res != mtbl_res_success)
+		return (NULL);
+
+	/*
+	 * The final buffers are sorted in memory and read directly alongside
+	 * any runs on disk, so sorts which fit in memory never touch the disk.
+	 */
+	for (size_t i = 0; i < buf_vec_size(s->bufs); i++) {
+		struct sorter_buf *b = buf_vec_value(s->bufs, i);
+		struct entry **array = entry_vec_data(b->vec);
+		size_t n = entry_vec_size(b->vec);
+		if (!b->vec_sorted)
+			psort((void **) array, n, s->opt.sort_threads, _mtbl_sorter_compare);
+		b->vec_sorted = true;
+		res = _mtbl_sorter_collapse(s, b, array, &n);
+		entry_vec_clip(b->vec, n);
+		if (res != mtbl_res_success)
+			return (NULL);
+		if (n > 0)
+			n_mem += 1;
+	}
 
-	if (entry_vec_size(s->vec) > 0) {
-		res = _mtbl_sorter_write_chunk(s);
+	/*
+	 * With many producers, the in-memory buffers alone may exceed the
+	 * merge width, in which case they are written out as well.
+	 */
+	if (s->opt.max_fan_in != 0 && n_mem >= s->opt.max_fan_in) {
+		for (size_t i = 0; i < buf_vec_size(s->bufs); i++) {
+			struct sorter_buf *b = buf_vec_value(s->bufs, i);
+			if (entry_vec_size(b->vec) == 0)
+				continue;
+			res = _mtbl_sorter_spill_vec(s, b, b->vec, true);
+			if (res != mtbl_res_success)
+				return (NULL);
+		}
+		n_mem = 0;
+	}
+
+	for (size_t i = 0; i < buf_vec_size(s->bufs); i++) {
+		res = _mtbl_sorter_run_close_all(s, buf_vec_value(s->bufs, i));
 		if (res != mtbl_res_success)
 			return (NULL);
 	}
 
+	res = _mtbl_sorter_reduce_fan_in(s, n_mem);
+	if (res != mtbl_res_success)
+		return (NULL);
+
+	struct sorter_iter *it = my_calloc(1, sizeof(*it));
+	it->readers = reader_vec_init(0);
+	it->mem_sources = source_vec_init(1);
+	it->ra_sources = source_vec_init(1);
 	for (unsigned i = 0; i < chunk_vec_size(s->chunks); i++) {
 		struct chunk *c = chunk_vec_value(s->chunks, i);
 		struct mtbl_reader *r;
 		r = mtbl_reader_init_fd(c->fd, NULL);
-		mtbl_merger_add_source(it->m, mtbl_reader_source(r));
+		reader_advise_sequential(r);
 		reader_vec_add(it->readers, r);
 	}
+	/*
+	 * The sources take over the buffers' entries, so that the iterator
+	 * may outlive the sorter like the readers on its chunks do.
+	 */
+	for (size_t i = 0; i < buf_vec_size(s->bufs); i++) {
+		struct sorter_buf *b = buf_vec_value(s->bufs, i);
+		if (entry_vec_size(b->vec) == 0)
+			continue;
+		struct mtbl_source *src = mtbl_source_init(mem_source_iter,
+							   mem_source_get,
+							   mem_source_get_prefix,
+							   mem_source_get_range,
+							   mem_source_free, b->vec);
+		source_vec_add(it->mem_sources, src);
+		b->vec = entry_vec_init(1);
+		b->entry_bytes = 0;
+	}
+
+	size_t n_sources = reader_vec_size(it->readers) + n_mem;
+	if (n_sources == 1) {
+		/* no merge required */
+		if (n_mem > 0) {
+			it->m_iter = mtbl_source_iter(source_vec_value(it->mem_sources, 0));
+		} else {
+			struct mtbl_reader *r = reader_vec_value(it->readers, 0);
+			it->m_iter = mtbl_source_iter(mtbl_reader_source(r));
+		}
+	} else if (n_sources > 1) {
+		it->m = _mtbl_sorter_merger_init(s);
+
+		/*
+		 * With read-ahead, blocks of the chunks are read and
+		 * decompressed by a pool of worker threads ahead of the merge.
+		 */
+		if (s->opt.readahead_threads > 0 && reader_vec_size(it->readers) > 0)
+			it->ra = readahead_init(s->opt.readahead_threads);
+		for (size_t i = 0; i < reader_vec_size(it->readers); i++) {
+			struct mtbl_reader *r = reader_vec_value(it->readers, i);
+			if (it->ra != NULL) {
+				struct mtbl_source *src;
+				src = readahead_source(it->ra, mtbl_reader_source(r));
+				source_vec_add(it->ra_sources, src);
+				mtbl_merger_add_source(it->m, src);
+			} else {
+				mtbl_merger_add_source(it->m, mtbl_reader_source(r));
+			}
+		}
+		for (size_t i = 0; i < n_mem; i++)
+			mtbl_merger_add_source(it->m, source_vec_value(it->mem_sources, i));
+		it->m_iter = mtbl_source_iter(mtbl_merger_source(it->m));
+	}
 
-	it->m_iter = mtbl_source_iter(mtbl_merger_source(it->m));
 	s->iterating = true;
 	return (mtbl_iter_init(sorter_iter_next, sorter_iter_free, it));
 }
+
+void
+mtbl_sorter_stats(struct mtbl_sorter *s, struct mtbl_sorter_stats *stats)
+{
+	stats->count_entries = 0;
+	stats->count_merges = __atomic_load_n(&s->stats.count_merges, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&s->lock);
+	for (size_t i = 0; i < buf_vec_size(s->bufs); i++) {
+		struct sorter_buf *b = buf_vec_value(s->bufs, i);
+		stats->count_entries +=
+			__atomic_load_n(&b->count_entries, __ATOMIC_RELAXED);
+		stats->count_merges +=
+			__atomic_load_n(&b->count_merges, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&s->lock);
+	stats->count_spills = __atomic_load_n(&s->stats.count_spills, __ATOMIC_RELAXED);
+	stats->count_spills_presorted =
+		__atomic_load_n(&s->stats.count_spills_presorted, __ATOMIC_RELAXED);
+	stats->count_runs = __atomic_load_n(&s->stats.count_runs, __ATOMIC_RELAXED);
+	stats->count_runs_open = __atomic_load_n(&s->stats.count_runs_open, __ATOMIC_RELAXED);
+	stats->count_chunks = __atomic_load_n(&s->stats.count_chunks, __ATOMIC_RELAXED);
+	stats->count_merge_passes =
+		__atomic_load_n(&s->stats.count_merge_passes, __ATOMIC_RELAXED);
+	stats->bytes_spilled = __atomic_load_n(&s->stats.bytes_spilled, __ATOMIC_RELAXED);
+	stats->bytes_merged = __atomic_load_n(&s->stats.bytes_merged, __ATOMIC_RELAXED);
+	stats->time_spills_ns = __atomic_load_n(&s->stats.time_spills_ns, __ATOMIC_RELAXED);
+
+	struct partition *parts = __atomic_load_n(&s->parts, __ATOMIC_ACQUIRE);
+	if (parts != NULL) {
+		for (size_t i = 0; i < s->opt.partitions; i++) {
+			struct mtbl_sorter_stats ps;
+			mtbl_sorter_stats(parts[i].s, &ps);
+			stats->count_entries += ps.count_entries;
+			stats->count_spills += ps.count_spills;
+			stats->count_spills_presorted += ps.count_spills_presorted;
+			stats->count_runs += ps.count_runs;
+			stats->count_runs_open += ps.count_runs_open;
+			stats->count_chunks += ps.count_chunks;
+			stats->count_merge_passes += ps.count_merge_passes;
+			stats->count_merges += ps.count_merges;
+			stats->bytes_spilled += ps.bytes_spilled;
+			stats->bytes_merged += ps.bytes_merged;
+			stats->time_spills_ns += ps.time_spills_ns;
+		}
+	}
+}
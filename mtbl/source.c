@@ -21,6 +21,10 @@ struct mtbl_source {
 	mtbl_source_get_func		source_get;
 	mtbl_source_get_prefix_func	source_get_prefix;
 	mtbl_source_get_range_func	source_get_range;
+	mtbl_source_iter_func		source_iter_keys;
+	mtbl_source_get_prefix_func	source_get_prefix_keys;
+	mtbl_source_get_range_func	source_get_range_keys;
+	source_index_func		source_index;
 	mtbl_source_free_func		source_free;
 	void				*clos;
 };
@@ -47,6 +51,36 @@ mtbl_source_init(mtbl_source_iter_func source_iter,
 	return (s);
 }
 
+void
+mtbl_source_set_keys_funcs(struct mtbl_source *s,
+			   mtbl_source_iter_func source_iter_keys,
+			   mtbl_source_get_prefix_func source_get_prefix_keys,
+			   mtbl_source_get_range_func source_get_range_keys)
+{
+	s->source_iter_keys = source_iter_keys;
+	s->source_get_prefix_keys = source_get_prefix_keys;
+	s->source_get_range_keys = source_get_range_keys;
+}
+
+void
+source_set_index_func(struct mtbl_source *s, source_index_func fp)
+{
+	s->source_index = fp;
+}
+
+/*
+ * Visit the index entries of the readers underlying 's', if any. Returns false
+ * if the source does not expose an index.
+ */
+bool
+source_index(const struct mtbl_source *s, index_visit_func visit, void *visit_clos)
+{
+	if (s->source_index == NULL)
+		return (false);
+	s->source_index(s->clos, visit, visit_clos);
+	return (true);
+}
+
 void
 mtbl_source_destroy(struct mtbl_source **s)
 {
@@ -86,20 +120,56 @@ mtbl_source_get_range(const struct mtbl_source *s,
 	return (s->source_get_range(s->clos, key0, len_key0, key1, len_key1));
 }
 
+/*
+ * Key-only iterators need not return the values of their entries. Sources
+ * without key-only functions return full iterators instead.
+ */
+struct mtbl_iter *
+mtbl_source_iter_keys(const struct mtbl_source *s)
+{
+	if (s->source_iter_keys == NULL)
+		return (mtbl_source_iter(s));
+	return (s->source_iter_keys(s->clos));
+}
+
+struct mtbl_iter *
+mtbl_source_get_prefix_keys(const struct mtbl_source *s,
+			    const uint8_t *key, size_t len_key)
+{
+	if (s->source_get_prefix_keys == NULL)
+		return (mtbl_source_get_prefix(s, key, len_key));
+	return (s->source_get_prefix_keys(s->clos, key, len_key));
+}
+
+struct mtbl_iter *
+mtbl_source_get_range_keys(const struct mtbl_source *s,
+			   const uint8_t *key0, size_t len_key0,
+			   const uint8_t *key1, size_t len_key1)
+{
+	if (s->source_get_range_keys == NULL)
+		return (mtbl_source_get_range(s, key0, len_key0, key1, len_key1));
+	return (s->source_get_range_keys(s->clos, key0, len_key0, key1, len_key1));
+}
+
 mtbl_res
 mtbl_source_write(const struct mtbl_source *s, struct mtbl_writer *w)
 {
-	const uint8_t *key, *val;
-	size_t len_key, len_val;
+	struct mtbl_kv kv[ITER_BATCH_SIZE];
 	struct mtbl_iter *it = mtbl_source_iter(s);
 	mtbl_res res = mtbl_res_success;
+	size_t n;
 
 	if (it == NULL)
 		return (mtbl_res_failure);
-	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
-		res = mtbl_writer_add(w, key, len_key, val, len_val);
-		if (res != mtbl_res_success)
-			break;
+	while (res == mtbl_res_success &&
+	       (n = mtbl_iter_next_batch(it, kv, ITER_BATCH_SIZE)) > 0)
+	{
+		for (size_t i = 0; i < n; i++) {
+			res = mtbl_writer_add(w, kv[i].key, kv[i].len_key,
+					      kv[i].val, kv[i].len_val);
+			if (res != mtbl_res_success)
+				break;
+		}
 	}
 	mtbl_iter_destroy(&it);
 	return (res);
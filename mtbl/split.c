@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "mtbl-private.h"
+#include "vector_types.h"
+
+/*
+ * Splitting a source into consecutive key ranges of roughly equal size.
+ *
+ * The boundaries are chosen from the index entries of the underlying readers,
+ * each of which is weighted by the size of the data block it points to. Each
+ * range is then iterated by seeking a full iterator to the start of the range,
+ * and stopping it at the start of the next one.
+ */
+
+struct split_point {
+	const uint8_t			*key;
+	size_t				off_key;
+	size_t				len_key;
+	uint64_t			bytes;
+};
+
+VECTOR_GENERATE(split_point_vec, struct split_point);
+
+struct split_state {
+	split_point_vec			*points;
+	ubuf				*keys;
+	uint64_t			total;
+};
+
+struct range_iter {
+	struct mtbl_iter		*it;
+	ubuf				*end;
+	bool				done;
+};
+
+static void
+split_visit(void *clos, const uint8_t *key, size_t len_key, uint64_t bytes)
+{
+	struct split_state *ss = (struct split_state *) clos;
+	struct split_point p = {
+		.off_key = ubuf_size(ss->keys),
+		.len_key = len_key,
+		.bytes = bytes,
+	};
+	ubuf_append(ss->keys, key, len_key);
+	split_point_vec_add(ss->points, p);
+	ss->total += bytes;
+}
+
+static int
+split_point_compare(const void *va, const void *vb)
+{
+	const struct split_point *a = (const struct split_point *) va;
+	const struct split_point *b = (const struct split_point *) vb;
+	return (bytes_compare(a->key, a->len_key, b->key, b->len_key));
+}
+
+/* Returns true if 'key' is at or past the end of the range. */
+static inline bool
+range_iter_past_end(const struct range_iter *it, const uint8_t *key, size_t len_key)
+{
+	return (it->end != NULL &&
+		bytes_compare(key, len_key, ubuf_data(it->end), ubuf_size(it->end)) >= 0);
+}
+
+static mtbl_res
+range_iter_next(void *v,
+		const uint8_t **key, size_t *len_key,
+		const uint8_t **val, size_t *len_val)
+{
+	struct range_iter *it = (struct range_iter *) v;
+
+	if (it->done)
+		return (mtbl_res_failure);
+	if (mtbl_iter_next(it->it, key, len_key, val, len_val) != mtbl_res_success ||
+	    range_iter_past_end(it, *key, *len_key))
+	{
+		it->done = true;
+		return (mtbl_res_failure);
+	}
+	return (mtbl_res_success);
+}
+
+static size_t
+range_iter_next_batch(void *v, struct mtbl_kv *kv, size_t max)
+{
+	struct range_iter *it = (struct range_iter *) v;
+
+	if (it->done)
+		return (0);
+	size_t n = mtbl_iter_next_batch(it->it, kv, max);
+	if (n == 0) {
+		it->done = true;
+		return (0);
+	}
+
+	/* only the batch which crosses the end of the range needs trimming */
+	if (range_iter_past_end(it, kv[n - 1].key, kv[n - 1].len_key)) {
+		it->done = true;
+		while (n > 0 && range_iter_past_end(it, kv[n - 1].key, kv[n - 1].len_key))
+			n--;
+	}
+	return (n);
+}
+
+static mtbl_res
+range_iter_seek(void *v, const uint8_t *key, size_t len_key)
+{
+	struct range_iter *it = (struct range_iter *) v;
+
+	if (it->done)
+		return (mtbl_res_success);
+	return (mtbl_iter_seek(it->it, key, len_key));
+}
+
+static struct mtbl_pin *
+range_iter_pin(void *v)
+{
+	return (iter_pin(((struct range_iter *) v)->it));
+}
+
+static void
+range_iter_free(void *v)
+{
+	struct range_iter *it = (struct range_iter *) v;
+	if (it != NULL) {
+		mtbl_iter_destroy(&it->it);
+		ubuf_destroy(&it->end);
+		free(it);
+	}
+}
+
+/*
+ * Return an iterator over the entries of 's' with keys in [start, end). A NULL
+ * 'start' or 'end' leaves the range unbounded on that side.
+ */
+static struct mtbl_iter *
+range_iter_init(const struct mtbl_source *s,
+		const struct split_point *start,
+		const struct split_point *end)
+{
+	struct range_iter *it = my_calloc(1, sizeof(*it));
+	it->it = mtbl_source_iter(s);
+	if (start != NULL && mtbl_iter_seek(it->it, start->key, start->len_key) != mtbl_res_success)
+		it->done = true;
+	if (end != NULL) {
+		it->end = ubuf_init(end->len_key);
+		ubuf_append(it->end, end->key, end->len_key);
+	}
+
+	struct mtbl_iter *iter = mtbl_iter_init(range_iter_next, range_iter_free, it);
+	mtbl_iter_set_seek_func(iter, range_iter_seek);
+	mtbl_iter_set_next_batch_func(iter, range_iter_next_batch);
+	iter_set_pin_func(iter, range_iter_pin);
+	return (iter);
+}
+
+size_t
+mtbl_source_split(const struct mtbl_source *s, size_t n, struct mtbl_iter **iters)
+{
+	struct split_state ss = {
+		.points = split_point_vec_init(64),
+		.keys = ubuf_init(1024),
+		.total = 0,
+	};
+	size_t n_iters = 0;
+
+	assert(n > 0);
+	source_index(s, split_visit, &ss);
+
+	/* the key buffer has stopped moving, so the points can refer into it */
+	struct split_point *points = split_point_vec_data(ss.points);
+	size_t n_points = split_point_vec_size(ss.points);
+	for (size_t i = 0; i < n_points; i++)
+		points[i].key = ubuf_data(ss.keys) + points[i].off_key;
+	qsort(points, n_points, sizeof(*points), split_point_compare);
+
+	/*
+	 * Each range ends once the data before it reaches the next multiple of
+	 * 1/n of the total. Boundaries which repeat are dropped, so fewer than
+	 * 'n' ranges may be returned.
+	 */
+	const struct split_point *start = NULL;
+	uint64_t bytes = 0;
+	size_t i_point = 0;
+	for (size_t i = 1; i < n; i++) {
+		uint64_t target = ss.total / n * i;
+		while (i_point < n_points && bytes < target)
+			bytes += points[i_point++].bytes;
+		if (i_point == 0 || i_point == n_points)
+			break;
+		const struct split_point *end = &points[i_point - 1];
+		if (start != NULL &&
+		    bytes_compare(start->key, start->len_key, end->key, end->len_key) >= 0)
+		{
+			continue;
+		}
+		iters[n_iters++] = range_iter_init(s, start, end);
+		start = end;
+	}
+	iters[n_iters++] = range_iter_init(s, start, NULL);
+
+	split_point_vec_destroy(&ss.points);
+	ubuf_destroy(&ss.keys);
+	return (n_iters);
+}
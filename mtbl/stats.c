@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "mtbl-private.h"
+
+static unsigned			next_shard;
+static __thread unsigned	thread_shard;
+
+/* Returns the shard of the calling thread, assigning threads in turn. */
+unsigned
+stats_shard(void)
+{
+	if (thread_shard == 0)
+		thread_shard = __atomic_add_fetch(&next_shard, 1, __ATOMIC_RELAXED) % STATS_SHARDS + 1;
+	return (thread_shard - 1);
+}
+
+/* Allocate a zeroed array of shards, aligned to a cache line. */
+void *
+stats_shards_init(size_t size)
+{
+	void *shards;
+	int ret = posix_memalign(&shards, STATS_ALIGN, size);
+	assert(ret == 0);
+	memset(shards, 0, size);
+	return (shards);
+}
+
+uint64_t
+stats_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
@@ -31,11 +31,16 @@ trailer_write(struct trailer *t, uint8_t *buf)
 	p += mtbl_fixed_encode64(p, t->bytes_index_block);
 	p += mtbl_fixed_encode64(p, t->bytes_keys);
 	p += mtbl_fixed_encode64(p, t->bytes_values);
+	p += mtbl_fixed_encode64(p, t->data_block_layout);
 
 	padding = MTBL_TRAILER_SIZE - (p - buf) - sizeof(uint32_t);
 	while (padding-- != 0)
 		*(p++) = '\0';
-	mtbl_fixed_encode32(buf + MTBL_TRAILER_SIZE - sizeof(uint32_t), MTBL_MAGIC);
+
+	/* readers without support for the split layout refuse such files */
+	mtbl_fixed_encode32(buf + MTBL_TRAILER_SIZE - sizeof(uint32_t),
+			    t->data_block_layout == DATA_BLOCK_LAYOUT_SPLIT ?
+			    MTBL_MAGIC_SPLIT : MTBL_MAGIC);
 }
 
 bool
@@ -45,7 +50,7 @@ trailer_read(const uint8_t *buf, struct trailer *t)
 	const uint8_t *p = buf;
 
 	magic = mtbl_fixed_decode32(buf + MTBL_TRAILER_SIZE - sizeof(uint32_t));
-	if (magic != MTBL_MAGIC)
+	if (magic != MTBL_MAGIC && magic != MTBL_MAGIC_SPLIT)
 		return (false);
 
 	t->index_block_offset = mtbl_fixed_decode64(p); p += 8;
@@ -57,6 +62,10 @@ trailer_read(const uint8_t *buf, struct trailer *t)
 	t->bytes_index_block = mtbl_fixed_decode64(p); p += 8;
 	t->bytes_keys = mtbl_fixed_decode64(p); p += 8;
 	t->bytes_values = mtbl_fixed_decode64(p); p += 8;
+	t->data_block_layout = mtbl_fixed_decode64(p); p += 8;
+
+	if ((magic == MTBL_MAGIC_SPLIT) != (t->data_block_layout == DATA_BLOCK_LAYOUT_SPLIT))
+		return (false);
 
 	return (true);
 
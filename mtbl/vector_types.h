@@ -14,6 +14,9 @@
  * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifndef MTBL_VECTOR_TYPES_H
+#define MTBL_VECTOR_TYPES_H
+
 #include <stdint.h>
 
 #include "vector.h"
@@ -23,3 +26,5 @@ VECTOR_GENERATE(uint32_vec, uint32_t);
 VECTOR_GENERATE(ubuf, uint8_t);
 
 #define ubuf_append_str(u, s) do { ubuf_append(u, (const uint8_t *) s, strlen(s)); } while (0)
+
+#endif /* MTBL_VECTOR_TYPES_H */
@@ -22,13 +22,17 @@ struct mtbl_writer_options {
 	mtbl_compression_type		compression_type;
 	size_t				block_size;
 	size_t				block_restart_interval;
+	bool				split_values;
 };
 
 struct mtbl_writer {
 	int				fd;
+	mtbl_writer_write_func		write_func;
+	void				*write_clos;
 	struct trailer			t;
 	struct block_builder		*data;
 	struct block_builder		*index;
+	ubuf				*values;
 
 	struct mtbl_writer_options	opt;
 
@@ -38,15 +42,25 @@ struct mtbl_writer {
 	bool				closed;
 	bool				pending_index_entry;
 	uint64_t			pending_offset;
+
+	/* the first failure of 'write_func', after which nothing is written */
+	mtbl_res			res;
 };
 
 static void _mtbl_writer_finish(struct mtbl_writer *);
 static void _mtbl_writer_flush(struct mtbl_writer *);
-static void _write_all(int fd, const uint8_t *, size_t);
+static mtbl_res _write_all(int fd, const uint8_t *, size_t);
+static mtbl_res _mtbl_writer_write_fd(void *, const uint8_t *, size_t);
+static mtbl_res _mtbl_writer_write_buf(void *, const uint8_t *, size_t);
+static void _mtbl_writer_write(struct mtbl_writer *, const uint8_t *, size_t);
 static size_t _mtbl_writer_writeblock(
 	struct mtbl_writer *,
 	struct block_builder *,
 	mtbl_compression_type);
+static size_t _mtbl_writer_writebuf(
+	struct mtbl_writer *,
+	uint8_t *, size_t,
+	mtbl_compression_type);
 
 struct mtbl_writer_options *
 mtbl_writer_options_init(void)
@@ -94,14 +108,24 @@ mtbl_writer_options_set_block_restart_interval(struct mtbl_writer_options *opt,
 	opt->block_restart_interval = block_restart_interval;
 }
 
+void
+mtbl_writer_options_set_split_values(struct mtbl_writer_options *opt,
+				     bool split_values)
+{
+	opt->split_values = split_values;
+}
+
+/*
+ * Output is passed to 'write_func', which must consume all of it or fail. The
+ * writer initializers below differ only in the output function.
+ */
 struct mtbl_writer *
-mtbl_writer_init_fd(int orig_fd, const struct mtbl_writer_options *opt)
+mtbl_writer_init_func(mtbl_writer_write_func write_func, void *clos,
+		      const struct mtbl_writer_options *opt)
 {
 	struct mtbl_writer *w;
-	int fd;
 
-	fd = dup(orig_fd);
-	assert(fd >= 0);
+	assert(write_func != NULL);
 	w = my_calloc(1, sizeof(*w));
 	if (opt == NULL) {
 		w->opt.compression_type = DEFAULT_COMPRESSION_TYPE;
@@ -110,15 +134,45 @@ mtbl_writer_init_fd(int orig_fd, const struct mtbl_writer_options *opt)
 	} else {
 		memcpy(&w->opt, opt, sizeof(*opt));
 	}
-	w->fd = fd;
+	w->fd = -1;
+	w->write_func = write_func;
+	w->write_clos = clos;
+	w->res = mtbl_res_success;
 	w->last_key = ubuf_init(256);
 	w->t.compression_algorithm = w->opt.compression_type;
 	w->t.data_block_size = w->opt.block_size;
 	w->data = block_builder_init(w->opt.block_restart_interval);
 	w->index = block_builder_init(w->opt.block_restart_interval);
+	if (w->opt.split_values) {
+		w->t.data_block_layout = DATA_BLOCK_LAYOUT_SPLIT;
+		w->values = ubuf_init(w->opt.block_size);
+	}
+	return (w);
+}
+
+struct mtbl_writer *
+mtbl_writer_init_fd(int orig_fd, const struct mtbl_writer_options *opt)
+{
+	struct mtbl_writer *w;
+	int fd;
+
+	fd = dup(orig_fd);
+	assert(fd >= 0);
+	w = mtbl_writer_init_func(_mtbl_writer_write_fd, NULL, opt);
+	w->fd = fd;
+	w->write_clos = &w->fd;
 	return (w);
 }
 
+/* The table is appended to 'buf', which must outlive the writer. */
+struct mtbl_writer *
+mtbl_writer_init_buf(struct mtbl_buf *buf, const struct mtbl_writer_options *opt)
+{
+	if (buf == NULL || mtbl_buf_size(buf) != 0)
+		return (NULL);
+	return (mtbl_writer_init_func(_mtbl_writer_write_buf, buf, opt));
+}
+
 struct mtbl_writer *
 mtbl_writer_init(const char *fname, const struct mtbl_writer_options *opt)
 {
@@ -133,20 +187,26 @@ mtbl_writer_init(const char *fname, const struct mtbl_writer_options *opt)
 	return (w);
 }
 
-void
+mtbl_res
 mtbl_writer_destroy(struct mtbl_writer **w)
 {
+	mtbl_res res = mtbl_res_success;
+
 	if (*w != NULL) {
 		if (!(*w)->closed) {
 			_mtbl_writer_finish(*w);
-			close((*w)->fd);
+			if ((*w)->fd >= 0)
+				close((*w)->fd);
 		}
 		block_builder_destroy(&((*w)->data));
 		block_builder_destroy(&((*w)->index));
+		ubuf_destroy(&(*w)->values);
 		ubuf_destroy(&(*w)->last_key);
+		res = (*w)->res;
 		free(*w);
 		*w = NULL;
 	}
+	return (res);
 }
 
 mtbl_res
@@ -155,6 +215,8 @@ mtbl_writer_add(struct mtbl_writer *w,
 		const uint8_t *val, size_t len_val)
 {
 	assert(!w->closed);
+	if (w->res != mtbl_res_success)
+		return (w->res);
 	if (w->t.count_entries > 0) {
 		if (!(bytes_compare(key, len_key,
 				    ubuf_data(w->last_key), ubuf_size(w->last_key)) > 0))
@@ -165,9 +227,14 @@ mtbl_writer_add(struct mtbl_writer *w,
 
 	size_t estimated_block_size = block_builder_current_size_estimate(w->data);
 	estimated_block_size += 3*5 + len_key + len_val;
+	if (w->values != NULL)
+		estimated_block_size += ubuf_size(w->values) + 2*10;
 
-	if (estimated_block_size >= w->opt.block_size)
+	if (estimated_block_size >= w->opt.block_size) {
 		_mtbl_writer_flush(w);
+		if (w->res != mtbl_res_success)
+			return (w->res);
+	}
 
 	if (w->pending_index_entry) {
 		uint8_t enc[10];
@@ -191,7 +258,15 @@ mtbl_writer_add(struct mtbl_writer *w,
 	w->t.count_entries += 1;
 	w->t.bytes_keys += len_key;
 	w->t.bytes_values += len_val;
-	block_builder_add(w->data, key, len_key, val, len_val);
+	if (w->values != NULL) {
+		uint8_t enc[2 * 10];
+		size_t len_enc = mtbl_varint_encode64(enc, ubuf_size(w->values));
+		len_enc += mtbl_varint_encode64(enc + len_enc, len_val);
+		ubuf_append(w->values, val, len_val);
+		block_builder_add(w->data, key, len_key, enc, len_enc);
+	} else {
+		block_builder_add(w->data, key, len_key, val, len_val);
+	}
 	return (mtbl_res_success);
 }
 
@@ -221,7 +296,7 @@ _mtbl_writer_finish(struct mtbl_writer *w)
 	w->t.bytes_index_block = _mtbl_writer_writeblock(w, w->index, MTBL_COMPRESSION_NONE);
 
 	trailer_write(&w->t, tbuf);
-	_write_all(w->fd, tbuf, sizeof(tbuf));
+	_mtbl_writer_write(w, tbuf, sizeof(tbuf));
 }
 
 static void
@@ -232,6 +307,12 @@ _mtbl_writer_flush(struct mtbl_writer *w)
 		return;
 	assert(!w->pending_index_entry);
 	w->t.bytes_data_blocks += _mtbl_writer_writeblock(w, w->data, w->opt.compression_type);
+	if (w->values != NULL) {
+		w->t.bytes_data_blocks += _mtbl_writer_writebuf(w,
+			ubuf_data(w->values), ubuf_size(w->values),
+			w->opt.compression_type);
+		ubuf_clip(w->values, 0);
+	}
 	w->t.count_data_blocks += 1;
 	w->pending_index_entry = true;
 }
@@ -241,14 +322,32 @@ _mtbl_writer_writeblock(struct mtbl_writer *w,
 			struct block_builder *b,
 			mtbl_compression_type compression_type)
 {
-	uint8_t *raw_contents = NULL, *block_contents = NULL, *comp_contents = NULL;
-	size_t raw_contents_size = 0, block_contents_size = 0, comp_contents_size = 0;
+	uint8_t *raw_contents = NULL;
+	size_t raw_contents_size = 0;
+
+	block_builder_finish(b, &raw_contents, &raw_contents_size);
+	w->last_offset = w->pending_offset;
+	PROBE3(block__write__start, w, w->pending_offset, raw_contents_size);
+	size_t bytes_written = _mtbl_writer_writebuf(w, raw_contents, raw_contents_size,
+						     compression_type);
+	PROBE3(block__write__done, w, w->last_offset, bytes_written);
+	block_builder_reset(b);
+	free(raw_contents);
+
+	return (bytes_written);
+}
+
+static size_t
+_mtbl_writer_writebuf(struct mtbl_writer *w,
+		      uint8_t *raw_contents, size_t raw_contents_size,
+		      mtbl_compression_type compression_type)
+{
+	uint8_t *block_contents = NULL, *comp_contents = NULL;
+	size_t block_contents_size = 0, comp_contents_size = 0;
 	snappy_status res;
 	int zret;
 	z_stream zs;
 
-	block_builder_finish(b, &raw_contents, &raw_contents_size);
-
 	switch (compression_type) {
 	case MTBL_COMPRESSION_NONE:
 		block_contents = raw_contents;
@@ -264,14 +363,14 @@ _mtbl_writer_writeblock(struct mtbl_writer *w,
 		block_contents_size = comp_contents_size;
 		break;
 	case MTBL_COMPRESSION_ZLIB:
-		comp_contents_size = 2 * raw_contents_size;
-		comp_contents = my_malloc(comp_contents_size);
 		memset(&zs, 0, sizeof(zs));
 		zs.zalloc = Z_NULL;
 		zs.zfree = Z_NULL;
 		zs.opaque = Z_NULL;
 		zret = deflateInit(&zs, Z_DEFAULT_COMPRESSION);
 		assert(zret == Z_OK);
+		comp_contents_size = deflateBound(&zs, raw_contents_size);
+		comp_contents = my_malloc(comp_contents_size);
 		zs.avail_in = raw_contents_size;
 		zs.next_in = raw_contents;
 		zs.avail_out = comp_contents_size;
@@ -292,22 +391,20 @@ _mtbl_writer_writeblock(struct mtbl_writer *w,
 	const uint32_t crc = htole32(mtbl_crc32c(block_contents, block_contents_size));
 	const uint32_t len = htole32(block_contents_size);
 
-	_write_all(w->fd, (const uint8_t *) &len, sizeof(len));
-	_write_all(w->fd, (const uint8_t *) &crc, sizeof(crc));
-	_write_all(w->fd, block_contents, block_contents_size);
+	_mtbl_writer_write(w, (const uint8_t *) &len, sizeof(len));
+	_mtbl_writer_write(w, (const uint8_t *) &crc, sizeof(crc));
+	if (block_contents_size > 0)
+		_mtbl_writer_write(w, block_contents, block_contents_size);
 
 	const size_t bytes_written = (sizeof(len) + sizeof(crc) + block_contents_size);
-	w->last_offset = w->pending_offset;
 	w->pending_offset += bytes_written;
 
-	block_builder_reset(b);
-	free(raw_contents);
 	free(comp_contents);
 
 	return (bytes_written);
 }
 
-static void
+static mtbl_res
 _write_all(int fd, const uint8_t *buf, size_t size)
 {
 	assert(size > 0);
@@ -321,9 +418,30 @@ _write_all(int fd, const uint8_t *buf, size_t size)
 		if (bytes_written <= 0) {
 			fprintf(stderr, "%s: write() failed: %s\n", __func__,
 				strerror(errno));
-			assert(bytes_written > 0);
+			return (mtbl_res_failure);
 		}
 		buf += bytes_written;
 		size -= bytes_written;
 	}
+	return (mtbl_res_success);
+}
+
+static void
+_mtbl_writer_write(struct mtbl_writer *w, const uint8_t *buf, size_t size)
+{
+	if (w->res == mtbl_res_success)
+		w->res = w->write_func(w->write_clos, buf, size);
+}
+
+static mtbl_res
+_mtbl_writer_write_fd(void *clos, const uint8_t *buf, size_t size)
+{
+	return (_write_all(*((int *) clos), buf, size));
+}
+
+static mtbl_res
+_mtbl_writer_write_buf(void *clos, const uint8_t *buf, size_t size)
+{
+	mtbl_buf_append((struct mtbl_buf *) clos, buf, size);
+	return (mtbl_res_success);
 }
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures the time per operation of the library's internal kernels.
+ *
+ * Each kernel is first run with a doubling number of operations until a run
+ * takes at least the minimum run time, which also warms up the caches and
+ * the branch predictors. It is then run that many operations for each
+ * repetition, and the median and minimum times per operation are reported.
+ *
+ * With -j, the results are printed as JSON, which can be saved as a baseline.
+ * With -c, the medians are compared against those of a saved baseline, and
+ * the exit status is nonzero if any kernel is slower by more than the
+ * threshold.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "block.c"
+#include "block_builder.c"
+#include "heap.c"
+#include "bytes.h"
+
+#define NUM_VARINTS	4096
+#define NUM_KEYS	4096
+#define NUM_TARGETS	1024
+#define HEAP_SIZE	16
+#define BLOCK_SIZE	8192
+#define MAX_REPS	101
+
+static const char		*program_name;
+
+static unsigned			num_reps = 9;
+static double			min_run_ms = 10;
+static double			threshold = 10;
+static bool			json;
+static const char		*baseline_fname;
+
+static uint8_t			varints32[5 * NUM_VARINTS];
+static uint8_t			varints64[10 * NUM_VARINTS];
+static uint8_t			crc_buf[4096];
+static uint8_t			keys[NUM_KEYS][32];
+static size_t			len_keys[NUM_KEYS];
+static uint8_t			val[32];
+static struct block_builder	*builder;
+static struct block		*block;
+static struct block_iter	*block_it;
+static size_t			block_keys;
+static unsigned			targets[NUM_TARGETS];
+static ubuf			*separator;
+static struct heap		*heap;
+static uint64_t			heap_items[HEAP_SIZE];
+static uint64_t			increments[NUM_KEYS];
+
+/* results are accumulated here, so that the kernels are not optimized out */
+static volatile uint64_t	sink;
+
+struct kernel {
+	const char		*name;
+	size_t			bytes_per_op;
+	uint64_t		(*run)(uint64_t n_ops);
+};
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-r <REPS>] [-m <MS>] [-j] [-c <BASELINE>] [-t <PERCENT>] [KERNEL]...\n"
+		"Measures the time per operation of internal kernels, optionally only those\n"
+		"whose names start with one of the KERNEL arguments.\n"
+		"\n"
+		"  -r <REPS>      number of timed repetitions (default 9)\n"
+		"  -m <MS>        minimum duration of a repetition (default 10)\n"
+		"  -j             print the results as JSON\n"
+		"  -c <BASELINE>  compare against a JSON file saved with -j\n"
+		"  -t <PERCENT>   slowdown reported as a regression (default 10)\n",
+		program_name
+	);
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static uint64_t
+rng(uint64_t *state)
+{
+	uint64_t x = (*state += 0x9e3779b97f4a7c15ULL);
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (x ^ (x >> 31));
+}
+
+static int
+heap_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * The keys are sorted and unique, 17 to 25 bytes long, and share 6-byte
+ * prefixes in runs of 64, like the keys of a typical data block. The varints
+ * have uniformly distributed bit lengths.
+ */
+static void
+init_data(void)
+{
+	uint64_t state = 1;
+
+	uint8_t *p32 = varints32, *p64 = varints64;
+	for (size_t i = 0; i < NUM_VARINTS; i++) {
+		uint64_t v = rng(&state);
+		p32 += mtbl_varint_encode32(p32, (uint32_t) (v >> (v % 32)));
+		p64 += mtbl_varint_encode64(p64, v >> (v % 64));
+	}
+
+	for (size_t i = 0; i < sizeof(crc_buf); i++)
+		crc_buf[i] = (uint8_t) rng(&state);
+
+	for (unsigned i = 0; i < NUM_KEYS; i++) {
+		int len = snprintf((char *) keys[i], sizeof(keys[i]), "%06u:%010u%.*s",
+				   i / 64, i * 7919, (int) (i % 9), "xxxxxxxx");
+		len_keys[i] = (size_t) len;
+		increments[i] = rng(&state) % 1000;
+	}
+	memset(val, 'v', sizeof(val));
+
+	/* a full data block, and random keys to look up in it */
+	builder = block_builder_init(16);
+	while (block_keys < NUM_KEYS &&
+	       block_builder_current_size_estimate(builder) < BLOCK_SIZE)
+	{
+		block_builder_add(builder, keys[block_keys], len_keys[block_keys],
+				  val, sizeof(val));
+		block_keys++;
+	}
+	uint8_t *data;
+	size_t len_data;
+	block_builder_finish(builder, &data, &len_data);
+	block_builder_reset(builder);
+	block = block_init(data, len_data, true);
+	block_it = block_iter_init(block);
+	for (size_t i = 0; i < NUM_TARGETS; i++)
+		targets[i] = rng(&state) % block_keys;
+
+	separator = ubuf_init(64);
+
+	heap = heap_init(heap_cmp);
+	for (size_t i = 0; i < HEAP_SIZE; i++) {
+		heap_items[i] = rng(&state) % 1000;
+		heap_push(heap, &heap_items[i]);
+	}
+}
+
+static void
+free_data(void)
+{
+	block_builder_destroy(&builder);
+	block_iter_destroy(&block_it);
+	block_destroy(&block);
+	ubuf_destroy(&separator);
+	heap_destroy(&heap);
+}
+
+static uint64_t
+run_varint_decode32(uint64_t n_ops)
+{
+	const uint8_t *p = varints32;
+	uint64_t sum = 0;
+	for (uint64_t i = 0, j = 0; i < n_ops; i++) {
+		uint32_t v;
+		p += mtbl_varint_decode32(p, &v);
+		sum += v;
+		if (++j == NUM_VARINTS) {
+			p = varints32;
+			j = 0;
+		}
+	}
+	return (sum);
+}
+
+static uint64_t
+run_varint_decode64(uint64_t n_ops)
+{
+	const uint8_t *p = varints64;
+	uint64_t sum = 0;
+	for (uint64_t i = 0, j = 0; i < n_ops; i++) {
+		uint64_t v;
+		p += mtbl_varint_decode64(p, &v);
+		sum += v;
+		if (++j == NUM_VARINTS) {
+			p = varints64;
+			j = 0;
+		}
+	}
+	return (sum);
+}
+
+static uint64_t
+run_crc32c_64(uint64_t n_ops)
+{
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < n_ops; i++)
+		sum += mtbl_crc32c(&crc_buf[(i % 64) * 64], 64);
+	return (sum);
+}
+
+static uint64_t
+run_crc32c_4096(uint64_t n_ops)
+{
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < n_ops; i++)
+		sum += mtbl_crc32c(crc_buf, sizeof(crc_buf));
+	return (sum);
+}
+
+static uint64_t
+run_block_builder_add(uint64_t n_ops)
+{
+	for (uint64_t i = 0, j = 0; i < n_ops; i++) {
+		block_builder_add(builder, keys[j], len_keys[j], val, sizeof(val));
+		if (++j == block_keys) {
+			block_builder_reset(builder);
+			j = 0;
+		}
+	}
+	block_builder_reset(builder);
+	return (0);
+}
+
+static uint64_t
+run_block_iter_seek(uint64_t n_ops)
+{
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < n_ops; i++) {
+		unsigned k = targets[i % NUM_TARGETS];
+		block_iter_seek(block_it, keys[k], len_keys[k]);
+		sum += block_iter_valid(block_it);
+	}
+	return (sum);
+}
+
+static uint64_t
+run_block_iter_next(uint64_t n_ops)
+{
+	const uint8_t *key = NULL, *v = NULL;
+	size_t len_key = 0, len_v = 0;
+	uint64_t sum = 0;
+
+	block_iter_seek_to_first(block_it);
+	for (uint64_t i = 0; i < n_ops; i++) {
+		if (!block_iter_get(block_it, &key, &len_key, &v, &len_v)) {
+			/* wrap around, unless the block is empty */
+			block_iter_seek_to_first(block_it);
+			if (!block_iter_get(block_it, &key, &len_key, &v, &len_v))
+				break;
+		}
+		sum += len_key;
+		block_iter_next(block_it);
+	}
+	return (sum);
+}
+
+static uint64_t
+run_bytes_compare(uint64_t n_ops)
+{
+	uint64_t sum = 0;
+	for (uint64_t i = 0, j = 0; i < n_ops; i++) {
+		sum += bytes_compare(keys[j], len_keys[j], keys[j + 1], len_keys[j + 1]);
+		if (++j == NUM_KEYS - 1)
+			j = 0;
+	}
+	return (sum);
+}
+
+static uint64_t
+run_bytes_shortest_separator(uint64_t n_ops)
+{
+	uint64_t sum = 0;
+	for (uint64_t i = 0, j = 0; i < n_ops; i++) {
+		ubuf_reset(separator);
+		ubuf_append(separator, keys[j], len_keys[j]);
+		bytes_shortest_separator(separator, keys[j + 1], len_keys[j + 1]);
+		sum += ubuf_size(separator);
+		if (++j == NUM_KEYS - 1)
+			j = 0;
+	}
+	return (sum);
+}
+
+/* the smallest item is advanced and put back, as the merger does */
+static uint64_t
+run_heap_replace(uint64_t n_ops)
+{
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < n_ops; i++) {
+		uint64_t *item = heap_peek(heap);
+		*item += increments[i % NUM_KEYS];
+		sum += *(uint64_t *) heap_replace(heap, item);
+	}
+	return (sum);
+}
+
+static const struct kernel kernels[] = {
+	{ "varint_decode32",		0,	run_varint_decode32 },
+	{ "varint_decode64",		0,	run_varint_decode64 },
+	{ "crc32c/64",			64,	run_crc32c_64 },
+	{ "crc32c/4096",		4096,	run_crc32c_4096 },
+	{ "block_builder_add",		0,	run_block_builder_add },
+	{ "block_iter_seek",		0,	run_block_iter_seek },
+	{ "block_iter_next",		0,	run_block_iter_next },
+	{ "bytes_compare",		0,	run_bytes_compare },
+	{ "bytes_shortest_separator",	0,	run_bytes_shortest_separator },
+	{ "heap_replace",		0,	run_heap_replace },
+};
+
+#define NUM_KERNELS	(sizeof(kernels) / sizeof(kernels[0]))
+
+struct result {
+	double			median;
+	double			min;
+	double			baseline;
+	bool			selected;
+};
+
+static struct result		results[NUM_KERNELS];
+
+static int
+compare_double(const void *va, const void *vb)
+{
+	double a = *(const double *) va, b = *(const double *) vb;
+	return (a < b ? -1 : a > b);
+}
+
+static double
+time_run(const struct kernel *k, uint64_t n_ops)
+{
+	uint64_t t0 = now_ns();
+	sink += k->run(n_ops);
+	return ((double) (now_ns() - t0));
+}
+
+static void
+measure(const struct kernel *k, struct result *res)
+{
+	double times[MAX_REPS];
+	uint64_t n_ops = 1;
+
+	/* calibrate, which also serves as the warmup */
+	while (time_run(k, n_ops) < min_run_ms * 1E6)
+		n_ops *= 2;
+	time_run(k, n_ops);
+
+	for (unsigned i = 0; i < num_reps; i++)
+		times[i] = time_run(k, n_ops) / n_ops;
+	qsort(times, num_reps, sizeof(double), compare_double);
+	res->median = times[num_reps / 2];
+	res->min = times[0];
+}
+
+/* Returns the baseline median of kernel 'name', or 0 if there is none. */
+static double
+baseline_value(const char *text, const char *name)
+{
+	char needle[64];
+	snprintf(needle, sizeof(needle), "\"name\":\"%s\"", name);
+	const char *p = strstr(text, needle);
+	if (p == NULL)
+		return (0);
+	p = strstr(p, "\"ns_per_op\":");
+	if (p == NULL)
+		return (0);
+	return (strtod(p + strlen("\"ns_per_op\":"), NULL));
+}
+
+static void
+load_baseline(void)
+{
+	FILE *fp = fopen(baseline_fname, "r");
+	if (fp == NULL) {
+		perror(baseline_fname);
+		exit(EXIT_FAILURE);
+	}
+	fseek(fp, 0, SEEK_END);
+	long len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char *text = my_calloc(1, len + 1);
+	if (fread(text, 1, len, fp) != (size_t) len) {
+		perror(baseline_fname);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+
+	for (size_t i = 0; i < NUM_KERNELS; i++)
+		results[i].baseline = baseline_value(text, kernels[i].name);
+	free(text);
+}
+
+static bool
+regressed(const struct result *res)
+{
+	return (res->baseline > 0 && res->median > res->baseline * (1 + threshold / 100));
+}
+
+static bool
+print_results(void)
+{
+	bool any_regressed = false;
+
+	if (json) {
+		printf("{\"kernels\":[\n");
+	} else {
+		printf("%-26s %10s %10s %10s", "kernel", "ns/op", "min ns/op", "MB/s");
+		if (baseline_fname != NULL)
+			printf(" %10s %8s", "baseline", "change");
+		printf("\n");
+	}
+
+	bool first = true;
+	for (size_t i = 0; i < NUM_KERNELS; i++) {
+		const struct kernel *k = &kernels[i];
+		const struct result *res = &results[i];
+		if (!res->selected)
+			continue;
+		any_regressed |= regressed(res);
+
+		if (json) {
+			printf("%s {\"name\":\"%s\",\"ns_per_op\":%.3f,\"min_ns_per_op\":%.3f",
+			       first ? "" : ",\n", k->name, res->median, res->min);
+			if (k->bytes_per_op > 0)
+				printf(",\"mb_per_sec\":%.1f", k->bytes_per_op * 1E3 / res->median);
+			if (baseline_fname != NULL) {
+				printf(",\"baseline_ns_per_op\":%.3f,\"regression\":%s",
+				       res->baseline, regressed(res) ? "true" : "false");
+			}
+			printf("}");
+			first = false;
+			continue;
+		}
+
+		printf("%-26s %10.2f %10.2f", k->name, res->median, res->min);
+		if (k->bytes_per_op > 0)
+			printf(" %10.1f", k->bytes_per_op * 1E3 / res->median);
+		else
+			printf(" %10s", "-");
+		if (baseline_fname != NULL && res->baseline > 0) {
+			printf(" %10.2f %+7.1f%%%s", res->baseline,
+			       100 * (res->median / res->baseline - 1),
+			       regressed(res) ? "  REGRESSION" : "");
+		} else if (baseline_fname != NULL) {
+			printf(" %10s %8s", "-", "-");
+		}
+		printf("\n");
+	}
+	if (json)
+		printf("\n]}\n");
+	return (any_regressed);
+}
+
+static bool
+selected(const char *name, int argc, char **argv)
+{
+	if (argc == 0)
+		return (true);
+	for (int i = 0; i < argc; i++) {
+		if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+			return (true);
+	}
+	return (false);
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+	program_name = argv[0];
+
+	while ((c = getopt(argc, argv, "c:jm:r:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			baseline_fname = optarg;
+			break;
+		case 'j':
+			json = true;
+			break;
+		case 'm':
+			min_run_ms = strtod(optarg, NULL);
+			break;
+		case 'r':
+			num_reps = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			threshold = strtod(optarg, NULL);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (num_reps == 0 || num_reps > MAX_REPS || min_run_ms <= 0 || threshold < 0)
+		usage();
+
+	init_data();
+	if (baseline_fname != NULL)
+		load_baseline();
+
+	for (size_t i = 0; i < NUM_KERNELS; i++) {
+		results[i].selected = selected(kernels[i].name, argc - optind, argv + optind);
+		if (results[i].selected)
+			measure(&kernels[i], &results[i]);
+	}
+	bool any_regressed = print_results();
+
+	free_data();
+	if (any_regressed)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
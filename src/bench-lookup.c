@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Measures the throughput of random exact-match lookups on a single shared
+ * reader, or on a merger of several readers, as the number of threads issuing
+ * them grows. Since readers share no mutable state, the throughput should
+ * scale with the number of cores; a flattening curve points at contention.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define MAX_THREADS	256
+#define MAX_SOURCES	16
+
+static const char		*program_name;
+
+static unsigned			num_keys = 1000000;
+static unsigned			num_ops = 200000;
+static unsigned			max_threads;
+static unsigned			num_sources = 1;
+static mtbl_compression_type	compression = MTBL_COMPRESSION_ZLIB;
+
+static struct mtbl_reader	*readers[MAX_SOURCES];
+static struct mtbl_merger	*merger;
+static const struct mtbl_source	*source;
+
+struct worker {
+	pthread_t		thr;
+	unsigned		seed;
+	unsigned		found;
+};
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-k <KEYS>] [-n <OPS>] [-t <THREADS>] [-s <SOURCES>] [-c <none|snappy|zlib>]\n"
+		"Measures random lookup throughput on a shared source from 1 to <THREADS>\n"
+		"threads, each performing <OPS> lookups. With more than one source, the\n"
+		"lookups are made on a merger of <SOURCES> readers.\n",
+		program_name
+	);
+	exit(EXIT_FAILURE);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1E9);
+}
+
+static mtbl_res
+merge_func(void *clos,
+	   const uint8_t *key, size_t len_key,
+	   size_t n_vals,
+	   const uint8_t * const *vals, const size_t *len_vals,
+	   struct mtbl_buf *merged_val)
+{
+	mtbl_buf_append(merged_val, vals[0], len_vals[0]);
+	return (mtbl_res_success);
+}
+
+/* source i holds the keys k with k % num_sources == i */
+static void
+init_sources(void)
+{
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_compression(wopt, compression);
+	char val[65];
+	memset(val, 'v', sizeof(val) - 1);
+	val[sizeof(val) - 1] = '\0';
+
+	for (unsigned i = 0; i < num_sources; i++) {
+		readers[i] = test_reader_init(wopt, NULL, i, num_keys, num_sources,
+					      test_val_str, val);
+		assert(readers[i] != NULL);
+	}
+	mtbl_writer_options_destroy(&wopt);
+
+	if (num_sources == 1) {
+		source = mtbl_reader_source(readers[0]);
+		return;
+	}
+	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+	mtbl_merger_options_set_merge_multi_func(mopt, merge_func, NULL);
+	merger = mtbl_merger_init(mopt);
+	mtbl_merger_options_destroy(&mopt);
+	for (unsigned i = 0; i < num_sources; i++)
+		mtbl_merger_add_source(merger, mtbl_reader_source(readers[i]));
+	source = mtbl_merger_source(merger);
+}
+
+static void *
+worker_thr(void *arg)
+{
+	struct worker *wk = (struct worker *) arg;
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+
+	for (unsigned i = 0; i < num_ops; i++) {
+		char k[16];
+		test_fmt_key(k, rand_r(&wk->seed) % num_keys);
+		struct mtbl_iter *it = mtbl_source_get(source, (const uint8_t *) k, strlen(k));
+		if (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success)
+			wk->found++;
+		mtbl_iter_destroy(&it);
+	}
+	return (NULL);
+}
+
+static double
+run(unsigned n_threads)
+{
+	struct worker workers[n_threads];
+	double t0 = now();
+
+	for (unsigned i = 0; i < n_threads; i++) {
+		workers[i].seed = i + 1;
+		workers[i].found = 0;
+		pthread_create(&workers[i].thr, NULL, worker_thr, &workers[i]);
+	}
+	for (unsigned i = 0; i < n_threads; i++) {
+		pthread_join(workers[i].thr, NULL);
+		assert(workers[i].found == num_ops);
+	}
+	return ((double) n_threads * num_ops / (now() - t0));
+}
+
+/* doubles the thread count, ending with exactly max_threads */
+static unsigned
+next_threads(unsigned n)
+{
+	if (n == max_threads)
+		return (n + 1);
+	if (2 * n > max_threads)
+		return (max_threads);
+	return (2 * n);
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+	program_name = argv[0];
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	max_threads = ncpu > 0 ? (unsigned) ncpu : 1;
+
+	while ((c = getopt(argc, argv, "c:k:n:s:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			if (strcmp(optarg, "none") == 0)
+				compression = MTBL_COMPRESSION_NONE;
+			else if (strcmp(optarg, "snappy") == 0)
+				compression = MTBL_COMPRESSION_SNAPPY;
+			else if (strcmp(optarg, "zlib") == 0)
+				compression = MTBL_COMPRESSION_ZLIB;
+			else
+				usage();
+			break;
+		case 'k':
+			num_keys = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			num_ops = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			num_sources = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (num_keys == 0 || num_keys > TEST_MAX_KEYS || num_ops == 0 ||
+	    max_threads == 0 || max_threads > MAX_THREADS ||
+	    num_sources == 0 || num_sources > MAX_SOURCES)
+	{
+		usage();
+	}
+
+	init_sources();
+	printf("%u keys, %u source(s), %u lookups per thread\n\n",
+	       num_keys, num_sources, num_ops);
+	printf("threads      lookups/sec   speedup   efficiency\n");
+
+	double base = 0;
+	for (unsigned n = 1; n <= max_threads; n = next_threads(n)) {
+		double rate = run(n);
+		if (n == 1)
+			base = rate;
+		printf("%7u %16.0f %8.2fx %11.1f%%\n",
+		       n, rate, rate / base, 100.0 * rate / base / n);
+	}
+
+	mtbl_merger_destroy(&merger);
+	for (unsigned i = 0; i < num_sources; i++)
+		mtbl_reader_destroy(&readers[i]);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,703 @@
+/*
+ * Copyright (c) 2012 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#define MAX_KEY_SIZE		1024
+#define MAX_VAL_SIZE		(1024 * 1024)
+#define VAL_TABLE_SIZE		65536
+#define MAX_RESULTS		64
+
+/*
+ * Entry i of the synthetic dataset has the key
+ *
+ *	[prefix of group i * num_prefixes / num_entries] [i, big endian] [filler]
+ *
+ * so that the keys are generated in sorted order, and any key can be
+ * regenerated from its index for lookups. Key and value sizes are drawn
+ * uniformly from their ranges, as a function of the index.
+ */
+
+static const char		*program_name;
+
+static uint64_t			num_entries = 1000000;
+static uint64_t			num_ops = 100000;
+static size_t			key_min = 16, key_max = 16;
+static size_t			val_min = 100, val_max = 100;
+static size_t			prefix_len;
+static uint64_t			num_prefixes;
+static mtbl_compression_type	compression = MTBL_COMPRESSION_ZLIB;
+static size_t			block_size = 8192;
+static double			zipf_theta;
+static uint64_t			range_len = 100;
+static size_t			max_fan_in = 8;
+static size_t			sorter_memory;
+static const char		*temp_dir;
+static const char		*benchmarks = "write,scan,get,prefix,range,merge,sort";
+static uint64_t			seed = 1;
+static bool			json;
+
+static uint8_t			val_table[VAL_TABLE_SIZE + MAX_VAL_SIZE];
+static uint64_t			rng_state;
+
+struct result {
+	char			name[32];
+	uint64_t		ops;
+	uint64_t		bytes;
+	double			seconds;
+	uint64_t		*lat;
+	size_t			n_lat;
+};
+
+static struct result		results[MAX_RESULTS];
+static size_t			n_results;
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTION]...\n"
+		"Generates a synthetic dataset and measures MTBL performance on it.\n"
+		"\n"
+		"  -n <ENTRIES>       number of entries (default 1000000)\n"
+		"  -o <OPS>           number of random operations (default 100000)\n"
+		"  -k <MIN[-MAX]>     key size in bytes (default 16)\n"
+		"  -v <MIN[-MAX]>     value size in bytes (default 100)\n"
+		"  -p <LEN>:<COUNT>   share COUNT distinct key prefixes of LEN bytes\n"
+		"  -c <COMPRESSION>   none, snappy or zlib (default zlib)\n"
+		"  -b <SIZE>          data block size (default 8192)\n"
+		"  -z <THETA>         Zipfian access skew, 0 <= THETA < 1 (default 0, uniform)\n"
+		"  -r <LEN>           number of keys per range scan (default 100)\n"
+		"  -f <FAN-IN>        maximum merger fan-in (default 8)\n"
+		"  -m <BYTES>         sorter memory limit\n"
+		"  -d <DIR>           directory for temporary files (default $TMPDIR or /tmp)\n"
+		"  -B <LIST>          benchmarks to run (default %s)\n"
+		"  -s <SEED>          random seed (default 1)\n"
+		"  -j                 print the results as JSON\n"
+		"\n"
+		"See mtbl_bench(1) for details.\n",
+		program_name, benchmarks
+	);
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* splitmix64 */
+static inline uint64_t
+mix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (x ^ (x >> 31));
+}
+
+static inline uint64_t
+rng_next(void)
+{
+	rng_state += 1;
+	return (mix(rng_state));
+}
+
+static inline size_t
+size_in_range(uint64_t h, size_t min, size_t max)
+{
+	return (min + (max > min ? h % (max - min + 1) : 0));
+}
+
+static size_t
+make_key(uint8_t *key, uint64_t i)
+{
+	size_t len = size_in_range(mix(seed ^ (i << 1)), key_min, key_max);
+	size_t pos = 0;
+
+	if (num_prefixes > 0) {
+		char group[32];
+		snprintf(group, sizeof(group), "%0*" PRIx64,
+			 (int) prefix_len, i * num_prefixes / num_entries);
+		memcpy(key, group, prefix_len);
+		pos = prefix_len;
+	}
+	for (int j = 7; j >= 0; j--)
+		key[pos++] = (uint8_t) (i >> (8 * j));
+	for (uint64_t h = mix(seed + i); pos < len; pos++, h = mix(h))
+		key[pos] = 'a' + h % 26;
+	return (len);
+}
+
+/* Returns a pointer into the value table, which is filled with text. */
+static const uint8_t *
+make_val(uint64_t i, size_t *len_val)
+{
+	uint64_t h = mix(seed ^ (i << 1 | 1));
+	*len_val = size_in_range(h, val_min, val_max);
+	return (&val_table[(h >> 32) % VAL_TABLE_SIZE]);
+}
+
+static void
+init_val_table(void)
+{
+	static const char words[] = "lorem ipsum dolor sit amet consectetur adipiscing elit ";
+	for (size_t i = 0; i < sizeof(val_table); i++) {
+		uint64_t h = mix(i / 8);
+		val_table[i] = (h & 3) == 0 ? (uint8_t) ('A' + h % 26) : (uint8_t) words[i % (sizeof(words) - 1)];
+	}
+}
+
+/*
+ * Zipfian index generator, as in Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases". The ranks are scattered over the
+ * dataset so that the popular keys are not adjacent.
+ */
+static double			zipf_zetan, zipf_alpha, zipf_eta;
+
+static void
+init_zipf(void)
+{
+	if (zipf_theta == 0)
+		return;
+	double zeta2 = 1.0 + pow(0.5, zipf_theta);
+	zipf_zetan = 0;
+	for (uint64_t i = 1; i <= num_entries; i++)
+		zipf_zetan += 1.0 / pow((double) i, zipf_theta);
+	zipf_alpha = 1.0 / (1.0 - zipf_theta);
+	zipf_eta = (1.0 - pow(2.0 / num_entries, 1.0 - zipf_theta)) /
+		(1.0 - zeta2 / zipf_zetan);
+}
+
+static uint64_t
+choose_index(void)
+{
+	if (zipf_theta == 0)
+		return (rng_next() % num_entries);
+
+	double u = (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+	double uz = u * zipf_zetan;
+	uint64_t rank;
+	if (uz < 1.0)
+		rank = 0;
+	else if (uz < 1.0 + pow(0.5, zipf_theta))
+		rank = 1;
+	else
+		rank = (uint64_t) (num_entries * pow(zipf_eta * u - zipf_eta + 1.0, zipf_alpha));
+	if (rank >= num_entries)
+		rank = num_entries - 1;
+	return (mix(rank ^ 0x5bd1e995) % num_entries);
+}
+
+/* Open an anonymous temporary file. */
+static int
+temp_file(void)
+{
+	char fname[4096];
+	snprintf(fname, sizeof(fname), "%s/mtbl_bench.XXXXXX", temp_dir);
+	int fd = mkstemp(fname);
+	if (fd < 0) {
+		perror(fname);
+		exit(EXIT_FAILURE);
+	}
+	unlink(fname);
+	return (fd);
+}
+
+static struct mtbl_writer *
+writer_init(int fd)
+{
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_compression(wopt, compression);
+	mtbl_writer_options_set_block_size(wopt, block_size);
+	struct mtbl_writer *w = mtbl_writer_init_fd(fd, wopt);
+	mtbl_writer_options_destroy(&wopt);
+	assert(w != NULL);
+	return (w);
+}
+
+static struct result *
+result_add(const char *name, size_t n_lat)
+{
+	assert(n_results < MAX_RESULTS);
+	struct result *res = &results[n_results++];
+	snprintf(res->name, sizeof(res->name), "%s", name);
+	if (n_lat > 0)
+		res->lat = calloc(n_lat, sizeof(uint64_t));
+	return (res);
+}
+
+static bool
+enabled(const char *name)
+{
+	size_t len = strlen(name);
+	for (const char *p = benchmarks; p != NULL; p = strchr(p, ',')) {
+		if (*p == ',')
+			p++;
+		if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * Write the entries whose index is congruent to 'part' modulo 'n_parts' to a
+ * new temporary file, and open it.
+ */
+static struct mtbl_reader *
+write_table(uint64_t part, uint64_t n_parts, struct result *res)
+{
+	uint8_t key[MAX_KEY_SIZE];
+	int fd = temp_file();
+	struct mtbl_writer *w = writer_init(fd);
+
+	uint64_t t0 = now_ns();
+	for (uint64_t i = part; i < num_entries; i += n_parts) {
+		size_t len_key = make_key(key, i), len_val;
+		const uint8_t *val = make_val(i, &len_val);
+		mtbl_res r = mtbl_writer_add(w, key, len_key, val, len_val);
+		assert(r == mtbl_res_success);
+		if (res != NULL) {
+			res->ops++;
+			res->bytes += len_key + len_val;
+		}
+	}
+	mtbl_writer_destroy(&w);
+	if (res != NULL)
+		res->seconds = (now_ns() - t0) / 1E9;
+
+	struct mtbl_reader *r = mtbl_reader_init_fd(fd, NULL);
+	assert(r != NULL);
+	close(fd);
+	return (r);
+}
+
+static void
+bench_scan(const char *name, const struct mtbl_source *s)
+{
+	struct result *res = result_add(name, 0);
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+
+	uint64_t t0 = now_ns();
+	struct mtbl_iter *it = mtbl_source_iter(s);
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		res->ops++;
+		res->bytes += len_key + len_val;
+	}
+	mtbl_iter_destroy(&it);
+	res->seconds = (now_ns() - t0) / 1E9;
+}
+
+static void
+bench_get(const char *name, const struct mtbl_source *s, uint64_t n_ops)
+{
+	struct result *res = result_add(name, n_ops);
+	uint8_t k[MAX_KEY_SIZE];
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+
+	uint64_t t0 = now_ns();
+	for (uint64_t i = 0; i < n_ops; i++) {
+		size_t len_k = make_key(k, choose_index());
+		uint64_t t = now_ns();
+		struct mtbl_iter *it = mtbl_source_get(s, k, len_k);
+		mtbl_res r = mtbl_iter_next(it, &key, &len_key, &val, &len_val);
+		assert(r == mtbl_res_success);
+		res->bytes += len_key + len_val;
+		mtbl_iter_destroy(&it);
+		res->lat[res->n_lat++] = now_ns() - t;
+	}
+	res->ops = n_ops;
+	res->seconds = (now_ns() - t0) / 1E9;
+}
+
+/*
+ * Scan the prefix group of random entries. Without shared prefixes, the
+ * prefix is the key up to the last byte of the index, which covers up to 256
+ * consecutive entries.
+ */
+static void
+bench_prefix(const struct mtbl_source *s, uint64_t n_ops)
+{
+	struct result *res = result_add("prefix", n_ops);
+	uint8_t k[MAX_KEY_SIZE];
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	size_t len_prefix = num_prefixes > 0 ? prefix_len : 7;
+
+	uint64_t t0 = now_ns();
+	for (uint64_t i = 0; i < n_ops; i++) {
+		make_key(k, choose_index());
+		uint64_t t = now_ns();
+		struct mtbl_iter *it = mtbl_source_get_prefix(s, k, len_prefix);
+		while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success)
+			res->bytes += len_key + len_val;
+		mtbl_iter_destroy(&it);
+		res->lat[res->n_lat++] = now_ns() - t;
+	}
+	res->ops = n_ops;
+	res->seconds = (now_ns() - t0) / 1E9;
+}
+
+static void
+bench_range(const struct mtbl_source *s, uint64_t n_ops)
+{
+	struct result *res = result_add("range", n_ops);
+	uint8_t k0[MAX_KEY_SIZE], k1[MAX_KEY_SIZE];
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+
+	uint64_t t0 = now_ns();
+	for (uint64_t i = 0; i < n_ops; i++) {
+		uint64_t first = choose_index();
+		uint64_t last = first + range_len - 1;
+		if (last >= num_entries)
+			last = num_entries - 1;
+		size_t len_k0 = make_key(k0, first);
+		size_t len_k1 = make_key(k1, last);
+		uint64_t t = now_ns();
+		struct mtbl_iter *it = mtbl_source_get_range(s, k0, len_k0, k1, len_k1);
+		while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success)
+			res->bytes += len_key + len_val;
+		mtbl_iter_destroy(&it);
+		res->lat[res->n_lat++] = now_ns() - t;
+	}
+	res->ops = n_ops;
+	res->seconds = (now_ns() - t0) / 1E9;
+}
+
+/* doubles the fan-in, ending with exactly max_fan_in */
+static size_t
+next_fan_in(size_t n)
+{
+	if (n == max_fan_in)
+		return (n + 1);
+	if (2 * n > max_fan_in)
+		return (max_fan_in);
+	return (2 * n);
+}
+
+/* The dataset split across 1, 2, 4, ... max_fan_in tables. */
+static void
+bench_merge(void)
+{
+	for (size_t fan_in = 1; fan_in <= max_fan_in; fan_in = next_fan_in(fan_in)) {
+		struct mtbl_reader *readers[fan_in];
+		char name[32];
+
+		struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+		mtbl_merger_options_set_precedence(mopt, true);
+		struct mtbl_merger *m = mtbl_merger_init(mopt);
+		mtbl_merger_options_destroy(&mopt);
+		for (size_t i = 0; i < fan_in; i++) {
+			readers[i] = write_table(i, fan_in, NULL);
+			mtbl_merger_add_source(m, mtbl_reader_source(readers[i]));
+		}
+
+		snprintf(name, sizeof(name), "merge_scan/%zu", fan_in);
+		bench_scan(name, mtbl_merger_source(m));
+		snprintf(name, sizeof(name), "merge_get/%zu", fan_in);
+		bench_get(name, mtbl_merger_source(m), num_ops);
+
+		mtbl_merger_destroy(&m);
+		for (size_t i = 0; i < fan_in; i++)
+			mtbl_reader_destroy(&readers[i]);
+	}
+}
+
+static mtbl_res
+merge_first(void *clos,
+	    const uint8_t *key, size_t len_key,
+	    size_t n_vals,
+	    const uint8_t * const *vals, const size_t *len_vals,
+	    struct mtbl_buf *merged_val)
+{
+	mtbl_buf_append(merged_val, vals[0], len_vals[0]);
+	return (mtbl_res_success);
+}
+
+static uint64_t
+gcd(uint64_t a, uint64_t b)
+{
+	while (b != 0) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return (a);
+}
+
+/* The entries added to a sorter in a pseudo-random order, then written out. */
+static void
+bench_sort(void)
+{
+	struct result *res_add = result_add("sort_add", 0);
+	struct result *res_write = result_add("sort_write", 0);
+	uint8_t key[MAX_KEY_SIZE];
+
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_multi_func(sopt, merge_first, NULL);
+	mtbl_sorter_options_set_temp_dir(sopt, temp_dir);
+	if (sorter_memory > 0)
+		mtbl_sorter_options_set_max_memory(sopt, sorter_memory);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+
+	/* i -> i * stride mod n is a permutation when stride is coprime to n */
+	uint64_t stride = (mix(seed) % num_entries) | 1;
+	while (gcd(stride, num_entries) != 1)
+		stride += 2;
+
+	uint64_t t0 = now_ns();
+	for (uint64_t i = 0, j = 0; i < num_entries; i++) {
+		size_t len_key = make_key(key, j), len_val;
+		const uint8_t *val = make_val(j, &len_val);
+		mtbl_res r = mtbl_sorter_add(s, key, len_key, val, len_val);
+		assert(r == mtbl_res_success);
+		res_add->ops++;
+		res_add->bytes += len_key + len_val;
+		j = (j + stride) % num_entries;
+	}
+	res_add->seconds = (now_ns() - t0) / 1E9;
+
+	int fd = temp_file();
+	struct mtbl_writer *w = writer_init(fd);
+	t0 = now_ns();
+	mtbl_res r = mtbl_sorter_write(s, w);
+	assert(r == mtbl_res_success);
+	mtbl_writer_destroy(&w);
+	res_write->seconds = (now_ns() - t0) / 1E9;
+	res_write->ops = res_add->ops;
+	res_write->bytes = res_add->bytes;
+	close(fd);
+	mtbl_sorter_destroy(&s);
+}
+
+static int
+compare_u64(const void *va, const void *vb)
+{
+	uint64_t a = *(const uint64_t *) va, b = *(const uint64_t *) vb;
+	return (a < b ? -1 : a > b);
+}
+
+static uint64_t
+percentile(const struct result *res, double q)
+{
+	size_t i = (size_t) (q * res->n_lat);
+	if (i >= res->n_lat)
+		i = res->n_lat - 1;
+	return (res->lat[i]);
+}
+
+static void
+print_human(void)
+{
+	printf("%-16s %10s %9s %13s %9s %10s %10s %10s\n",
+	       "benchmark", "ops", "seconds", "ops/sec", "MB/s",
+	       "p50 us", "p99 us", "p999 us");
+	for (size_t i = 0; i < n_results; i++) {
+		const struct result *res = &results[i];
+		printf("%-16s %10" PRIu64 " %9.3f %13.0f %9.1f",
+		       res->name, res->ops, res->seconds,
+		       res->ops / res->seconds, res->bytes / res->seconds / 1E6);
+		if (res->n_lat > 0) {
+			printf(" %10.1f %10.1f %10.1f\n",
+			       percentile(res, 0.50) / 1E3,
+			       percentile(res, 0.99) / 1E3,
+			       percentile(res, 0.999) / 1E3);
+		} else {
+			printf(" %10s %10s %10s\n", "-", "-", "-");
+		}
+	}
+}
+
+static void
+print_json(void)
+{
+	static const char *compressions[] = { "none", "snappy", "zlib" };
+
+	printf("{\"config\":{\"entries\":%" PRIu64 ",\"ops\":%" PRIu64
+	       ",\"key_size\":[%zu,%zu],\"val_size\":[%zu,%zu]"
+	       ",\"prefix_len\":%zu,\"prefixes\":%" PRIu64
+	       ",\"compression\":\"%s\",\"block_size\":%zu"
+	       ",\"zipf_theta\":%g,\"range_len\":%" PRIu64 ",\"seed\":%" PRIu64 "},\n",
+	       num_entries, num_ops, key_min, key_max, val_min, val_max,
+	       prefix_len, num_prefixes, compressions[compression], block_size,
+	       zipf_theta, range_len, seed);
+	printf(" \"results\":[\n");
+	for (size_t i = 0; i < n_results; i++) {
+		const struct result *res = &results[i];
+		printf("  {\"name\":\"%s\",\"ops\":%" PRIu64 ",\"bytes\":%" PRIu64
+		       ",\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.3f",
+		       res->name, res->ops, res->bytes, res->seconds,
+		       res->ops / res->seconds, res->bytes / res->seconds / 1E6);
+		if (res->n_lat > 0) {
+			printf(",\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64
+			       ",\"p999_ns\":%" PRIu64,
+			       percentile(res, 0.50), percentile(res, 0.99),
+			       percentile(res, 0.999));
+		}
+		printf("}%s\n", i + 1 < n_results ? "," : "");
+	}
+	printf(" ]}\n");
+}
+
+static void
+parse_range(const char *arg, size_t *min, size_t *max)
+{
+	char *end;
+	*min = *max = strtoul(arg, &end, 0);
+	if (*end == '-')
+		*max = strtoul(end + 1, &end, 0);
+	if (*end != '\0' || *max < *min)
+		usage();
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+	program_name = argv[0];
+	temp_dir = getenv("TMPDIR");
+	if (temp_dir == NULL)
+		temp_dir = "/tmp";
+
+	while ((c = getopt(argc, argv, "B:b:c:d:f:jk:m:n:o:p:r:s:v:z:")) != -1) {
+		switch (c) {
+		case 'B':
+			benchmarks = optarg;
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			if (strcmp(optarg, "none") == 0)
+				compression = MTBL_COMPRESSION_NONE;
+			else if (strcmp(optarg, "snappy") == 0)
+				compression = MTBL_COMPRESSION_SNAPPY;
+			else if (strcmp(optarg, "zlib") == 0)
+				compression = MTBL_COMPRESSION_ZLIB;
+			else
+				usage();
+			break;
+		case 'd':
+			temp_dir = optarg;
+			break;
+		case 'f':
+			max_fan_in = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			json = true;
+			break;
+		case 'k':
+			parse_range(optarg, &key_min, &key_max);
+			break;
+		case 'm':
+			sorter_memory = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			num_entries = strtoull(optarg, NULL, 0);
+			break;
+		case 'o':
+			num_ops = strtoull(optarg, NULL, 0);
+			break;
+		case 'p':
+			if (sscanf(optarg, "%zu:%" SCNu64, &prefix_len, &num_prefixes) != 2)
+				usage();
+			break;
+		case 'r':
+			range_len = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			parse_range(optarg, &val_min, &val_max);
+			break;
+		case 'z':
+			zipf_theta = strtod(optarg, NULL);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	/* the prefix group must fit in the prefix, and the index after it */
+	if (num_prefixes > 0 &&
+	    (prefix_len == 0 || prefix_len > 16 ||
+	     (prefix_len < 16 && num_prefixes > (1ULL << (4 * prefix_len)))))
+	{
+		usage();
+	}
+	if (num_prefixes == 0)
+		prefix_len = 0;
+	if (num_entries == 0 || num_ops == 0 || range_len == 0 || max_fan_in == 0 ||
+	    key_min < prefix_len + 8 || key_max > MAX_KEY_SIZE || val_max > MAX_VAL_SIZE ||
+	    zipf_theta < 0 || zipf_theta >= 1)
+	{
+		usage();
+	}
+
+	rng_state = mix(seed);
+	init_val_table();
+	init_zipf();
+
+	struct mtbl_reader *r = write_table(0, 1, enabled("write") ? result_add("write", 0) : NULL);
+
+	const struct mtbl_source *s = mtbl_reader_source(r);
+	if (enabled("scan"))
+		bench_scan("scan", s);
+	if (enabled("get"))
+		bench_get("get", s, num_ops);
+	if (enabled("prefix"))
+		bench_prefix(s, num_ops / 10 > 0 ? num_ops / 10 : 1);
+	if (enabled("range"))
+		bench_range(s, num_ops / 10 > 0 ? num_ops / 10 : 1);
+	mtbl_reader_destroy(&r);
+
+	if (enabled("merge"))
+		bench_merge();
+	if (enabled("sort"))
+		bench_sort();
+
+	for (size_t i = 0; i < n_results; i++) {
+		if (results[i].n_lat > 0)
+			qsort(results[i].lat, results[i].n_lat, sizeof(uint64_t), compare_u64);
+	}
+	if (json)
+		print_json();
+	else
+		print_human();
+
+	for (size_t i = 0; i < n_results; i++)
+		free(results[i].lat);
+	return (EXIT_SUCCESS);
+}
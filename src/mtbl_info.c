@@ -93,6 +93,15 @@ dump(const char *fname)
 		printf("%" PRIu64 "\n", t.compression_algorithm);
 	}
 
+	printf("data block layout:     ");
+	if (t.data_block_layout == DATA_BLOCK_LAYOUT_DEFAULT) {
+		puts("default");
+	} else if (t.data_block_layout == DATA_BLOCK_LAYOUT_SPLIT) {
+		puts("split");
+	} else {
+		printf("%" PRIu64 "\n", t.data_block_layout);
+	}
+
 	printf("compactness:           %'.2f%%\n", compactness);
 
 	putchar('\n');
@@ -35,6 +35,9 @@ static const char		*mtbl_output_fname;
 
 static const char		*merge_dso_path;
 static const char		*merge_dso_prefix;
+static const char		*merge_op_name;
+
+static mtbl_merge_multi_func	merge_op;
 
 static mtbl_merge_init_func	user_func_init;
 static mtbl_merge_free_func	user_func_free;
@@ -54,7 +57,8 @@ usage(void)
 	fprintf(stderr,
 		"Usage: %s <INPUT MTBL FILE> [<INPUT MTBL FILE>...] <OUTPUT MTBL FILE>\n"
 		"Merges one or more MTBL input files into a single output file.\n"
-		"Requires a merge function provided by the user at runtime via a DSO.\n"
+		"Requires a built-in merge operator selected via MTBL_MERGE_OP, or a\n"
+		"merge function provided by the user at runtime via a DSO.\n"
 		"See mtbl_merge(1) for details.\n",
 		program_name
 	);
@@ -62,7 +66,7 @@ usage(void)
 }
 
 static void
-timespec_get(struct timespec *now) {
+my_timespec_get(struct timespec *now) {
 	struct timeval tv;
 	(void) gettimeofday(&tv, NULL);
 	now->tv_sec = tv.tv_sec;
@@ -90,7 +94,7 @@ print_stats(void)
 	struct timespec dur;
 	double t_dur;
 
-	timespec_get(&dur);
+	my_timespec_get(&dur);
 	timespec_sub(&start_time, &dur);
 	t_dur = timespec_to_double(&dur);
 
@@ -121,6 +125,23 @@ merge_func(void *clos,
 	count_merged += 1;
 }
 
+static mtbl_res
+merge_op_func(void *clos,
+	      const uint8_t *key, size_t len_key,
+	      size_t n_vals,
+	      const uint8_t * const *vals, const size_t *len_vals,
+	      struct mtbl_buf *merged_val)
+{
+	mtbl_res res = merge_op(clos, key, len_key, n_vals, vals, len_vals, merged_val);
+	if (res != mtbl_res_success) {
+		fprintf(stderr, "Error: merge operator %s failed on a malformed value.\n",
+			merge_op_name);
+		exit(EXIT_FAILURE);
+	}
+	count_merged += n_vals - 1;
+	return (res);
+}
+
 static void
 merge(void)
 {
@@ -141,6 +162,21 @@ merge(void)
 	mtbl_writer_destroy(&writer);
 }
 
+static bool
+init_merge_op(void)
+{
+	merge_op_name = getenv("MTBL_MERGE_OP");
+	if (merge_op_name == NULL)
+		return (false);
+
+	merge_op = mtbl_merge_op_lookup(merge_op_name);
+	if (merge_op == NULL) {
+		fprintf(stderr, "Error: unknown merge operator %s.\n\n", merge_op_name);
+		usage();
+	}
+	return (true);
+}
+
 static void
 init_dso(void)
 {
@@ -209,7 +245,10 @@ init_mtbl(void)
 	mopt = mtbl_merger_options_init();
 	wopt = mtbl_writer_options_init();
 
-	mtbl_merger_options_set_merge_func(mopt, merge_func, user_clos);
+	if (merge_op != NULL)
+		mtbl_merger_options_set_merge_multi_func(mopt, merge_op_func, NULL);
+	else
+		mtbl_merger_options_set_merge_func(mopt, merge_func, user_clos);
 	mtbl_writer_options_set_compression(wopt, MTBL_COMPRESSION_ZLIB);
 
 	merger = mtbl_merger_init(mopt);
@@ -236,8 +275,9 @@ main(int argc, char **argv)
 		usage();
 	mtbl_output_fname = argv[argc - 1];
 
-	/* open user dso */
-	init_dso();
+	/* select built-in merge operator, or open user dso */
+	if (!init_merge_op())
+		init_dso();
 
 	/* open merger, writer */
 	init_mtbl();
@@ -256,7 +296,7 @@ main(int argc, char **argv)
 	}
 
 	/* do merge */
-	timespec_get(&start_time);
+	my_timespec_get(&start_time);
 	merge();
 
 	/* cleanup readers */
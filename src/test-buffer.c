@@ -0,0 +1,274 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define NAME	"test-buffer"
+
+#define NUM_KEYS	5000
+
+static size_t
+fmt_val(char *val, unsigned k, const void *clos)
+{
+	return (snprintf(val, 64, "value %08u value %08u", k, k * 3));
+}
+
+static struct mtbl_writer_options *
+make_options(bool split_values)
+{
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_block_size(wopt, 1024);
+	mtbl_writer_options_set_compression(wopt, MTBL_COMPRESSION_ZLIB);
+	mtbl_writer_options_set_split_values(wopt, split_values);
+	return (wopt);
+}
+
+static int
+fill(struct mtbl_writer *w)
+{
+	return (test_writer_fill(w, 0, NUM_KEYS, 1, fmt_val, NULL));
+}
+
+/* scan the reader, and look up a few keys */
+static int
+check_reader(struct mtbl_reader *r)
+{
+	const struct mtbl_source *s = mtbl_reader_source(r);
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	unsigned k = 0;
+	int ret = 0;
+
+	struct mtbl_iter *it = mtbl_source_iter(s);
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		char want[64];
+		test_fmt_key(want, k);
+		ret |= (len_key != strlen(want) || memcmp(key, want, len_key) != 0);
+		size_t len_want = fmt_val(want, k, NULL);
+		ret |= (len_val != len_want || memcmp(val, want, len_val) != 0);
+		k++;
+	}
+	mtbl_iter_destroy(&it);
+	ret |= (k != NUM_KEYS);
+
+	for (k = 7; k < NUM_KEYS; k += 997) {
+		char want[64];
+		test_fmt_key(want, k);
+		it = mtbl_source_get(s, (const uint8_t *) want, strlen(want));
+		ret |= (mtbl_iter_next(it, &key, &len_key, &val, &len_val) != mtbl_res_success);
+		mtbl_iter_destroy(&it);
+	}
+	return (ret);
+}
+
+/* Returns the contents of a table written to a file, for comparison. */
+static uint8_t *
+write_file(bool split_values, size_t *len)
+{
+	FILE *fp = tmpfile();
+	if (fp == NULL)
+		return (NULL);
+	struct mtbl_writer_options *wopt = make_options(split_values);
+	int ret = fill(mtbl_writer_init_fd(dup(fileno(fp)), wopt));
+	mtbl_writer_options_destroy(&wopt);
+	if (ret != 0)
+		return (NULL);
+
+	fseek(fp, 0, SEEK_END);
+	*len = ftell(fp);
+	rewind(fp);
+	uint8_t *data = malloc(*len);
+	if (fread(data, 1, *len, fp) != *len) {
+		free(data);
+		data = NULL;
+	}
+	fclose(fp);
+	return (data);
+}
+
+/* a table written to a memory buffer, which matches the file, and read back */
+static int
+test1(void)
+{
+	int ret = 0;
+
+	for (int split = 0; split <= 1; split++) {
+		struct mtbl_buf *buf = mtbl_buf_init();
+		struct mtbl_writer_options *wopt = make_options(split);
+		ret |= fill(mtbl_writer_init_buf(buf, wopt));
+		mtbl_writer_options_destroy(&wopt);
+
+		size_t len_file;
+		uint8_t *file = write_file(split, &len_file);
+		if (file == NULL)
+			return (1);
+		ret |= (len_file != mtbl_buf_size(buf) ||
+			memcmp(file, mtbl_buf_data(buf), len_file) != 0);
+		free(file);
+
+		struct mtbl_reader *r = mtbl_reader_init_buffer(mtbl_buf_data(buf),
+								mtbl_buf_size(buf), NULL);
+		if (r == NULL)
+			return (1);
+		ret |= check_reader(r);
+		mtbl_reader_destroy(&r);
+		mtbl_buf_destroy(&buf);
+		ret |= (buf != NULL);
+	}
+	return (ret);
+}
+
+struct sink {
+	uint8_t		*data;
+	size_t		len;
+	size_t		calls;
+};
+
+static mtbl_res
+sink_write(void *clos, const uint8_t *data, size_t len)
+{
+	struct sink *sk = (struct sink *) clos;
+	sk->data = realloc(sk->data, sk->len + len + 1);
+	memcpy(sk->data + 1 + sk->len, data, len);
+	sk->len += len;
+	sk->calls++;
+	return (mtbl_res_success);
+}
+
+/* a sink which fails once it has been given 'limit' bytes */
+struct failing_sink {
+	size_t		len;
+	size_t		limit;
+	size_t		calls_failed;
+};
+
+static mtbl_res
+failing_sink_write(void *clos, const uint8_t *data, size_t len)
+{
+	struct failing_sink *sk = (struct failing_sink *) clos;
+	if (sk->len + len > sk->limit) {
+		sk->calls_failed++;
+		return (mtbl_res_failure);
+	}
+	sk->len += len;
+	return (mtbl_res_success);
+}
+
+/* a table written to a callback, and read from an unaligned buffer */
+static int
+test2(void)
+{
+	struct sink sk = { .data = NULL };
+	struct mtbl_writer_options *wopt = make_options(false);
+	int ret = fill(mtbl_writer_init_func(sink_write, &sk, wopt));
+	mtbl_writer_options_destroy(&wopt);
+	ret |= (sk.calls < 3);
+
+	struct mtbl_reader *r = mtbl_reader_init_buffer(sk.data + 1, sk.len, NULL);
+	if (r == NULL)
+		return (1);
+	ret |= check_reader(r);
+	mtbl_reader_destroy(&r);
+	free(sk.data);
+	return (ret);
+}
+
+/* buffers which do not hold a table are rejected */
+static int
+test3(void)
+{
+	int ret = 0;
+	uint8_t *zeros = calloc(1, 4096);
+
+	ret |= (mtbl_reader_init_buffer(zeros, 100, NULL) != NULL);
+	ret |= (mtbl_reader_init_buffer(zeros, 4096, NULL) != NULL);
+	free(zeros);
+	return (ret);
+}
+
+/* a failure of the output function is reported, and ends the output */
+static int
+test4(void)
+{
+	int ret = 0;
+	struct failing_sink sk = { .limit = 4096 };
+	struct mtbl_writer_options *wopt = make_options(false);
+	struct mtbl_writer *w = mtbl_writer_init_func(failing_sink_write, &sk, wopt);
+	mtbl_writer_options_destroy(&wopt);
+	unsigned k;
+
+	for (k = 0; k < NUM_KEYS; k++) {
+		char key[16], val[64];
+		test_fmt_key(key, k);
+		size_t len_val = fmt_val(val, k, NULL);
+		if (mtbl_writer_add(w, (const uint8_t *) key, strlen(key),
+				    (const uint8_t *) val, len_val) != mtbl_res_success)
+		{
+			break;
+		}
+	}
+	ret |= (k == NUM_KEYS);
+	ret |= (mtbl_writer_destroy(&w) != mtbl_res_failure);
+	ret |= (sk.calls_failed != 1);
+
+	/* the same table is written in full without the limit */
+	sk = (struct failing_sink) { .limit = SIZE_MAX };
+	wopt = make_options(false);
+	ret |= fill(mtbl_writer_init_func(failing_sink_write, &sk, wopt));
+	mtbl_writer_options_destroy(&wopt);
+	ret |= (sk.calls_failed != 0);
+	return (ret);
+}
+
+/* a failed write to a file descriptor, here a pipe without a reader, is reported */
+static int
+test5(void)
+{
+	int ret = 0;
+	int fds[2];
+
+	if (pipe(fds) != 0)
+		return (1);
+	close(fds[0]);
+	signal(SIGPIPE, SIG_IGN);
+
+	struct mtbl_writer_options *wopt = make_options(false);
+	ret |= (fill(mtbl_writer_init_fd(fds[1], wopt)) == 0);
+	mtbl_writer_options_destroy(&wopt);
+	close(fds[1]);
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+	ret |= check(test4(), "test4");
+	ret |= check(test5(), "test5");
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+void
+test_fmt_key(char *key, unsigned k)
+{
+	snprintf(key, TEST_LEN_KEY, "%08u", k);
+}
+
+size_t
+test_val_str(char *val, unsigned k, const void *clos)
+{
+	return (snprintf(val, TEST_LEN_VAL, "%s", (const char *) clos));
+}
+
+int
+test_writer_fill(struct mtbl_writer *w, unsigned k0, unsigned k1, unsigned step,
+		 test_val_func fmt_val, const void *clos)
+{
+	if (w == NULL)
+		return (1);
+	for (unsigned k = k0; k < k1; k += step) {
+		char key[TEST_LEN_KEY], val[TEST_LEN_VAL];
+		test_fmt_key(key, k);
+		size_t len_val = fmt_val(val, k, clos);
+		if (mtbl_writer_add(w, (const uint8_t *) key, strlen(key),
+				    (const uint8_t *) val, len_val) != mtbl_res_success)
+		{
+			mtbl_writer_destroy(&w);
+			return (1);
+		}
+	}
+	return (mtbl_writer_destroy(&w) != mtbl_res_success);
+}
+
+struct mtbl_reader *
+test_reader_init(const struct mtbl_writer_options *wopt,
+		 const struct mtbl_reader_options *ropt,
+		 unsigned k0, unsigned k1, unsigned step,
+		 test_val_func fmt_val, const void *clos)
+{
+	struct mtbl_reader *r = NULL;
+
+	FILE *fp = tmpfile();
+	if (fp == NULL)
+		return (NULL);
+	if (test_writer_fill(mtbl_writer_init_fd(dup(fileno(fp)), wopt),
+			     k0, k1, step, fmt_val, clos) == 0)
+	{
+		r = mtbl_reader_init_fd(dup(fileno(fp)), ropt);
+	}
+	fclose(fp);
+	return (r);
+}
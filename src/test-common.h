@@ -0,0 +1,44 @@
+#ifndef MTBL_TEST_COMMON_H
+#define MTBL_TEST_COMMON_H
+
+#include <stddef.h>
+
+#include <mtbl.h>
+
+/* the key of entry k, which sorts in the order of k for k < TEST_MAX_KEYS */
+#define TEST_LEN_KEY	16
+#define TEST_MAX_KEYS	100000000
+
+/* the largest value a test_val_func may format */
+#define TEST_LEN_VAL	256
+
+/* Formats the value of entry 'k' into 'val', and returns its length. */
+typedef size_t (*test_val_func)(char *val, unsigned k, const void *clos);
+
+void
+test_fmt_key(char *key, unsigned k);
+
+/* A test_val_func whose value is the string 'clos', for every entry. */
+size_t
+test_val_str(char *val, unsigned k, const void *clos);
+
+/*
+ * Adds every 'step'th entry from 'k0' below 'k1' to the writer 'w', and
+ * destroys it. Returns 0 on success, and non-zero if 'w' is NULL, or an entry
+ * or the table could not be written.
+ */
+int
+test_writer_fill(struct mtbl_writer *w, unsigned k0, unsigned k1, unsigned step,
+		 test_val_func fmt_val, const void *clos);
+
+/*
+ * Returns a reader on a temporary table holding every 'step'th entry from
+ * 'k0' below 'k1', as added by test_writer_fill(), or NULL on failure.
+ */
+struct mtbl_reader *
+test_reader_init(const struct mtbl_writer_options *wopt,
+		 const struct mtbl_reader_options *ropt,
+		 unsigned k0, unsigned k1, unsigned step,
+		 test_val_func fmt_val, const void *clos);
+
+#endif /* MTBL_TEST_COMMON_H */
@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define NAME	"test-concurrent"
+
+#define NUM_SOURCES	2
+#define NUM_KEYS	60000
+#define NUM_THREADS	8
+#define NUM_OPS		20000
+
+/* source i contains the keys which are multiples of divisors[i] */
+static const unsigned		divisors[NUM_SOURCES] = { 2, 3 };
+static const char		suffixes[NUM_SOURCES] = { 'a', 'b' };
+static struct mtbl_reader	*readers[NUM_SOURCES];
+static struct mtbl_merger	*merger;
+
+/* concatenates the values, so it has no state of its own */
+static mtbl_res
+merge_func(void *clos,
+	   const uint8_t *key, size_t len_key,
+	   size_t n_vals,
+	   const uint8_t * const *vals, const size_t *len_vals,
+	   struct mtbl_buf *merged_val)
+{
+	for (size_t i = 0; i < n_vals; i++)
+		mtbl_buf_append(merged_val, vals[i], len_vals[i]);
+	return (mtbl_res_success);
+}
+
+/* the second source uses the split layout, whose values are loaded lazily */
+static int
+init_sources(void)
+{
+	struct mtbl_reader_options *ropt = mtbl_reader_options_init();
+	mtbl_reader_options_set_verify_checksums(ropt, true);
+
+	for (unsigned i = 0; i < NUM_SOURCES; i++) {
+		struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+		mtbl_writer_options_set_block_size(wopt, 1024);
+		mtbl_writer_options_set_split_values(wopt, i == 1);
+
+		char val[2] = { suffixes[i], '\0' };
+		readers[i] = test_reader_init(wopt, ropt, 0, NUM_KEYS, divisors[i],
+					      test_val_str, val);
+		mtbl_writer_options_destroy(&wopt);
+		if (readers[i] == NULL)
+			return (1);
+	}
+	mtbl_reader_options_destroy(&ropt);
+
+	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+	mtbl_merger_options_set_merge_multi_func(mopt, merge_func, NULL);
+	merger = mtbl_merger_init(mopt);
+	mtbl_merger_options_destroy(&mopt);
+	for (unsigned i = 0; i < NUM_SOURCES; i++)
+		mtbl_merger_add_source(merger, mtbl_reader_source(readers[i]));
+	return (0);
+}
+
+/* Returns the expected value of key 'k' in the merger, or "" if absent. */
+static void
+expected_val(char *val, unsigned k)
+{
+	size_t len = 0;
+	for (unsigned i = 0; i < NUM_SOURCES; i++) {
+		if (k % divisors[i] == 0)
+			val[len++] = suffixes[i];
+	}
+	val[len] = '\0';
+}
+
+static int
+check_get(const struct mtbl_source *s, unsigned k, const char *want)
+{
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	char k_key[16];
+	int ret = 0;
+
+	test_fmt_key(k_key, k);
+	struct mtbl_iter *it = mtbl_source_get(s, (const uint8_t *) k_key, strlen(k_key));
+	if (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		ret |= (len_val != strlen(want) || memcmp(val, want, len_val) != 0);
+	} else {
+		ret |= (strlen(want) != 0);
+	}
+	mtbl_iter_destroy(&it);
+	return (ret);
+}
+
+/* the keys with prefix 'k / 10' */
+static int
+check_prefix(const struct mtbl_source *s, unsigned k)
+{
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	char prefix[16];
+	unsigned count = 0, want = 0;
+
+	test_fmt_key(prefix, k - k % 10);
+	for (unsigned j = k - k % 10; j < k - k % 10 + 10; j++) {
+		if (j % divisors[0] == 0 || j % divisors[1] == 0)
+			want++;
+	}
+	struct mtbl_iter *it = mtbl_source_get_prefix(s, (const uint8_t *) prefix,
+						      strlen(prefix) - 1);
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success)
+		count++;
+	mtbl_iter_destroy(&it);
+	return (count != want);
+}
+
+struct worker {
+	pthread_t		thr;
+	unsigned		seed;
+	int			ret;
+};
+
+static void *
+worker_thr(void *arg)
+{
+	struct worker *wk = (struct worker *) arg;
+
+	for (unsigned i = 0; i < NUM_OPS; i++) {
+		unsigned k = rand_r(&wk->seed) % NUM_KEYS;
+		unsigned r = k % NUM_SOURCES;
+		char want[NUM_SOURCES + 1] = "";
+
+		if (k % divisors[r] == 0)
+			want[0] = suffixes[r];
+		wk->ret |= check_get(mtbl_reader_source(readers[r]), k, want);
+
+		expected_val(want, k);
+		wk->ret |= check_get(mtbl_merger_source(merger), k, want);
+
+		if (i % 64 == 0)
+			wk->ret |= check_prefix(mtbl_merger_source(merger), k);
+	}
+	return (NULL);
+}
+
+/* lookups on shared readers and a shared merger from many threads */
+static int
+test1(void)
+{
+	struct worker workers[NUM_THREADS];
+	int ret = 0;
+
+	for (unsigned i = 0; i < NUM_THREADS; i++) {
+		workers[i].seed = i + 1;
+		workers[i].ret = 0;
+		pthread_create(&workers[i].thr, NULL, worker_thr, &workers[i]);
+	}
+	for (unsigned i = 0; i < NUM_THREADS; i++) {
+		pthread_join(workers[i].thr, NULL);
+		ret |= workers[i].ret;
+	}
+	return (ret);
+}
+
+static void *
+scan_thr(void *arg)
+{
+	struct worker *wk = (struct worker *) arg;
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	unsigned k = 0;
+
+	struct mtbl_iter *it = mtbl_source_iter(mtbl_merger_source(merger));
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		char want[16];
+		while (k % divisors[0] != 0 && k % divisors[1] != 0)
+			k++;
+		test_fmt_key(want, k);
+		if (len_key != strlen(want) || memcmp(key, want, len_key) != 0)
+			wk->ret = 1;
+		expected_val(want, k++);
+		if (len_val != strlen(want) || memcmp(val, want, len_val) != 0)
+			wk->ret = 1;
+	}
+	mtbl_iter_destroy(&it);
+	return (NULL);
+}
+
+/* full scans of a shared merger from many threads */
+static int
+test2(void)
+{
+	struct worker workers[NUM_THREADS];
+	int ret = 0;
+
+	for (unsigned i = 0; i < NUM_THREADS; i++) {
+		workers[i].ret = 0;
+		pthread_create(&workers[i].thr, NULL, scan_thr, &workers[i]);
+	}
+	for (unsigned i = 0; i < NUM_THREADS; i++) {
+		pthread_join(workers[i].thr, NULL);
+		ret |= workers[i].ret;
+	}
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	if (init_sources() != 0) {
+		fprintf(stderr, NAME ": FAIL: init_sources\n");
+		return (EXIT_FAILURE);
+	}
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+
+	mtbl_merger_destroy(&merger);
+	for (unsigned i = 0; i < NUM_SOURCES; i++)
+		mtbl_reader_destroy(&readers[i]);
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,416 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define NAME	"test-iter"
+
+#define NUM_KEYS	20000
+#define BATCH_SIZE	100
+
+static struct mtbl_reader	*reader;
+
+static size_t
+fmt_val(char *val, unsigned k, const void *clos)
+{
+	return (snprintf(val, 32, "value-%u", k * 7));
+}
+
+static struct mtbl_reader *
+make_reader(bool split_values, mtbl_compression_type compression)
+{
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_block_size(wopt, 1024);
+	mtbl_writer_options_set_split_values(wopt, split_values);
+	mtbl_writer_options_set_compression(wopt, compression);
+
+	struct mtbl_reader *r = test_reader_init(wopt, NULL, 0, NUM_KEYS, 1, fmt_val, NULL);
+	mtbl_writer_options_destroy(&wopt);
+	return (r);
+}
+
+static int
+init_reader(void)
+{
+	reader = make_reader(false, MTBL_COMPRESSION_ZLIB);
+	return (reader == NULL);
+}
+
+/* Check that a key-only iterator returns exactly the keys [k0, k1), without values. */
+static int
+check_keys(struct mtbl_iter *it, unsigned k0, unsigned k1)
+{
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	unsigned k = k0;
+
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		char want[16];
+		test_fmt_key(want, k++);
+		if (len_key != strlen(want) || memcmp(key, want, len_key) != 0 || len_val != 0)
+			return (1);
+	}
+	return (k != k1);
+}
+
+static uint64_t
+count_blocks_read(struct mtbl_reader *r)
+{
+	struct mtbl_reader_stats st;
+	mtbl_reader_stats(r, &st);
+	return (st.count_blocks_read);
+}
+
+static void
+drain(struct mtbl_iter *it)
+{
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success);
+	mtbl_iter_destroy(&it);
+}
+
+/*
+ * Check that batches from 'it' contain exactly the keys [k0, k1), mixing in
+ * calls to mtbl_iter_next() if 'mixed' is set, and track the largest batch.
+ */
+static int
+check_batches(struct mtbl_iter *it, unsigned k0, unsigned k1, bool mixed, size_t *largest)
+{
+	struct mtbl_kv kv[BATCH_SIZE];
+	unsigned k = k0;
+	size_t n;
+
+	while ((n = mtbl_iter_next_batch(it, kv, BATCH_SIZE)) > 0) {
+		if (n > BATCH_SIZE)
+			return (1);
+		if (largest != NULL && n > *largest)
+			*largest = n;
+		/* check the whole batch, after it is complete */
+		for (size_t i = 0; i < n; i++, k++) {
+			char key[16], val[32];
+			test_fmt_key(key, k);
+			fmt_val(val, k, NULL);
+			if (kv[i].len_key != strlen(key) ||
+			    memcmp(kv[i].key, key, kv[i].len_key) != 0 ||
+			    kv[i].len_val != strlen(val) ||
+			    memcmp(kv[i].val, val, kv[i].len_val) != 0)
+			{
+				return (1);
+			}
+		}
+		if (mixed) {
+			const uint8_t *key, *val;
+			size_t len_key, len_val;
+			char want[16];
+			if (mtbl_iter_next(it, &key, &len_key, &val, &len_val) != mtbl_res_success)
+				break;
+			test_fmt_key(want, k++);
+			if (len_key != strlen(want) || memcmp(key, want, len_key) != 0)
+				return (1);
+		}
+	}
+	return (k != k1);
+}
+
+static mtbl_res
+merge_func(void *clos,
+	   const uint8_t *key, size_t len_key,
+	   size_t n_vals,
+	   const uint8_t * const *vals, const size_t *len_vals,
+	   struct mtbl_buf *merged_val)
+{
+	mtbl_buf_append(merged_val, vals[0], len_vals[0]);
+	return (mtbl_res_success);
+}
+
+static int
+test1(void)
+{
+	int ret = 0;
+	const struct mtbl_source *s = mtbl_reader_source(reader);
+	struct mtbl_iter *it;
+	char key0[16], key1[16];
+
+	it = mtbl_source_iter(s);
+	ret |= check_batches(it, 0, NUM_KEYS, false, NULL);
+	mtbl_iter_destroy(&it);
+
+	it = mtbl_source_iter(s);
+	ret |= check_batches(it, 0, NUM_KEYS, true, NULL);
+	mtbl_iter_destroy(&it);
+
+	test_fmt_key(key0, 1234);
+	test_fmt_key(key1, 5678);
+	it = mtbl_source_get_range(s, (const uint8_t *) key0, strlen(key0),
+				   (const uint8_t *) key1, strlen(key1));
+	ret |= check_batches(it, 1234, 5679, false, NULL);
+	mtbl_iter_destroy(&it);
+
+	it = mtbl_source_get_prefix(s, (const uint8_t *) "000123", 6);
+	ret |= check_batches(it, 12300, 12400, false, NULL);
+	mtbl_iter_destroy(&it);
+
+	it = mtbl_source_get(s, (const uint8_t *) key0, strlen(key0));
+	ret |= check_batches(it, 1234, 1235, false, NULL);
+	mtbl_iter_destroy(&it);
+
+	return (ret);
+}
+
+static struct mtbl_merger *
+merger_init(const struct mtbl_source *s0, const struct mtbl_source *s1)
+{
+	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+	mtbl_merger_options_set_merge_multi_func(mopt, merge_func, NULL);
+	struct mtbl_merger *m = mtbl_merger_init(mopt);
+	mtbl_merger_options_destroy(&mopt);
+	mtbl_merger_add_source(m, s0);
+	mtbl_merger_add_source(m, s1);
+	return (m);
+}
+
+/* merger iterators return batches of both merged and unmerged entries */
+static int
+test2(void)
+{
+	int ret = 0;
+	size_t largest = 0;
+
+	/* every key is held by both sources, so every entry is merged */
+	struct mtbl_merger *m = merger_init(mtbl_reader_source(reader),
+					    mtbl_reader_source(reader));
+	struct mtbl_iter *it = mtbl_source_iter(mtbl_merger_source(m));
+	ret |= check_batches(it, 0, NUM_KEYS, false, &largest);
+	mtbl_iter_destroy(&it);
+
+	it = mtbl_source_iter(mtbl_merger_source(m));
+	ret |= check_batches(it, 0, NUM_KEYS, true, NULL);
+	mtbl_iter_destroy(&it);
+	mtbl_merger_destroy(&m);
+	ret |= (largest < 2);
+
+	/* sources which overlap in only a few keys, around NUM_KEYS / 2 */
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_block_size(wopt, 1024);
+	struct mtbl_reader *r0 = test_reader_init(wopt, NULL, 0, NUM_KEYS / 2 + 100, 1,
+						  fmt_val, NULL);
+	struct mtbl_reader *r1 = test_reader_init(wopt, NULL, NUM_KEYS / 2 - 100, NUM_KEYS, 1,
+						  fmt_val, NULL);
+	mtbl_writer_options_destroy(&wopt);
+	if (r0 == NULL || r1 == NULL)
+		return (1);
+	m = merger_init(mtbl_reader_source(r0), mtbl_reader_source(r1));
+
+	largest = 0;
+	it = mtbl_source_iter(mtbl_merger_source(m));
+	ret |= check_batches(it, 0, NUM_KEYS, false, &largest);
+	mtbl_iter_destroy(&it);
+	ret |= (largest < 2);
+
+	it = mtbl_source_iter(mtbl_merger_source(m));
+	ret |= check_batches(it, 0, NUM_KEYS, true, NULL);
+	mtbl_iter_destroy(&it);
+
+	/* seeks within the entries already read from the sources, and past them */
+	struct mtbl_kv kv[BATCH_SIZE];
+	char key[16];
+	it = mtbl_source_iter(mtbl_merger_source(m));
+	ret |= (mtbl_iter_next_batch(it, kv, 10) == 0);
+	test_fmt_key(key, 30);
+	ret |= (mtbl_iter_seek(it, (const uint8_t *) key, strlen(key)) != mtbl_res_success);
+	ret |= (mtbl_iter_next_batch(it, kv, 10) == 0 ||
+		kv[0].len_key != strlen(key) || memcmp(kv[0].key, key, kv[0].len_key) != 0);
+	test_fmt_key(key, NUM_KEYS / 2 - 50);
+	ret |= (mtbl_iter_seek(it, (const uint8_t *) key, strlen(key)) != mtbl_res_success);
+	ret |= check_batches(it, NUM_KEYS / 2 - 50, NUM_KEYS, true, NULL);
+	mtbl_iter_destroy(&it);
+
+	mtbl_merger_destroy(&m);
+	mtbl_reader_destroy(&r0);
+	mtbl_reader_destroy(&r1);
+	return (ret);
+}
+
+/* iterators without a batch function */
+static int
+test3(void)
+{
+	int ret = 0;
+	const struct mtbl_source *sources[1] = { mtbl_reader_source(reader) };
+	struct mtbl_source *s = mtbl_source_intersection(sources, 1);
+
+	struct mtbl_iter *it = mtbl_source_iter(s);
+	ret |= check_batches(it, 0, NUM_KEYS, true, NULL);
+	mtbl_iter_destroy(&it);
+
+	mtbl_source_destroy(&s);
+	return (ret);
+}
+
+/* the split data block layout, and key-only iterators over it */
+static int
+test4(void)
+{
+	static const mtbl_compression_type compressions[] = {
+		MTBL_COMPRESSION_NONE,
+		MTBL_COMPRESSION_SNAPPY,
+		MTBL_COMPRESSION_ZLIB,
+	};
+	int ret = 0;
+	char key0[16], key1[16];
+
+	test_fmt_key(key0, 1234);
+	test_fmt_key(key1, 5678);
+
+	for (size_t i = 0; i < sizeof(compressions) / sizeof(compressions[0]); i++) {
+		for (int split = 0; split <= 1; split++) {
+			struct mtbl_reader *r = make_reader(split, compressions[i]);
+			if (r == NULL)
+				return (1);
+			const struct mtbl_source *s = mtbl_reader_source(r);
+			struct mtbl_iter *it;
+
+			it = mtbl_source_iter(s);
+			ret |= check_batches(it, 0, NUM_KEYS, true, NULL);
+			mtbl_iter_destroy(&it);
+
+			it = mtbl_source_get_range(s, (const uint8_t *) key0, strlen(key0),
+						   (const uint8_t *) key1, strlen(key1));
+			ret |= check_batches(it, 1234, 5679, false, NULL);
+			mtbl_iter_destroy(&it);
+
+			it = mtbl_source_get(s, (const uint8_t *) key1, strlen(key1));
+			ret |= check_batches(it, 5678, 5679, false, NULL);
+			mtbl_iter_destroy(&it);
+
+			it = mtbl_source_iter_keys(s);
+			ret |= check_keys(it, 0, NUM_KEYS);
+			mtbl_iter_destroy(&it);
+
+			it = mtbl_source_get_prefix_keys(s, (const uint8_t *) "000123", 6);
+			ret |= check_keys(it, 12300, 12400);
+			mtbl_iter_destroy(&it);
+
+			it = mtbl_source_get_range_keys(s, (const uint8_t *) key0, strlen(key0),
+							(const uint8_t *) key1, strlen(key1));
+			ret |= check_keys(it, 1234, 5679);
+			mtbl_iter_destroy(&it);
+
+			/*
+			 * With split values, key-only iterators read no value
+			 * blocks, and the others read one for each data block
+			 * whose entries they return.
+			 */
+			uint64_t n0 = count_blocks_read(r);
+			drain(mtbl_source_iter_keys(s));
+			uint64_t n_keys = count_blocks_read(r) - n0;
+			drain(mtbl_source_iter(s));
+			uint64_t n_all = count_blocks_read(r) - n0 - n_keys;
+			ret |= (n_all != (split ? 2 * n_keys : n_keys));
+
+			n0 = count_blocks_read(r);
+			drain(mtbl_source_get_range_keys(s, (const uint8_t *) key0, strlen(key0),
+							 (const uint8_t *) key1, strlen(key1)));
+			n_keys = count_blocks_read(r) - n0;
+			drain(mtbl_source_get_range(s, (const uint8_t *) key0, strlen(key0),
+						    (const uint8_t *) key1, strlen(key1)));
+			n_all = count_blocks_read(r) - n0 - n_keys;
+			if (split)
+				ret |= (n_all <= n_keys || n_all > 2 * n_keys);
+			else
+				ret |= (n_all != n_keys);
+
+			mtbl_reader_destroy(&r);
+		}
+	}
+	return (ret);
+}
+
+/* key-only iterators over a merger, which neither merge nor read values */
+static int
+test5(void)
+{
+	int ret = 0;
+	struct mtbl_merger_stats st;
+	char key0[16], key1[16];
+
+	test_fmt_key(key0, 1234);
+	test_fmt_key(key1, 5678);
+
+	struct mtbl_reader *r = make_reader(true, MTBL_COMPRESSION_ZLIB);
+	if (r == NULL)
+		return (1);
+	struct mtbl_merger *m = merger_init(mtbl_reader_source(r), mtbl_reader_source(r));
+	const struct mtbl_source *s = mtbl_merger_source(m);
+	struct mtbl_iter *it;
+
+	it = mtbl_source_iter_keys(s);
+	ret |= check_keys(it, 0, NUM_KEYS);
+	mtbl_iter_destroy(&it);
+
+	it = mtbl_source_get_prefix_keys(s, (const uint8_t *) "000123", 6);
+	ret |= check_keys(it, 12300, 12400);
+	mtbl_iter_destroy(&it);
+
+	it = mtbl_source_get_range_keys(s, (const uint8_t *) key0, strlen(key0),
+					(const uint8_t *) key1, strlen(key1));
+	ret |= check_keys(it, 1234, 5679);
+	mtbl_iter_destroy(&it);
+
+	mtbl_merger_stats(m, &st);
+	ret |= (st.count_duplicates != NUM_KEYS + 100 + 4445);
+	ret |= (st.count_merges != 0);
+
+	uint64_t n0 = count_blocks_read(r);
+	drain(mtbl_source_iter_keys(s));
+	uint64_t n_keys = count_blocks_read(r) - n0;
+	drain(mtbl_source_iter(s));
+	uint64_t n_all = count_blocks_read(r) - n0 - n_keys;
+	ret |= (n_all != 2 * n_keys);
+
+	mtbl_merger_destroy(&m);
+	mtbl_reader_destroy(&r);
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	if (init_reader() != 0) {
+		fprintf(stderr, NAME ": FAIL: init_reader\n");
+		return (EXIT_FAILURE);
+	}
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+	ret |= check(test4(), "test4");
+	ret |= check(test5(), "test5");
+
+	mtbl_reader_destroy(&reader);
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
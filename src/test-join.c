@@ -0,0 +1,285 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define NAME	"test-join"
+
+#define NUM_SOURCES	3
+#define NUM_KEYS	100000
+
+static const unsigned		divisors[NUM_SOURCES] = { 2, 3, 5 };
+static struct mtbl_reader	*readers[NUM_SOURCES];
+static const struct mtbl_source	*sources[NUM_SOURCES];
+
+/* source i contains the keys which are multiples of divisors[i], valued i */
+static int
+init_readers(void)
+{
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_block_size(wopt, 1024);
+
+	for (unsigned i = 0; i < NUM_SOURCES; i++) {
+		char val[2] = { '0' + i, '\0' };
+		readers[i] = test_reader_init(wopt, NULL, 0, NUM_KEYS, divisors[i],
+					      test_val_str, val);
+		if (readers[i] == NULL)
+			return (1);
+		sources[i] = mtbl_reader_source(readers[i]);
+	}
+
+	mtbl_writer_options_destroy(&wopt);
+	return (0);
+}
+
+/*
+ * Check that 'it' returns exactly the keys k in [k0, k1) for which want(k),
+ * with the value computed by want_val(k).
+ */
+static int
+check_iter(struct mtbl_iter *it, unsigned k0, unsigned k1,
+	   bool (*want)(unsigned), size_t (*want_val)(unsigned, char *))
+{
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	unsigned k = k0;
+
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		char expect[16], expect_val[NUM_SOURCES];
+		while (k < k1 && !want(k))
+			k++;
+		if (k == k1)
+			return (1);
+		test_fmt_key(expect, k);
+		size_t len_expect_val = want_val(k, expect_val);
+		if (len_key != strlen(expect) || memcmp(key, expect, len_key) != 0 ||
+		    len_val != len_expect_val || memcmp(val, expect_val, len_val) != 0)
+		{
+			return (1);
+		}
+		k++;
+	}
+	while (k < k1 && !want(k))
+		k++;
+	return (k != k1);
+}
+
+static bool
+want_all(unsigned k)
+{
+	return (k % 30 == 0);
+}
+
+static size_t
+val_first(unsigned k, char *val)
+{
+	val[0] = '0';
+	return (1);
+}
+
+static size_t
+val_concat(unsigned k, char *val)
+{
+	memcpy(val, "012", 3);
+	return (3);
+}
+
+static bool
+want_diff(unsigned k)
+{
+	return (k % 2 == 0 && k % 3 != 0);
+}
+
+static mtbl_res
+concat_func(void *clos,
+	    const uint8_t *key, size_t len_key,
+	    size_t n_vals,
+	    const uint8_t * const *vals, const size_t *len_vals,
+	    struct mtbl_buf *merged_val)
+{
+	for (size_t i = 0; i < n_vals; i++)
+		mtbl_buf_append(merged_val, vals[i], len_vals[i]);
+	return (mtbl_res_success);
+}
+
+static int
+test1(void)
+{
+	int ret = 0;
+	struct mtbl_source *s = mtbl_source_intersection(sources, NUM_SOURCES);
+	struct mtbl_iter *it;
+	char key0[16], key1[16];
+
+	it = mtbl_source_iter(s);
+	ret |= check_iter(it, 0, NUM_KEYS, want_all, val_first);
+	mtbl_iter_destroy(&it);
+
+	test_fmt_key(key0, 1000);
+	test_fmt_key(key1, 2000);
+	it = mtbl_source_get_range(s, (const uint8_t *) key0, strlen(key0),
+				   (const uint8_t *) key1, strlen(key1));
+	ret |= check_iter(it, 1000, 2001, want_all, val_first);
+	mtbl_iter_destroy(&it);
+
+	/* keys 00012000 through 00012999 */
+	it = mtbl_source_get_prefix(s, (const uint8_t *) "00012", 5);
+	ret |= check_iter(it, 12000, 13000, want_all, val_first);
+	mtbl_iter_destroy(&it);
+
+	mtbl_source_destroy(&s);
+	return (ret);
+}
+
+static int
+test2(void)
+{
+	int ret = 0;
+	struct mtbl_source *s = mtbl_source_join(sources, NUM_SOURCES, concat_func, NULL);
+	struct mtbl_iter *it;
+	char key[16];
+
+	it = mtbl_source_iter(s);
+	ret |= check_iter(it, 0, NUM_KEYS, want_all, val_concat);
+	mtbl_iter_destroy(&it);
+
+	/* seeking the join skips to the next common key */
+	it = mtbl_source_iter(s);
+	test_fmt_key(key, 50001);
+	if (mtbl_iter_seek(it, (const uint8_t *) key, strlen(key)) != mtbl_res_success)
+		ret |= 1;
+	ret |= check_iter(it, 50001, NUM_KEYS, want_all, val_concat);
+	mtbl_iter_destroy(&it);
+
+	mtbl_source_destroy(&s);
+	return (ret);
+}
+
+static int
+test3(void)
+{
+	int ret = 0;
+	struct mtbl_source *s = mtbl_source_difference(sources[0], sources[1]);
+	struct mtbl_iter *it;
+
+	it = mtbl_source_iter(s);
+	ret |= check_iter(it, 0, NUM_KEYS, want_diff, val_first);
+	mtbl_iter_destroy(&it);
+
+	mtbl_source_destroy(&s);
+	return (ret);
+}
+
+struct array_iter {
+	unsigned	k;
+	char		key[16];
+};
+
+static mtbl_res
+array_iter_next(void *v,
+		const uint8_t **key, size_t *len_key,
+		const uint8_t **val, size_t *len_val)
+{
+	struct array_iter *ai = (struct array_iter *) v;
+	if (ai->k >= NUM_KEYS)
+		return (mtbl_res_failure);
+	test_fmt_key(ai->key, ai->k);
+	ai->k += 2;
+	*key = (const uint8_t *) ai->key;
+	*len_key = strlen(ai->key);
+	*val = (const uint8_t *) "0";
+	*len_val = 1;
+	return (mtbl_res_success);
+}
+
+static bool
+want_even(unsigned k)
+{
+	return (k % 2 == 0);
+}
+
+/* seeking readers, and iterators without a seek function */
+static int
+test4(void)
+{
+	int ret = 0;
+	struct array_iter ai = { 0 };
+	struct mtbl_iter *it;
+	char key[16];
+	const uint8_t *k, *v;
+	size_t len_k, len_v;
+
+	it = mtbl_iter_init(array_iter_next, NULL, &ai);
+	test_fmt_key(key, 777);
+	if (mtbl_iter_seek(it, (const uint8_t *) key, strlen(key)) != mtbl_res_success)
+		ret |= 1;
+	/* a seek backwards does not move the iterator */
+	test_fmt_key(key, 10);
+	if (mtbl_iter_seek(it, (const uint8_t *) key, strlen(key)) != mtbl_res_success)
+		ret |= 1;
+	ret |= check_iter(it, 777, NUM_KEYS, want_even, val_first);
+	mtbl_iter_destroy(&it);
+
+	it = mtbl_source_iter(sources[0]);
+	if (mtbl_iter_next(it, &k, &len_k, &v, &len_v) != mtbl_res_success)
+		ret |= 1;
+	test_fmt_key(key, 33333);
+	if (mtbl_iter_seek(it, (const uint8_t *) key, strlen(key)) != mtbl_res_success)
+		ret |= 1;
+	test_fmt_key(key, 20000);
+	if (mtbl_iter_seek(it, (const uint8_t *) key, strlen(key)) != mtbl_res_success)
+		ret |= 1;
+	ret |= check_iter(it, 33333, NUM_KEYS, want_even, val_first);
+	mtbl_iter_destroy(&it);
+
+	/* past the end */
+	it = mtbl_source_iter(sources[0]);
+	test_fmt_key(key, NUM_KEYS);
+	if (mtbl_iter_seek(it, (const uint8_t *) key, strlen(key)) != mtbl_res_success ||
+	    mtbl_iter_next(it, &k, &len_k, &v, &len_v) != mtbl_res_failure)
+	{
+		ret |= 1;
+	}
+	mtbl_iter_destroy(&it);
+
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	if (init_readers() != 0) {
+		fprintf(stderr, NAME ": FAIL: init_readers\n");
+		return (EXIT_FAILURE);
+	}
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+	ret |= check(test4(), "test4");
+
+	for (unsigned i = 0; i < NUM_SOURCES; i++)
+		mtbl_reader_destroy(&readers[i]);
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,201 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "mtbl-private.h"
+#include "vector_types.h"
+
+#define NAME	"test-merge_op"
+
+static mtbl_res
+call(const char *name, size_t n_vals,
+     const uint8_t * const *vals, const size_t *len_vals,
+     ubuf *out)
+{
+	mtbl_merge_multi_func fp = mtbl_merge_op_lookup(name);
+	assert(fp != NULL);
+	/* leave junk in the buffer, which the operator must discard */
+	ubuf_clip(out, 0);
+	ubuf_append(out, (const uint8_t *) "junk", 4);
+	return (fp(NULL, (const uint8_t *) "k", 1, n_vals, vals, len_vals,
+		   (struct mtbl_buf *) out));
+}
+
+static int
+test1(void)
+{
+	int ret = 0;
+	uint8_t v[3][10];
+	const uint8_t *vals[3] = { v[0], v[1], v[2] };
+	size_t len_vals[3];
+	uint64_t sum;
+	ubuf *out = ubuf_init(0);
+
+	len_vals[0] = mtbl_varint_encode64(v[0], 1);
+	len_vals[1] = mtbl_varint_encode64(v[1], 300);
+	len_vals[2] = mtbl_varint_encode64(v[2], UINT64_C(1) << 40);
+	if (call("sum_varint", 3, vals, len_vals, out) != mtbl_res_success)
+		ret |= 1;
+	if (mtbl_varint_length_packed(ubuf_data(out), ubuf_size(out)) != ubuf_size(out))
+		ret |= 1;
+	mtbl_varint_decode64(ubuf_data(out), &sum);
+	if (sum != 301 + (UINT64_C(1) << 40))
+		ret |= 1;
+
+	/* truncated varint */
+	len_vals[1] = 1;
+	if (call("sum_varint", 3, vals, len_vals, out) != mtbl_res_failure)
+		ret |= 1;
+
+	ubuf_destroy(&out);
+	return (ret);
+}
+
+static int
+test2(void)
+{
+	int ret = 0;
+	uint8_t v[3][4 * sizeof(uint64_t)];
+	const uint8_t *vals[3] = { v[0], v[1], v[2] };
+	const size_t len_vals[3] = { 2 * sizeof(uint64_t), sizeof(v[1]), 3 * sizeof(uint64_t) };
+	ubuf *out = ubuf_init(0);
+
+	for (size_t i = 0; i < 3; i++) {
+		for (size_t j = 0; j < 4; j++)
+			mtbl_fixed_encode64(v[i] + j * sizeof(uint64_t), 10 * (i + 1) + j);
+	}
+
+	if (call("sum_fixed64", 3, vals, len_vals, out) != mtbl_res_success ||
+	    ubuf_size(out) != sizeof(v[1]))
+	{
+		ret |= 1;
+	} else {
+		const uint64_t want[4] = { 60, 63, 54, 23 };
+		for (size_t j = 0; j < 4; j++) {
+			if (mtbl_fixed_decode64(ubuf_data(out) + j * sizeof(uint64_t)) != want[j])
+				ret |= 1;
+		}
+	}
+
+	if (call("min_fixed64", 3, vals, len_vals, out) != mtbl_res_success ||
+	    ubuf_size(out) != sizeof(v[1]))
+	{
+		ret |= 1;
+	} else {
+		const uint64_t want[4] = { 10, 11, 22, 23 };
+		for (size_t j = 0; j < 4; j++) {
+			if (mtbl_fixed_decode64(ubuf_data(out) + j * sizeof(uint64_t)) != want[j])
+				ret |= 1;
+		}
+	}
+
+	if (call("max_fixed64", 3, vals, len_vals, out) != mtbl_res_success ||
+	    ubuf_size(out) != sizeof(v[1]))
+	{
+		ret |= 1;
+	} else {
+		const uint64_t want[4] = { 30, 31, 32, 23 };
+		for (size_t j = 0; j < 4; j++) {
+			if (mtbl_fixed_decode64(ubuf_data(out) + j * sizeof(uint64_t)) != want[j])
+				ret |= 1;
+		}
+	}
+
+	/* not a whole number of words */
+	const size_t len_bad[3] = { 7, 8, 8 };
+	if (call("sum_fixed64", 3, vals, len_bad, out) != mtbl_res_failure)
+		ret |= 1;
+
+	ubuf_destroy(&out);
+	return (ret);
+}
+
+static void
+append_str(ubuf *u, const char *s)
+{
+	uint8_t len[10];
+	ubuf_append(u, len, mtbl_varint_encode64(len, strlen(s)));
+	ubuf_append(u, (const uint8_t *) s, strlen(s));
+}
+
+static int
+test3(void)
+{
+	int ret = 0;
+	static const char *sets[3][4] = {
+		{ "a", "bb", "d", NULL },
+		{ "b", "bb", "bb", "e" },
+		{ "", "a", "c", NULL },
+	};
+	const uint8_t *vals[3];
+	size_t len_vals[3];
+	ubuf *v[3];
+	ubuf *out = ubuf_init(0);
+	ubuf *want = ubuf_init(0);
+
+	for (size_t i = 0; i < 3; i++) {
+		v[i] = ubuf_init(0);
+		for (size_t j = 0; j < 4 && sets[i][j] != NULL; j++)
+			append_str(v[i], sets[i][j]);
+		vals[i] = ubuf_data(v[i]);
+		len_vals[i] = ubuf_size(v[i]);
+	}
+	append_str(want, "");
+	append_str(want, "a");
+	append_str(want, "b");
+	append_str(want, "bb");
+	append_str(want, "c");
+	append_str(want, "d");
+	append_str(want, "e");
+
+	if (call("union_sorted", 3, vals, len_vals, out) != mtbl_res_success ||
+	    ubuf_size(out) != ubuf_size(want) ||
+	    memcmp(ubuf_data(out), ubuf_data(want), ubuf_size(want)) != 0)
+	{
+		ret |= 1;
+	}
+
+	/* truncated string */
+	len_vals[1] -= 1;
+	if (call("union_sorted", 3, vals, len_vals, out) != mtbl_res_failure)
+		ret |= 1;
+
+	if (mtbl_merge_op_lookup("no_such_op") != NULL)
+		ret |= 1;
+
+	for (size_t i = 0; i < 3; i++)
+		ubuf_destroy(&v[i]);
+	ubuf_destroy(&out);
+	ubuf_destroy(&want);
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,274 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define NAME	"test-merger"
+
+#define NUM_SOURCES	3
+#define NUM_KEYS	1000
+
+static struct mtbl_reader	*readers[NUM_SOURCES];
+
+/* source i contains the keys which are multiples of (i + 1), valued i */
+static int
+init_readers(void)
+{
+	for (unsigned i = 0; i < NUM_SOURCES; i++) {
+		char val[2] = { '0' + i, '\0' };
+		readers[i] = test_reader_init(NULL, NULL, 0, NUM_KEYS, i + 1, test_val_str, val);
+		if (readers[i] == NULL)
+			return (1);
+	}
+	return (0);
+}
+
+static uint8_t
+expected_val(unsigned k)
+{
+	for (unsigned i = 0; i < NUM_SOURCES; i++) {
+		if (k % (i + 1) == 0)
+			return ('0' + i);
+	}
+	abort();
+}
+
+static mtbl_res
+concat_func(void *clos,
+	    const uint8_t *key, size_t len_key,
+	    size_t n_vals,
+	    const uint8_t * const *vals, const size_t *len_vals,
+	    struct mtbl_buf *merged_val)
+{
+	for (size_t i = 0; i < n_vals; i++)
+		mtbl_buf_append(merged_val, vals[i], len_vals[i]);
+	return (mtbl_res_success);
+}
+
+static struct mtbl_merger *
+merger_init(bool precedence)
+{
+	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+	if (precedence)
+		mtbl_merger_options_set_precedence(mopt, true);
+	else
+		mtbl_merger_options_set_merge_multi_func(mopt, concat_func, NULL);
+	struct mtbl_merger *m = mtbl_merger_init(mopt);
+	mtbl_merger_options_destroy(&mopt);
+	for (unsigned i = 0; i < NUM_SOURCES; i++)
+		mtbl_merger_add_source(m, mtbl_reader_source(readers[i]));
+	return (m);
+}
+
+/* every key resolves to the value from the first source containing it */
+static int
+test1(void)
+{
+	int ret = 0;
+	struct mtbl_merger *m = merger_init(true);
+	struct mtbl_iter *it = mtbl_source_iter(mtbl_merger_source(m));
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	unsigned n = 0;
+
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		char want[16];
+		test_fmt_key(want, n);
+		if (len_key != strlen(want) || memcmp(key, want, len_key) != 0 ||
+		    len_val != 1 || val[0] != expected_val(n))
+		{
+			ret |= 1;
+			break;
+		}
+		n++;
+	}
+	if (n != NUM_KEYS)
+		ret |= 1;
+
+	mtbl_iter_destroy(&it);
+	mtbl_merger_destroy(&m);
+	return (ret);
+}
+
+/* A source holding no entries, which counts the lookups made on it. */
+static struct mtbl_iter *
+counting_iter(void *clos)
+{
+	(*(unsigned *) clos)++;
+	return (NULL);
+}
+
+static struct mtbl_iter *
+counting_get(void *clos, const uint8_t *key, size_t len_key)
+{
+	(*(unsigned *) clos)++;
+	return (NULL);
+}
+
+static struct mtbl_iter *
+counting_get_range(void *clos,
+		   const uint8_t *key0, size_t len_key0,
+		   const uint8_t *key1, size_t len_key1)
+{
+	(*(unsigned *) clos)++;
+	return (NULL);
+}
+
+/*
+ * Lookups resolve to the first source containing the key, without searching
+ * the sources after it.
+ */
+static int
+test2(void)
+{
+	int ret = 0;
+	struct mtbl_merger *m = merger_init(true);
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	unsigned n_lookups = 0;
+
+	struct mtbl_source *last = mtbl_source_init(counting_iter, counting_get,
+						    counting_get, counting_get_range,
+						    NULL, &n_lookups);
+	mtbl_merger_add_source(m, last);
+
+	for (unsigned k = 0; k < NUM_KEYS; k += 7) {
+		char want[16];
+		test_fmt_key(want, k);
+		struct mtbl_iter *it = mtbl_source_get(mtbl_merger_source(m),
+						       (const uint8_t *) want, strlen(want));
+		if (it == NULL ||
+		    mtbl_iter_next(it, &key, &len_key, &val, &len_val) != mtbl_res_success ||
+		    len_val != 1 || val[0] != expected_val(k) ||
+		    mtbl_iter_next(it, &key, &len_key, &val, &len_val) != mtbl_res_failure)
+		{
+			ret |= 1;
+		}
+		mtbl_iter_destroy(&it);
+	}
+	/* the first source holds every key */
+	ret |= (n_lookups != 0);
+
+	/* a key which is not present in any source, so every source is searched */
+	struct mtbl_iter *it = mtbl_source_get(mtbl_merger_source(m),
+					       (const uint8_t *) "x", 1);
+	if (it != NULL &&
+	    mtbl_iter_next(it, &key, &len_key, &val, &len_val) != mtbl_res_failure)
+	{
+		ret |= 1;
+	}
+	mtbl_iter_destroy(&it);
+	ret |= (n_lookups != 1);
+
+	mtbl_merger_destroy(&m);
+	mtbl_source_destroy(&last);
+	return (ret);
+}
+
+/* without precedence, values are merged in the order of their sources */
+static int
+test3(void)
+{
+	int ret = 0;
+	struct mtbl_merger *m = merger_init(false);
+	struct mtbl_iter *it = mtbl_source_iter(mtbl_merger_source(m));
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	unsigned n = 0;
+
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		char want[NUM_SOURCES];
+		size_t len_want = 0;
+		for (unsigned i = 0; i < NUM_SOURCES; i++) {
+			if (n % (i + 1) == 0)
+				want[len_want++] = '0' + i;
+		}
+		if (len_val != len_want || memcmp(val, want, len_want) != 0) {
+			ret |= 1;
+			break;
+		}
+		n++;
+	}
+	if (n != NUM_KEYS)
+		ret |= 1;
+
+	mtbl_iter_destroy(&it);
+	mtbl_merger_destroy(&m);
+	return (ret);
+}
+
+/* seeking skips every source forward */
+static int
+test4(void)
+{
+	int ret = 0;
+	struct mtbl_merger *m = merger_init(true);
+	struct mtbl_iter *it = mtbl_source_iter(mtbl_merger_source(m));
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	char want[16];
+	unsigned n = 500;
+
+	test_fmt_key(want, n);
+	if (mtbl_iter_next(it, &key, &len_key, &val, &len_val) != mtbl_res_success ||
+	    mtbl_iter_seek(it, (const uint8_t *) want, strlen(want)) != mtbl_res_success)
+	{
+		ret |= 1;
+	}
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		test_fmt_key(want, n);
+		if (len_key != strlen(want) || memcmp(key, want, len_key) != 0 ||
+		    len_val != 1 || val[0] != expected_val(n))
+		{
+			ret |= 1;
+			break;
+		}
+		n++;
+	}
+	if (n != NUM_KEYS)
+		ret |= 1;
+
+	mtbl_iter_destroy(&it);
+	mtbl_merger_destroy(&m);
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	if (init_readers() != 0) {
+		fprintf(stderr, NAME ": FAIL: init_readers\n");
+		return (EXIT_FAILURE);
+	}
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+	ret |= check(test4(), "test4");
+
+	for (unsigned i = 0; i < NUM_SOURCES; i++)
+		mtbl_reader_destroy(&readers[i]);
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,257 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define NAME	"test-pin"
+
+#define NUM_KEYS	5000
+#define NUM_THREADS	4
+
+struct pinned {
+	const uint8_t		*val;
+	size_t			len_val;
+	struct mtbl_pin		*pin;
+};
+
+static size_t
+fmt_val(char *val, unsigned k, const void *clos)
+{
+	return (snprintf(val, 64, "value %08u value %08u value %08u", k, k * 3, k * 7));
+}
+
+static int
+check_val(const uint8_t *val, size_t len_val, unsigned k)
+{
+	char want[64];
+	size_t len_want = fmt_val(want, k, NULL);
+	return (len_val != len_want || memcmp(val, want, len_val) != 0);
+}
+
+/* every 'step'th key from 'k0', in a table of the given layout */
+static struct mtbl_reader *
+make_reader(unsigned k0, unsigned step, mtbl_compression_type compression, bool split_values)
+{
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_block_size(wopt, 1024);
+	mtbl_writer_options_set_compression(wopt, compression);
+	mtbl_writer_options_set_split_values(wopt, split_values);
+
+	struct mtbl_reader *r = test_reader_init(wopt, NULL, k0, NUM_KEYS, step, fmt_val, NULL);
+	mtbl_writer_options_destroy(&wopt);
+	return (r);
+}
+
+/*
+ * Pin every value of 's', then check them all after the iterator and, if
+ * given, the reader have been destroyed.
+ */
+static int
+check_pinned_scan(const struct mtbl_source *s, struct mtbl_reader **r, unsigned step)
+{
+	struct pinned *p = calloc(NUM_KEYS, sizeof(*p));
+	const uint8_t *key;
+	size_t len_key;
+	unsigned n = 0;
+	int ret = 0;
+
+	struct mtbl_iter *it = mtbl_source_iter(s);
+	while (n < NUM_KEYS &&
+	       mtbl_iter_next_pinned(it, &key, &len_key, &p[n].val, &p[n].len_val,
+				     &p[n].pin) == mtbl_res_success)
+	{
+		n++;
+	}
+	mtbl_iter_destroy(&it);
+	if (r != NULL)
+		mtbl_reader_destroy(r);
+
+	ret |= (n != (NUM_KEYS + step - 1) / step);
+	for (unsigned i = 0; i < n; i++) {
+		ret |= (p[i].pin == NULL);
+		ret |= check_val(p[i].val, p[i].len_val, i * step);
+		mtbl_pin_release(&p[i].pin);
+		ret |= (p[i].pin != NULL);
+	}
+	free(p);
+	return (ret);
+}
+
+/* values of readers outlive the iterator and the reader */
+static int
+test1(void)
+{
+	static const mtbl_compression_type compressions[] = {
+		MTBL_COMPRESSION_NONE,
+		MTBL_COMPRESSION_ZLIB,
+	};
+	int ret = 0;
+
+	for (size_t i = 0; i < sizeof(compressions) / sizeof(compressions[0]); i++) {
+		for (int split = 0; split <= 1; split++) {
+			struct mtbl_reader *r = make_reader(0, 1, compressions[i], split);
+			if (r == NULL)
+				return (1);
+			ret |= check_pinned_scan(mtbl_reader_source(r), NULL, 1);
+			ret |= check_pinned_scan(mtbl_reader_source(r), &r, 1);
+		}
+	}
+	return (ret);
+}
+
+static mtbl_res
+merge_func(void *clos,
+	   const uint8_t *key, size_t len_key,
+	   size_t n_vals,
+	   const uint8_t * const *vals, const size_t *len_vals,
+	   struct mtbl_buf *merged_val)
+{
+	mtbl_buf_append(merged_val, vals[0], len_vals[0]);
+	return (mtbl_res_success);
+}
+
+/* values of a merger are copied into their pins */
+static int
+test2(void)
+{
+	struct mtbl_reader *r0 = make_reader(0, 2, MTBL_COMPRESSION_ZLIB, false);
+	struct mtbl_reader *r1 = make_reader(1, 2, MTBL_COMPRESSION_ZLIB, false);
+	if (r0 == NULL || r1 == NULL)
+		return (1);
+
+	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+	mtbl_merger_options_set_merge_multi_func(mopt, merge_func, NULL);
+	struct mtbl_merger *m = mtbl_merger_init(mopt);
+	mtbl_merger_options_destroy(&mopt);
+	mtbl_merger_add_source(m, mtbl_reader_source(r0));
+	mtbl_merger_add_source(m, mtbl_reader_source(r1));
+
+	int ret = check_pinned_scan(mtbl_merger_source(m), NULL, 1);
+
+	mtbl_merger_destroy(&m);
+	mtbl_reader_destroy(&r0);
+	mtbl_reader_destroy(&r1);
+	return (ret);
+}
+
+/* a pin retained twice needs to be released twice */
+static int
+test3(void)
+{
+	const uint8_t *key, *val, *val2;
+	size_t len_key, len_val, len_val2;
+	struct mtbl_pin *pin, *pin2;
+	int ret = 0;
+
+	struct mtbl_reader *r = make_reader(0, 1, MTBL_COMPRESSION_ZLIB, false);
+	if (r == NULL)
+		return (1);
+	struct mtbl_iter *it = mtbl_source_get(mtbl_reader_source(r), (const uint8_t *) "00000042", 8);
+	if (mtbl_iter_next_pinned(it, &key, &len_key, &val, &len_val, &pin) != mtbl_res_success)
+		return (1);
+	ret |= (mtbl_iter_next_pinned(it, &key, &len_key, &val2, &len_val2, &pin2) != mtbl_res_failure);
+	ret |= (pin2 != NULL);
+	mtbl_iter_destroy(&it);
+
+	pin2 = mtbl_pin_retain(pin);
+	ret |= (pin2 != pin);
+	mtbl_pin_release(&pin);
+	ret |= check_val(val, len_val, 42);
+	mtbl_pin_release(&pin2);
+	mtbl_reader_destroy(&r);
+	return (ret);
+}
+
+struct worker {
+	pthread_t		thr;
+	struct pinned		*p;
+	unsigned		first;
+	unsigned		n;
+	int			ret;
+};
+
+static void *
+worker_thr(void *arg)
+{
+	struct worker *wk = (struct worker *) arg;
+	for (unsigned i = 0; i < wk->n; i++) {
+		struct pinned *p = &wk->p[wk->first + i];
+		wk->ret |= check_val(p->val, p->len_val, wk->first + i);
+		mtbl_pin_release(&p->pin);
+	}
+	return (NULL);
+}
+
+/* pins handed to other threads, which release them concurrently */
+static int
+test4(void)
+{
+	struct pinned *p = calloc(NUM_KEYS, sizeof(*p));
+	struct worker workers[NUM_THREADS];
+	const uint8_t *key;
+	size_t len_key;
+	unsigned n = 0;
+	int ret = 0;
+
+	struct mtbl_reader *r = make_reader(0, 1, MTBL_COMPRESSION_ZLIB, true);
+	if (r == NULL)
+		return (1);
+	struct mtbl_iter *it = mtbl_source_iter(mtbl_reader_source(r));
+	while (n < NUM_KEYS &&
+	       mtbl_iter_next_pinned(it, &key, &len_key, &p[n].val, &p[n].len_val,
+				     &p[n].pin) == mtbl_res_success)
+	{
+		n++;
+	}
+	mtbl_iter_destroy(&it);
+	mtbl_reader_destroy(&r);
+	if (n != NUM_KEYS)
+		return (1);
+
+	for (unsigned i = 0; i < NUM_THREADS; i++) {
+		workers[i].p = p;
+		workers[i].first = i * (NUM_KEYS / NUM_THREADS);
+		workers[i].n = NUM_KEYS / NUM_THREADS;
+		workers[i].ret = 0;
+		pthread_create(&workers[i].thr, NULL, worker_thr, &workers[i]);
+	}
+	for (unsigned i = 0; i < NUM_THREADS; i++) {
+		pthread_join(workers[i].thr, NULL);
+		ret |= workers[i].ret;
+	}
+	free(p);
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+	ret |= check(test4(), "test4");
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,695 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "mtbl-private.h"
+
+#define NAME	"test-sorter"
+
+#define NUM_KEYS	200000
+#define NUM_ENTRIES	800000
+#define LEN_PADDING	64
+
+static void
+merge_func(void *clos,
+	   const uint8_t *key, size_t len_key,
+	   const uint8_t *val0, size_t len_val0,
+	   const uint8_t *val1, size_t len_val1,
+	   uint8_t **merged_val, size_t *len_merged_val)
+{
+	assert(len_val0 >= sizeof(uint64_t));
+	assert(len_val1 >= sizeof(uint64_t));
+	*len_merged_val = len_val0;
+	*merged_val = my_malloc(len_val0);
+	memcpy(*merged_val, val0, len_val0);
+	mtbl_fixed_encode64(*merged_val,
+			    mtbl_fixed_decode64(val0) + mtbl_fixed_decode64(val1));
+}
+
+static mtbl_res
+merge_buf_func(void *clos,
+	       const uint8_t *key, size_t len_key,
+	       const uint8_t *val0, size_t len_val0,
+	       const uint8_t *val1, size_t len_val1,
+	       struct mtbl_buf *merged_val)
+{
+	if (len_val0 < sizeof(uint64_t) || len_val1 < sizeof(uint64_t))
+		return (mtbl_res_failure);
+	uint8_t *p = mtbl_buf_extend(merged_val, len_val0);
+	memcpy(p, val0, len_val0);
+	mtbl_fixed_encode64(p, mtbl_fixed_decode64(val0) + mtbl_fixed_decode64(val1));
+	return (mtbl_res_success);
+}
+
+static mtbl_res
+merge_multi_func(void *clos,
+		 const uint8_t *key, size_t len_key,
+		 size_t n_vals,
+		 const uint8_t * const *vals, const size_t *len_vals,
+		 struct mtbl_buf *merged_val)
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < n_vals; i++) {
+		if (len_vals[i] < sizeof(uint64_t))
+			return (mtbl_res_failure);
+		total += mtbl_fixed_decode64(vals[i]);
+	}
+	uint8_t *p = mtbl_buf_extend(merged_val, len_vals[0]);
+	memcpy(p, vals[0], len_vals[0]);
+	mtbl_fixed_encode64(p, total);
+	return (mtbl_res_success);
+}
+
+static struct mtbl_sorter *
+sorter_init(size_t max_fan_in, bool preaggregate)
+{
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_func(sopt, merge_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_max_fan_in(sopt, max_fan_in);
+	mtbl_sorter_options_set_preaggregate(sopt, preaggregate);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+	return (s);
+}
+
+/*
+ * Add NUM_ENTRIES entries drawn from 'n_keys' distinct keys, each with a
+ * counter value of 1, and check that the sorted output contains every key
+ * exactly once, in order, with the correct total count.
+ */
+static int
+check_sorter_keys(struct mtbl_sorter *s, unsigned n_keys)
+{
+	int ret = 0;
+	uint8_t key[16], val[sizeof(uint64_t) + LEN_PADDING];
+	uint32_t x = 1;
+
+	memset(val, 0, sizeof(val));
+	mtbl_fixed_encode64(val, 1);
+	for (unsigned i = 0; i < NUM_ENTRIES; i++) {
+		x = x * 1103515245 + 12345;
+		snprintf((char *) key, sizeof(key), "%010u", (x >> 1) % n_keys);
+		if (mtbl_sorter_add(s, key, 10, val, sizeof(val)) != mtbl_res_success)
+			return (1);
+	}
+
+	struct mtbl_iter *it = mtbl_sorter_iter(s);
+	if (it == NULL)
+		return (1);
+
+	const uint8_t *k, *v;
+	size_t len_k, len_v;
+	uint8_t last_key[16];
+	size_t len_last_key = 0;
+	uint64_t n_out = 0, total = 0;
+	while (mtbl_iter_next(it, &k, &len_k, &v, &len_v) == mtbl_res_success) {
+		if (len_last_key > 0 &&
+		    bytes_compare(last_key, len_last_key, k, len_k) >= 0)
+		{
+			fprintf(stderr, NAME ": keys out of order\n");
+			ret |= 1;
+		}
+		memcpy(last_key, k, len_k);
+		len_last_key = len_k;
+		n_out += 1;
+		total += mtbl_fixed_decode64(v);
+	}
+	mtbl_iter_destroy(&it);
+
+	if (total != NUM_ENTRIES) {
+		fprintf(stderr, NAME ": total %" PRIu64 " != %u\n", total, NUM_ENTRIES);
+		ret |= 1;
+	}
+	if (n_out > n_keys) {
+		fprintf(stderr, NAME ": %" PRIu64 " keys > %u\n", n_out, n_keys);
+		ret |= 1;
+	}
+	return (ret);
+}
+
+static int
+check_sorter(struct mtbl_sorter *s)
+{
+	return (check_sorter_keys(s, NUM_KEYS));
+}
+
+static int
+test1(void)
+{
+	struct mtbl_sorter *s = sorter_init(0, false);
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+static int
+test2(void)
+{
+	struct mtbl_sorter *s = sorter_init(2, false);
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+/*
+ * With few distinct keys, pre-aggregation keeps a single entry per key in
+ * memory, so nothing is spilled, while the same input fills the buffer many
+ * times over without it.
+ */
+static int
+test3(void)
+{
+	struct mtbl_sorter_stats plain, preaggregated;
+
+	struct mtbl_sorter *s = sorter_init(0, false);
+	int ret = check_sorter_keys(s, NUM_KEYS / 10);
+	mtbl_sorter_stats(s, &plain);
+	mtbl_sorter_destroy(&s);
+
+	s = sorter_init(0, true);
+	ret |= check_sorter_keys(s, NUM_KEYS / 10);
+	mtbl_sorter_stats(s, &preaggregated);
+	mtbl_sorter_destroy(&s);
+
+	if (plain.count_spills == 0 || preaggregated.count_spills != 0 ||
+	    preaggregated.bytes_spilled != 0 ||
+	    preaggregated.count_merges < NUM_ENTRIES - NUM_KEYS / 10)
+	{
+		ret |= 1;
+	}
+	return (ret);
+}
+
+static int
+test4(void)
+{
+	int ret = 0;
+	struct mtbl_sorter *s = sorter_init(0, false);
+	struct mtbl_sorter_stats stats;
+	uint8_t key[16], val[sizeof(uint64_t) + LEN_PADDING];
+
+	/* sorted input, with each key added twice */
+	memset(val, 0, sizeof(val));
+	mtbl_fixed_encode64(val, 1);
+	for (unsigned i = 0; i < NUM_ENTRIES; i++) {
+		snprintf((char *) key, sizeof(key), "%010u", i / 2);
+		if (mtbl_sorter_add(s, key, 10, val, sizeof(val)) != mtbl_res_success)
+			ret |= 1;
+	}
+
+	mtbl_sorter_stats(s, &stats);
+	if (stats.count_spills == 0 ||
+	    stats.count_spills != stats.count_spills_presorted ||
+	    stats.count_runs != 1)
+	{
+		fprintf(stderr, NAME ": spills %" PRIu64 " presorted %" PRIu64
+			" runs %" PRIu64 "\n", stats.count_spills,
+			stats.count_spills_presorted, stats.count_runs);
+		ret |= 1;
+	}
+
+	struct mtbl_iter *it = mtbl_sorter_iter(s);
+	const uint8_t *k, *v;
+	size_t len_k, len_v;
+	unsigned n = 0;
+	while (mtbl_iter_next(it, &k, &len_k, &v, &len_v) == mtbl_res_success) {
+		snprintf((char *) key, sizeof(key), "%010u", n++);
+		if (len_k != 10 || memcmp(k, key, 10) != 0 ||
+		    mtbl_fixed_decode64(v) != 2)
+		{
+			ret |= 1;
+		}
+	}
+	if (n != NUM_ENTRIES / 2)
+		ret |= 1;
+	mtbl_iter_destroy(&it);
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+static int
+test5(void)
+{
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_func(sopt, merge_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, 8 * MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_sort_threads(sopt, 4);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+static int
+test6(void)
+{
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_func(sopt, merge_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, 2 * MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_max_fan_in(sopt, 4);
+	mtbl_sorter_options_set_background_spill(sopt, true);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+static int
+test7(void)
+{
+	int ret = 0;
+	struct mtbl_sorter *s = sorter_init(0, false);
+	struct mtbl_sorter_stats stats;
+	uint8_t key[16], val[sizeof(uint64_t)];
+
+	mtbl_fixed_encode64(val, 1);
+	for (unsigned i = 0; i < 1000; i++) {
+		snprintf((char *) key, sizeof(key), "%010u", (i * 7919) % 500);
+		if (mtbl_sorter_add(s, key, 10, val, sizeof(val)) != mtbl_res_success)
+			ret |= 1;
+	}
+
+	struct mtbl_iter *it = mtbl_sorter_iter(s);
+	const uint8_t *k, *v;
+	size_t len_k, len_v;
+	unsigned n = 0;
+	while (mtbl_iter_next(it, &k, &len_k, &v, &len_v) == mtbl_res_success) {
+		snprintf((char *) key, sizeof(key), "%010u", n++);
+		if (len_k != 10 || memcmp(k, key, 10) != 0 ||
+		    mtbl_fixed_decode64(v) != 2)
+		{
+			ret |= 1;
+		}
+	}
+	if (n != 500)
+		ret |= 1;
+	mtbl_iter_destroy(&it);
+
+	/* everything fit in memory, nothing should have been written to disk */
+	mtbl_sorter_stats(s, &stats);
+	if (stats.count_spills != 0 || stats.count_runs != 0 || stats.bytes_spilled != 0)
+		ret |= 1;
+
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+#define NUM_PRODUCERS	4
+
+static void *
+producer_thr(void *arg)
+{
+	struct mtbl_sorter *s = (struct mtbl_sorter *) arg;
+	uint8_t key[16], val[sizeof(uint64_t) + LEN_PADDING];
+	uint32_t x = 1;
+
+	memset(val, 0, sizeof(val));
+	mtbl_fixed_encode64(val, 1);
+	for (unsigned i = 0; i < NUM_ENTRIES / NUM_PRODUCERS; i++) {
+		x = x * 1103515245 + 12345;
+		snprintf((char *) key, sizeof(key), "%010u", (x >> 1) % NUM_KEYS);
+		if (mtbl_sorter_add(s, key, 10, val, sizeof(val)) != mtbl_res_success)
+			return (s);
+	}
+	return (NULL);
+}
+
+static int
+test8(void)
+{
+	int ret = 0;
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_func(sopt, merge_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, 2 * MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_max_fan_in(sopt, 4);
+	mtbl_sorter_options_set_thread_safe(sopt, true);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+
+	pthread_t thr[NUM_PRODUCERS];
+	for (size_t i = 0; i < NUM_PRODUCERS; i++) {
+		int thr_ret = pthread_create(&thr[i], NULL, producer_thr, s);
+		assert(thr_ret == 0);
+	}
+	for (size_t i = 0; i < NUM_PRODUCERS; i++) {
+		void *thr_res;
+		int thr_ret = pthread_join(thr[i], &thr_res);
+		assert(thr_ret == 0);
+		if (thr_res != NULL)
+			ret |= 1;
+	}
+
+	struct mtbl_sorter_stats stats;
+	mtbl_sorter_stats(s, &stats);
+	if (stats.count_entries != NUM_ENTRIES || stats.count_spills == 0)
+		ret |= 1;
+
+	struct mtbl_iter *it = mtbl_sorter_iter(s);
+	const uint8_t *k, *v;
+	size_t len_k, len_v;
+	uint8_t last_key[16];
+	size_t len_last_key = 0;
+	uint64_t total = 0;
+	while (mtbl_iter_next(it, &k, &len_k, &v, &len_v) == mtbl_res_success) {
+		if (len_last_key > 0 &&
+		    bytes_compare(last_key, len_last_key, k, len_k) >= 0)
+		{
+			ret |= 1;
+		}
+		memcpy(last_key, k, len_k);
+		len_last_key = len_k;
+		total += mtbl_fixed_decode64(v);
+	}
+	mtbl_iter_destroy(&it);
+	if (total != NUM_ENTRIES)
+		ret |= 1;
+
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+/*
+ * Chunks are unlinked as soon as they are created, so whether a temporary
+ * directory was used is told by its modification time, which is reset first.
+ */
+static bool
+dir_used(const char *dname)
+{
+	struct stat ss;
+	return (stat(dname, &ss) == 0 && ss.st_mtime != 0);
+}
+
+static int
+check_temp_dirs(mtbl_sorter_temp_placement temp_placement, bool want_both)
+{
+	const struct timeval epoch[2] = { { 0, 0 }, { 0, 0 } };
+	char dname0[] = "/tmp/test-sorter.XXXXXX";
+	char dname1[] = "/tmp/test-sorter.XXXXXX";
+	if (mkdtemp(dname0) == NULL || mkdtemp(dname1) == NULL)
+		return (1);
+	if (utimes(dname0, epoch) != 0 || utimes(dname1, epoch) != 0)
+		return (1);
+
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_func(sopt, merge_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_temp_dir(sopt, dname0);
+	mtbl_sorter_options_add_temp_dir(sopt, dname1);
+	mtbl_sorter_options_set_temp_placement(sopt, temp_placement);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+
+	bool used0 = dir_used(dname0), used1 = dir_used(dname1);
+	if (want_both)
+		ret |= !(used0 && used1);
+	else
+		ret |= !(used0 || used1);
+	rmdir(dname0);
+	rmdir(dname1);
+	return (ret);
+}
+
+static int
+test9(void)
+{
+	int ret = 0;
+	ret |= check_temp_dirs(MTBL_SORTER_TEMP_FREE_SPACE, false);
+	ret |= check_temp_dirs(MTBL_SORTER_TEMP_ROUND_ROBIN, true);
+	return (ret);
+}
+
+#define NUM_PARTITIONS	4
+
+static struct mtbl_sorter *
+sorter_init_partitioned(void)
+{
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_func(sopt, merge_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, 4 * MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_partitions(sopt, NUM_PARTITIONS);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+	return (s);
+}
+
+static int
+test10(void)
+{
+	struct mtbl_sorter *s = sorter_init_partitioned();
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+
+	/* partitioned sorters cannot be thread-safe */
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_func(sopt, merge_func, NULL);
+	mtbl_sorter_options_set_partitions(sopt, NUM_PARTITIONS);
+	mtbl_sorter_options_set_thread_safe(sopt, true);
+	s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+	if (s != NULL) {
+		mtbl_sorter_destroy(&s);
+		ret |= 1;
+	}
+	return (ret);
+}
+
+static int
+test11(void)
+{
+	int ret = 0;
+	struct mtbl_sorter *s = sorter_init_partitioned();
+	uint8_t key[16], val[sizeof(uint64_t)];
+	uint32_t x = 1;
+
+	mtbl_fixed_encode64(val, 1);
+	for (unsigned i = 0; i < NUM_ENTRIES; i++) {
+		x = x * 1103515245 + 12345;
+		snprintf((char *) key, sizeof(key), "%010u", (x >> 1) % NUM_KEYS);
+		if (mtbl_sorter_add(s, key, 10, val, sizeof(val)) != mtbl_res_success)
+			ret |= 1;
+	}
+
+	/* entries merged while sampling are counted like any others */
+	struct mtbl_sorter_stats stats;
+	mtbl_sorter_stats(s, &stats);
+	if (stats.count_entries != NUM_ENTRIES)
+		ret |= 1;
+
+	FILE *fp[NUM_PARTITIONS];
+	struct mtbl_writer *w[NUM_PARTITIONS];
+	for (size_t i = 0; i < NUM_PARTITIONS; i++) {
+		fp[i] = tmpfile();
+		assert(fp[i] != NULL);
+		w[i] = mtbl_writer_init_fd(fileno(fp[i]), NULL);
+	}
+	if (mtbl_sorter_write_partitions(s, w, NUM_PARTITIONS) != mtbl_res_success)
+		ret |= 1;
+	mtbl_sorter_destroy(&s);
+
+	/* the partitions concatenated in order must be sorted */
+	uint8_t last_key[16];
+	size_t len_last_key = 0;
+	uint64_t total = 0;
+	for (size_t i = 0; i < NUM_PARTITIONS; i++) {
+		mtbl_writer_destroy(&w[i]);
+		struct mtbl_reader *r = mtbl_reader_init_fd(fileno(fp[i]), NULL);
+		assert(r != NULL);
+		struct mtbl_iter *it = mtbl_source_iter(mtbl_reader_source(r));
+		const uint8_t *k, *v;
+		size_t len_k, len_v;
+		while (mtbl_iter_next(it, &k, &len_k, &v, &len_v) == mtbl_res_success) {
+			if (len_last_key > 0 &&
+			    bytes_compare(last_key, len_last_key, k, len_k) >= 0)
+			{
+				ret |= 1;
+			}
+			memcpy(last_key, k, len_k);
+			len_last_key = len_k;
+			total += mtbl_fixed_decode64(v);
+		}
+		mtbl_iter_destroy(&it);
+		mtbl_reader_destroy(&r);
+		fclose(fp[i]);
+	}
+	if (total != NUM_ENTRIES)
+		ret |= 1;
+	return (ret);
+}
+
+static int
+test12(void)
+{
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_func(sopt, merge_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_readahead_threads(sopt, 2);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+static int
+test13(void)
+{
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_buf_func(sopt, merge_buf_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_max_fan_in(sopt, 2);
+	mtbl_sorter_options_set_preaggregate(sopt, true);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+static int
+test14(void)
+{
+	struct mtbl_sorter_options *sopt = mtbl_sorter_options_init();
+	mtbl_sorter_options_set_merge_multi_func(sopt, merge_multi_func, NULL);
+	mtbl_sorter_options_set_max_memory(sopt, MIN_SORTER_MEMORY);
+	mtbl_sorter_options_set_max_fan_in(sopt, 4);
+	struct mtbl_sorter *s = mtbl_sorter_init(sopt);
+	mtbl_sorter_options_destroy(&sopt);
+
+	int ret = check_sorter(s);
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+/*
+ * The iterator may outlive the sorter, both for the chunks on disk and for
+ * the final buffer read from memory.
+ */
+static int
+test15(void)
+{
+	int ret = 0;
+	struct mtbl_sorter *s = sorter_init(0, false);
+	struct mtbl_sorter_stats stats;
+	uint8_t key[16], val[sizeof(uint64_t) + LEN_PADDING];
+
+	memset(val, 0, sizeof(val));
+	mtbl_fixed_encode64(val, 1);
+	for (unsigned i = 0; i < NUM_ENTRIES / 2; i++) {
+		snprintf((char *) key, sizeof(key), "%010u", (i * 7919) % (NUM_ENTRIES / 2));
+		if (mtbl_sorter_add(s, key, 10, val, sizeof(val)) != mtbl_res_success)
+			ret |= 1;
+	}
+	mtbl_sorter_stats(s, &stats);
+	if (stats.count_spills == 0)
+		ret |= 1;
+
+	struct mtbl_iter *it = mtbl_sorter_iter(s);
+	mtbl_sorter_destroy(&s);
+
+	const uint8_t *k, *v;
+	size_t len_k, len_v;
+	unsigned n = 0;
+	while (mtbl_iter_next(it, &k, &len_k, &v, &len_v) == mtbl_res_success) {
+		snprintf((char *) key, sizeof(key), "%010u", n++);
+		if (len_k != 10 || memcmp(k, key, 10) != 0 ||
+		    mtbl_fixed_decode64(v) != 1)
+		{
+			ret |= 1;
+		}
+	}
+	if (n != NUM_ENTRIES / 2)
+		ret |= 1;
+	mtbl_iter_destroy(&it);
+	return (ret);
+}
+
+/* the duplicates within each spill are merged before it is written */
+static int
+test16(void)
+{
+	int ret = 0;
+	struct mtbl_sorter *s = sorter_init(0, false);
+	struct mtbl_sorter_stats stats;
+	uint8_t key[16], val[sizeof(uint64_t) + LEN_PADDING];
+
+	memset(val, 0, sizeof(val));
+	mtbl_fixed_encode64(val, 1);
+	for (unsigned i = 0; i < NUM_ENTRIES; i++) {
+		snprintf((char *) key, sizeof(key), "%010u", i / 2);
+		if (mtbl_sorter_add(s, key, 10, val, sizeof(val)) != mtbl_res_success)
+			ret |= 1;
+	}
+	mtbl_sorter_stats(s, &stats);
+	ret |= (stats.count_spills == 0 || stats.count_runs != 1);
+
+	struct mtbl_iter *it = mtbl_sorter_iter(s);
+	const uint8_t *k, *v;
+	size_t len_k, len_v;
+	while (mtbl_iter_next(it, &k, &len_k, &v, &len_v) == mtbl_res_success);
+	mtbl_iter_destroy(&it);
+
+	/* a single run needs no intermediate merges */
+	mtbl_sorter_stats(s, &stats);
+	ret |= (stats.count_merges < NUM_ENTRIES / 2);
+	ret |= (stats.bytes_spilled == 0 || stats.time_spills_ns == 0);
+	ret |= (stats.bytes_merged != 0);
+
+	mtbl_sorter_destroy(&s);
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+	ret |= check(test4(), "test4");
+	ret |= check(test5(), "test5");
+	ret |= check(test6(), "test6");
+	ret |= check(test7(), "test7");
+	ret |= check(test8(), "test8");
+	ret |= check(test9(), "test9");
+	ret |= check(test10(), "test10");
+	ret |= check(test11(), "test11");
+	ret |= check(test12(), "test12");
+	ret |= check(test13(), "test13");
+	ret |= check(test14(), "test14");
+	ret |= check(test15(), "test15");
+	ret |= check(test16(), "test16");
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
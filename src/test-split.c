@@ -0,0 +1,237 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define NAME	"test-split"
+
+#define NUM_SOURCES	2
+#define NUM_KEYS	50000
+#define MAX_SPLITS	16
+#define BATCH_SIZE	50
+
+static struct mtbl_reader	*readers[NUM_SOURCES];
+static struct mtbl_merger	*merger;
+
+/* the value of each entry is its key */
+static size_t
+fmt_val(char *val, unsigned k, const void *clos)
+{
+	test_fmt_key(val, k);
+	return (strlen(val));
+}
+
+static unsigned
+parse_key(const uint8_t *key, size_t len_key)
+{
+	char buf[16];
+	assert(len_key < sizeof(buf));
+	memcpy(buf, key, len_key);
+	buf[len_key] = '\0';
+	return (strtoul(buf, NULL, 10));
+}
+
+/* source i contains the keys k with k % NUM_SOURCES == i */
+static int
+init_sources(void)
+{
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_block_size(wopt, 1024);
+
+	for (unsigned i = 0; i < NUM_SOURCES; i++) {
+		readers[i] = test_reader_init(wopt, NULL, i, NUM_KEYS, NUM_SOURCES, fmt_val, NULL);
+		if (readers[i] == NULL)
+			return (1);
+	}
+	mtbl_writer_options_destroy(&wopt);
+
+	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+	mtbl_merger_options_set_precedence(mopt, true);
+	merger = mtbl_merger_init(mopt);
+	mtbl_merger_options_destroy(&mopt);
+	for (unsigned i = 0; i < NUM_SOURCES; i++)
+		mtbl_merger_add_source(merger, mtbl_reader_source(readers[i]));
+	return (0);
+}
+
+/*
+ * Check that the ranges returned by splitting 's' into 'n' cover the keys
+ * [0, n_keys) with step 'step', in order and without overlap, and that none
+ * of them is much larger than its share.
+ */
+static int
+check_split(const struct mtbl_source *s, size_t n, unsigned n_keys, unsigned step, bool batch)
+{
+	struct mtbl_iter *iters[MAX_SPLITS];
+	unsigned k = 0;
+	int ret = 0;
+
+	size_t n_iters = mtbl_source_split(s, n, iters);
+	if (n_iters == 0 || n_iters > n)
+		return (1);
+	if (n > 1 && n_iters < 2)
+		ret = 1;
+
+	for (size_t i = 0; i < n_iters; i++) {
+		unsigned count = 0;
+		if (batch) {
+			struct mtbl_kv kv[BATCH_SIZE];
+			size_t n_kv;
+			while ((n_kv = mtbl_iter_next_batch(iters[i], kv, BATCH_SIZE)) > 0) {
+				for (size_t j = 0; j < n_kv; j++, count++, k += step) {
+					if (parse_key(kv[j].key, kv[j].len_key) != k)
+						ret = 1;
+				}
+			}
+		} else {
+			const uint8_t *key, *val;
+			size_t len_key, len_val;
+			while (mtbl_iter_next(iters[i], &key, &len_key, &val, &len_val) ==
+			       mtbl_res_success)
+			{
+				if (parse_key(key, len_key) != k ||
+				    len_val != len_key || memcmp(key, val, len_key) != 0)
+				{
+					ret = 1;
+				}
+				count++;
+				k += step;
+			}
+		}
+		if (count > 2 * (n_keys / step) / n + 1000)
+			ret = 1;
+		mtbl_iter_destroy(&iters[i]);
+	}
+	if (k != n_keys)
+		ret = 1;
+	return (ret);
+}
+
+/* a single reader */
+static int
+test1(void)
+{
+	int ret = 0;
+	const struct mtbl_source *s = mtbl_reader_source(readers[0]);
+	for (size_t n = 1; n <= MAX_SPLITS; n++) {
+		ret |= check_split(s, n, NUM_KEYS, NUM_SOURCES, false);
+		ret |= check_split(s, n, NUM_KEYS, NUM_SOURCES, true);
+	}
+	return (ret);
+}
+
+/* the merger of the readers, split by their combined indexes */
+static int
+test2(void)
+{
+	int ret = 0;
+	const struct mtbl_source *s = mtbl_merger_source(merger);
+	for (size_t n = 1; n <= MAX_SPLITS; n++) {
+		ret |= check_split(s, n, NUM_KEYS, 1, false);
+		ret |= check_split(s, n, NUM_KEYS, 1, true);
+	}
+	return (ret);
+}
+
+/* a source without an index is not split */
+static int
+test3(void)
+{
+	int ret = 0;
+	const struct mtbl_source *sources[1] = { mtbl_merger_source(merger) };
+	struct mtbl_source *s = mtbl_source_intersection(sources, 1);
+	struct mtbl_iter *iters[MAX_SPLITS];
+
+	size_t n_iters = mtbl_source_split(s, MAX_SPLITS, iters);
+	ret |= (n_iters != 1);
+	for (size_t i = 0; i < n_iters; i++)
+		mtbl_iter_destroy(&iters[i]);
+	mtbl_source_destroy(&s);
+	return (ret);
+}
+
+struct worker {
+	pthread_t		thr;
+	struct mtbl_iter	*it;
+	uint64_t		count;
+	uint64_t		sum;
+};
+
+static void *
+worker_thr(void *arg)
+{
+	struct worker *wk = (struct worker *) arg;
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+
+	while (mtbl_iter_next(wk->it, &key, &len_key, &val, &len_val) == mtbl_res_success) {
+		wk->count++;
+		wk->sum += parse_key(key, len_key);
+	}
+	return (NULL);
+}
+
+/* the ranges of the merger, iterated concurrently */
+static int
+test4(void)
+{
+	struct mtbl_iter *iters[MAX_SPLITS];
+	struct worker workers[MAX_SPLITS];
+	uint64_t count = 0, sum = 0;
+
+	size_t n_iters = mtbl_source_split(mtbl_merger_source(merger), MAX_SPLITS, iters);
+	memset(workers, 0, sizeof(workers));
+	for (size_t i = 0; i < n_iters; i++) {
+		workers[i].it = iters[i];
+		pthread_create(&workers[i].thr, NULL, worker_thr, &workers[i]);
+	}
+	for (size_t i = 0; i < n_iters; i++) {
+		pthread_join(workers[i].thr, NULL);
+		count += workers[i].count;
+		sum += workers[i].sum;
+		mtbl_iter_destroy(&iters[i]);
+	}
+	return (count != NUM_KEYS || sum != (uint64_t) NUM_KEYS * (NUM_KEYS - 1) / 2);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	if (init_sources() != 0) {
+		fprintf(stderr, NAME ": FAIL: init_sources\n");
+		return (EXIT_FAILURE);
+	}
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+	ret |= check(test4(), "test4");
+
+	mtbl_merger_destroy(&merger);
+	for (unsigned i = 0; i < NUM_SOURCES; i++)
+		mtbl_reader_destroy(&readers[i]);
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}
@@ -0,0 +1,222 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mtbl.h>
+
+#include "test-common.h"
+
+#define NAME	"test-stats"
+
+#define NUM_KEYS	10000
+#define NUM_THREADS	4
+#define NUM_OPS		1000
+
+/* a checksummed and timed reader, holding every 'step'th key from 'k0' */
+static struct mtbl_reader *
+make_reader(unsigned k0, unsigned step, bool split_values)
+{
+	struct mtbl_writer_options *wopt = mtbl_writer_options_init();
+	mtbl_writer_options_set_block_size(wopt, 1024);
+	mtbl_writer_options_set_compression(wopt, MTBL_COMPRESSION_ZLIB);
+	mtbl_writer_options_set_split_values(wopt, split_values);
+
+	struct mtbl_reader_options *ropt = mtbl_reader_options_init();
+	mtbl_reader_options_set_verify_checksums(ropt, true);
+	mtbl_reader_options_set_timing(ropt, true);
+
+	struct mtbl_reader *r = test_reader_init(wopt, ropt, k0, NUM_KEYS, step,
+						 test_val_str, "value value value");
+	mtbl_writer_options_destroy(&wopt);
+	mtbl_reader_options_destroy(&ropt);
+	return (r);
+}
+
+static unsigned
+drain(struct mtbl_iter *it)
+{
+	const uint8_t *key, *val;
+	size_t len_key, len_val;
+	unsigned n = 0;
+
+	while (mtbl_iter_next(it, &key, &len_key, &val, &len_val) == mtbl_res_success)
+		n++;
+	mtbl_iter_destroy(&it);
+	return (n);
+}
+
+/* reader counters for scans and lookups */
+static int
+test1(void)
+{
+	int ret = 0;
+	struct mtbl_reader_stats st;
+	struct mtbl_reader *r = make_reader(0, 1, false);
+	if (r == NULL)
+		return (1);
+	const struct mtbl_source *s = mtbl_reader_source(r);
+
+	mtbl_reader_stats(r, &st);
+	ret |= (st.count_iters != 0 || st.count_blocks_read != 0);
+
+	ret |= (drain(mtbl_source_iter(s)) != NUM_KEYS);
+	mtbl_reader_stats(r, &st);
+	ret |= (st.count_iters != 1);
+	ret |= (st.count_index_seeks != 0);
+	ret |= (st.count_blocks_read < 2);
+	ret |= (st.count_blocks_decompressed != st.count_blocks_read);
+	ret |= (st.count_checksums_verified != st.count_blocks_read);
+	ret |= (st.bytes_read == 0 || st.bytes_decompressed <= st.bytes_read);
+	ret |= (st.time_blocks_ns == 0);
+
+	uint64_t n_blocks = st.count_blocks_read;
+	ret |= (drain(mtbl_source_get(s, (const uint8_t *) "00001234", 8)) != 1);
+	mtbl_reader_stats(r, &st);
+	ret |= (st.count_iters != 2);
+	ret |= (st.count_index_seeks != 1);
+	ret |= (st.count_blocks_read < n_blocks + 1);
+
+	mtbl_reader_destroy(&r);
+	return (ret);
+}
+
+/* with split values, key-only scans read only the data blocks */
+static int
+test2(void)
+{
+	int ret = 0;
+	struct mtbl_reader_stats st;
+	struct mtbl_reader *r = make_reader(0, 1, true);
+	if (r == NULL)
+		return (1);
+	const struct mtbl_source *s = mtbl_reader_source(r);
+
+	ret |= (drain(mtbl_source_iter_keys(s)) != NUM_KEYS);
+	mtbl_reader_stats(r, &st);
+	uint64_t n_blocks = st.count_blocks_read;
+
+	ret |= (drain(mtbl_source_iter(s)) != NUM_KEYS);
+	mtbl_reader_stats(r, &st);
+	ret |= (st.count_blocks_read != 3 * n_blocks);
+
+	mtbl_reader_destroy(&r);
+	return (ret);
+}
+
+static mtbl_res
+merge_func(void *clos,
+	   const uint8_t *key, size_t len_key,
+	   size_t n_vals,
+	   const uint8_t * const *vals, const size_t *len_vals,
+	   struct mtbl_buf *merged_val)
+{
+	mtbl_buf_append(merged_val, vals[0], len_vals[0]);
+	return (mtbl_res_success);
+}
+
+/* merger counters, with the keys which are multiples of 6 in both sources */
+static int
+test3(void)
+{
+	int ret = 0;
+	struct mtbl_merger_stats st;
+	struct mtbl_reader *r0 = make_reader(0, 2, false);
+	struct mtbl_reader *r1 = make_reader(0, 3, false);
+	if (r0 == NULL || r1 == NULL)
+		return (1);
+
+	struct mtbl_merger_options *mopt = mtbl_merger_options_init();
+	mtbl_merger_options_set_merge_multi_func(mopt, merge_func, NULL);
+	struct mtbl_merger *m = mtbl_merger_init(mopt);
+	mtbl_merger_options_destroy(&mopt);
+	mtbl_merger_add_source(m, mtbl_reader_source(r0));
+	mtbl_merger_add_source(m, mtbl_reader_source(r1));
+
+	unsigned n = drain(mtbl_source_iter(mtbl_merger_source(m)));
+	unsigned n_both = (NUM_KEYS + 5) / 6;
+	mtbl_merger_stats(m, &st);
+	ret |= (st.count_iters != 1);
+	ret |= (st.count_entries != n);
+	ret |= (st.count_duplicates != n_both);
+	ret |= (st.count_merges != n_both);
+	ret |= (st.count_seeks != 0);
+
+	struct mtbl_iter *it = mtbl_source_iter(mtbl_merger_source(m));
+	ret |= (mtbl_iter_seek(it, (const uint8_t *) "00005000", 8) != mtbl_res_success);
+	mtbl_iter_destroy(&it);
+	mtbl_merger_stats(m, &st);
+	ret |= (st.count_iters != 2);
+	ret |= (st.count_seeks != 1);
+
+	mtbl_merger_destroy(&m);
+	mtbl_reader_destroy(&r0);
+	mtbl_reader_destroy(&r1);
+	return (ret);
+}
+
+static void *
+lookup_thr(void *arg)
+{
+	const struct mtbl_source *s = (const struct mtbl_source *) arg;
+	unsigned seed = (unsigned) (uintptr_t) pthread_self();
+
+	for (unsigned i = 0; i < NUM_OPS; i++) {
+		char key[16];
+		test_fmt_key(key, rand_r(&seed) % NUM_KEYS);
+		drain(mtbl_source_get(s, (const uint8_t *) key, strlen(key)));
+	}
+	return (NULL);
+}
+
+/* no updates are lost when the counters are updated from many threads */
+static int
+test4(void)
+{
+	pthread_t thr[NUM_THREADS];
+	struct mtbl_reader_stats st;
+	struct mtbl_reader *r = make_reader(0, 1, false);
+	if (r == NULL)
+		return (1);
+
+	for (unsigned i = 0; i < NUM_THREADS; i++)
+		pthread_create(&thr[i], NULL, lookup_thr, (void *) mtbl_reader_source(r));
+	for (unsigned i = 0; i < NUM_THREADS; i++)
+		pthread_join(thr[i], NULL);
+
+	mtbl_reader_stats(r, &st);
+	int ret = (st.count_iters != NUM_THREADS * NUM_OPS ||
+		   st.count_index_seeks != NUM_THREADS * NUM_OPS ||
+		   st.count_blocks_read < NUM_THREADS * NUM_OPS);
+	mtbl_reader_destroy(&r);
+	return (ret);
+}
+
+static int
+check(int ret, const char *s)
+{
+	if (ret == 0)
+		fprintf(stderr, NAME ": PASS: %s\n", s);
+	else
+		fprintf(stderr, NAME ": FAIL: %s\n", s);
+	return (ret);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+
+	ret |= check(test1(), "test1");
+	ret |= check(test2(), "test2");
+	ret |= check(test3(), "test3");
+	ret |= check(test4(), "test4");
+
+	if (ret)
+		return (EXIT_FAILURE);
+	return (EXIT_SUCCESS);
+}